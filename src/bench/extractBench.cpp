@@ -0,0 +1,169 @@
+// Compares built-in archive extractor with external tools (tar, unzip) on package archives.
+// Archives are given in command line or found in distr directory by URLs of package build files
+#include "cxx-pm-config.h"
+#include "exec.h"
+#include "extract.h"
+#include "strExtras.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum CmdLineOptsTy {
+  clOptHelp = 1,
+  clOptPackageRoot,
+  clOptDistrDir,
+  clOptRounds,
+  clOptThreads
+};
+
+static option cmdLineOpts[] = {
+  {"package-root", required_argument, nullptr, clOptPackageRoot},
+  {"distr-dir", required_argument, nullptr, clOptDistrDir},
+  {"rounds", required_argument, nullptr, clOptRounds},
+  {"threads", required_argument, nullptr, clOptThreads},
+  {"help", no_argument, nullptr, clOptHelp},
+  {nullptr, 0, nullptr, 0}
+};
+
+static void printHelpMessage()
+{
+  printf("cxx-pm-extract-bench [options] [archive...]\n");
+  printf("  --package-root=<dir>: directory with packages/ folder, archives named in URL variables are searched in distr directory\n");
+  printf("  --distr-dir=<dir>: downloaded archives directory, ~/.cxxpm/distr by default\n");
+  printf("  --rounds=<n>: runs of each extractor, best time is reported (3 by default)\n");
+  printf("  --threads=<n>: threads of parallel built-in extraction, all cores by default\n");
+}
+
+// Archive file names from URL="..." and <System>_URL="..." lines of build files
+static void collectArchives(const std::filesystem::path &packageRoot, const std::filesystem::path &distrDir, std::set<std::filesystem::path> &archives)
+{
+  std::error_code ec;
+  for (const auto &package: std::filesystem::directory_iterator(packageRoot / "packages", ec)) {
+    for (const auto &file: std::filesystem::directory_iterator(package.path(), ec)) {
+      if (file.path().extension() != ".build")
+        continue;
+      std::ifstream stream(file.path());
+      std::string line;
+      while (std::getline(stream, line)) {
+        size_t pos = line.find("URL=\"");
+        if (pos == line.npos)
+          continue;
+        std::string url = line.substr(pos + 5, line.find('"', pos + 5) - pos - 5);
+        std::filesystem::path path = distrDir / url.substr(url.rfind('/') + 1);
+        if (archiveExtractSupported(path) && std::filesystem::exists(path, ec))
+          archives.insert(path);
+      }
+    }
+  }
+}
+
+// Best wall time of rounds, destination is cleaned before each run; negative on failure
+static double measure(const std::filesystem::path &destination, unsigned rounds, const std::function<bool(CProcessStats&)> &extract)
+{
+  double best = -1.0;
+  for (unsigned i = 0; i < rounds; i++) {
+    std::error_code ec;
+    std::filesystem::remove_all(destination, ec);
+    std::filesystem::create_directories(destination, ec);
+    CProcessStats stats;
+    if (!extract(stats))
+      return -1.0;
+    if (best < 0.0 || stats.WallTime < best)
+      best = stats.WallTime;
+  }
+  return best;
+}
+
+static void printResult(double seconds, uintmax_t archiveSize)
+{
+  if (seconds >= 0.0)
+    printf(" %8.3fs %7.1fMB/s", seconds, archiveSize / seconds / 1048576.0);
+  else
+    printf(" %8s %12s", "failed", "");
+}
+
+int main(int argc, char **argv)
+{
+  std::filesystem::path packageRoot;
+  std::filesystem::path distrDir;
+  unsigned rounds = 3;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  const char *home = getenv("HOME");
+  if (home)
+    distrDir = std::filesystem::path(home) / ".cxxpm" / "distr";
+
+  int res;
+  int index = 0;
+  while ((res = getopt_long(argc, argv, "", cmdLineOpts, &index)) != -1) {
+    switch (res) {
+      case clOptPackageRoot :
+        packageRoot = optarg;
+        break;
+      case clOptDistrDir :
+        distrDir = optarg;
+        break;
+      case clOptRounds :
+        rounds = std::max(1, atoi(optarg));
+        break;
+      case clOptThreads :
+        threads = std::max(1, atoi(optarg));
+        break;
+      case clOptHelp :
+        printHelpMessage();
+        return 0;
+      default :
+        return 1;
+    }
+  }
+
+  std::set<std::filesystem::path> archives;
+  for (int i = optind; i < argc; i++)
+    archives.insert(argv[i]);
+  if (!packageRoot.empty())
+    collectArchives(packageRoot, distrDir, archives);
+  if (archives.empty()) {
+    fprintf(stderr, "ERROR: no archives found, specify them in command line or use --package-root\n");
+    return 1;
+  }
+
+  std::filesystem::path destination = std::filesystem::temp_directory_path() / "cxx-pm-extract-bench";
+  printf("%-48s %21s %21s %21s\n", "archive", "external", "built-in 1 thread", ("built-in " + std::to_string(threads) + " threads").c_str());
+  for (const auto &archive: archives) {
+    std::error_code ec;
+    uintmax_t archiveSize = std::filesystem::file_size(archive, ec);
+    std::string archiveName = archive.filename().string();
+    printf("%-48s", archiveName.c_str());
+    fflush(stdout);
+
+    bool zip = endsWith(archiveName, ".zip");
+    printResult(measure(destination, rounds, [&](CProcessStats &stats) {
+      // GNU tar detects compression by itself
+      return zip ?
+        runNoCapture(".", "unzip", {"-o", "-q", archive.string(), "-d", destination.string()}, {}, true, &stats) :
+        runNoCapture(".", "tar", {"-xf", archive.string(), "-C", destination.string()}, {}, true, &stats);
+    }), archiveSize);
+    fflush(stdout);
+
+    for (unsigned threadsNum: {1u, threads}) {
+      printResult(measure(destination, rounds, [&](CProcessStats &stats) {
+        std::string sha3;
+        return archiveExtract(archive, destination, sha3, 0, &stats, threadsNum) == EExtractResult::Success;
+      }), archiveSize);
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+
+  std::error_code ec;
+  std::filesystem::remove_all(destination, ec);
+  return 0;
+}
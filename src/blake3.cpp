@@ -0,0 +1,630 @@
+#include "blake3.h"
+#include "fileio.h"
+#include "hashCache.h"
+#include "strExtras.h"
+
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BLAKE3_X86 1
+#endif
+
+#ifdef _MSC_VER
+#define FORCE_INLINE static __forceinline
+#else
+#define FORCE_INLINE static inline __attribute__((always_inline))
+#endif
+
+static inline unsigned popcount64(uint64_t x)
+{
+#ifdef _MSC_VER
+  // POPCNT instruction is not required by x86-64 baseline
+  x = x - ((x >> 1) & 0x5555555555555555ull);
+  x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+  return static_cast<unsigned>((x * 0x0101010101010101ull) >> 56);
+#else
+  return static_cast<unsigned>(__builtin_popcountll(x));
+#endif
+}
+
+// Index of highest set bit, x must not be zero
+static inline unsigned highestBit64(uint64_t x)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+  unsigned long index;
+  _BitScanReverse64(&index, x);
+  return static_cast<unsigned>(index);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  if (_BitScanReverse(&index, static_cast<uint32_t>(x >> 32)))
+    return static_cast<unsigned>(index) + 32;
+  _BitScanReverse(&index, static_cast<uint32_t>(x));
+  return static_cast<unsigned>(index);
+#else
+  return 63 - static_cast<unsigned>(__builtin_clzll(x));
+#endif
+}
+
+static constexpr size_t blockSize = 64;
+static constexpr size_t chunkSize = 1024;
+static constexpr unsigned maxLanes = 16;
+
+enum : uint8_t {
+  ChunkStart = 1,
+  ChunkEnd = 2,
+  Parent = 4,
+  Root = 8
+};
+
+static constexpr uint32_t IV[8] = {
+  0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+  0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+// Message word order for each of 7 rounds, permutation applied to previous round order
+struct MessageSchedule {
+  uint8_t Index[7][16];
+  constexpr MessageSchedule() : Index() {
+    constexpr uint8_t permutation[16] = {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8};
+    for (unsigned i = 0; i < 16; i++)
+      Index[0][i] = i;
+    for (unsigned r = 1; r < 7; r++) {
+      for (unsigned i = 0; i < 16; i++)
+        Index[r][i] = Index[r-1][permutation[i]];
+    }
+  }
+};
+
+static constexpr MessageSchedule schedule;
+
+static inline uint32_t load32(const uint8_t *p)
+{
+  return static_cast<uint32_t>(p[0]) |
+         (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline void store32(uint8_t *p, uint32_t v)
+{
+  p[0] = static_cast<uint8_t>(v);
+  p[1] = static_cast<uint8_t>(v >> 8);
+  p[2] = static_cast<uint8_t>(v >> 16);
+  p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+// Round function is shared by scalar and vector code: T is uint32_t or GCC vector of them
+template<typename T>
+FORCE_INLINE void xorRotr32(T &x, const T &y, unsigned n)
+{
+  x ^= y;
+  x = (x >> n) | (x << (32 - n));
+}
+
+template<typename T>
+FORCE_INLINE void g(T *v, unsigned a, unsigned b, unsigned c, unsigned d, const T &x, const T &y)
+{
+  v[a] = v[a] + v[b] + x;
+  xorRotr32(v[d], v[a], 16);
+  v[c] = v[c] + v[d];
+  xorRotr32(v[b], v[c], 12);
+  v[a] = v[a] + v[b] + y;
+  xorRotr32(v[d], v[a], 8);
+  v[c] = v[c] + v[d];
+  xorRotr32(v[b], v[c], 7);
+}
+
+template<typename T>
+FORCE_INLINE void rounds(T *v, const T *m)
+{
+  for (unsigned r = 0; r < 7; r++) {
+    const uint8_t *s = schedule.Index[r];
+    g(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    g(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    g(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    g(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    g(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    g(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    g(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    g(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+}
+
+static void compress(const uint32_t cv[8], const uint8_t block[64], uint8_t blockLen, uint64_t counter, uint8_t flags, uint32_t out[16])
+{
+  uint32_t m[16];
+  for (unsigned i = 0; i < 16; i++)
+    m[i] = load32(block + i*4);
+
+  uint32_t v[16] = {
+    cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+    IV[0], IV[1], IV[2], IV[3],
+    static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), blockLen, flags
+  };
+
+  rounds(v, m);
+  for (unsigned i = 0; i < 8; i++) {
+    out[i] = v[i] ^ v[i+8];
+    out[i+8] = v[i+8] ^ cv[i];
+  }
+}
+
+static void compressInPlace(uint32_t cv[8], const uint8_t block[64], uint8_t blockLen, uint64_t counter, uint8_t flags)
+{
+  uint32_t out[16];
+  compress(cv, block, blockLen, counter, flags, out);
+  memcpy(cv, out, 32);
+}
+
+// Hashes count inputs of blocks*64 bytes each, writes chaining values to out[i*32];
+// lane i uses counter + i if incrementCounter is set
+typedef void HashManyFn(const uint8_t *const *inputs, size_t blocks, uint64_t counter, bool incrementCounter,
+                        uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd, uint8_t *out);
+
+static void hashManyPortable(const uint8_t *const *inputs, size_t count, size_t blocks, uint64_t counter, bool incrementCounter,
+                             uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd, uint8_t *out)
+{
+  for (size_t i = 0; i < count; i++) {
+    uint32_t cv[8];
+    memcpy(cv, IV, sizeof(cv));
+    for (size_t b = 0; b < blocks; b++) {
+      uint8_t blockFlags = flags | (b == 0 ? flagsStart : 0) | (b == blocks-1 ? flagsEnd : 0);
+      compressInPlace(cv, inputs[i] + b*blockSize, blockSize, counter + (incrementCounter ? i : 0), blockFlags);
+    }
+    for (unsigned j = 0; j < 8; j++)
+      store32(out + i*32 + j*4, cv[j]);
+  }
+}
+
+#ifdef BLAKE3_X86
+// Lane j of vector holds state of input j; kernel is instantiated inside
+// functions compiled for specific instruction set
+template<typename V, unsigned N>
+FORCE_INLINE void hashManyVector(const uint8_t *const *inputs, size_t blocks, uint64_t counter, bool incrementCounter,
+                                                                  uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd, uint8_t *out)
+{
+  V h[8];
+  V counterLo;
+  V counterHi;
+  for (unsigned i = 0; i < 8; i++) {
+    for (unsigned j = 0; j < N; j++)
+      h[i][j] = IV[i];
+  }
+  for (unsigned j = 0; j < N; j++) {
+    uint64_t c = counter + (incrementCounter ? j : 0);
+    counterLo[j] = static_cast<uint32_t>(c);
+    counterHi[j] = static_cast<uint32_t>(c >> 32);
+  }
+
+  for (size_t b = 0; b < blocks; b++) {
+    uint32_t words[16][N];
+    for (unsigned j = 0; j < N; j++) {
+      const uint8_t *block = inputs[j] + b*blockSize;
+      for (unsigned i = 0; i < 16; i++)
+        memcpy(&words[i][j], block + i*4, 4);
+    }
+
+    V m[16];
+    memcpy(m, words, sizeof(m));
+
+    uint32_t blockFlags = flags | (b == 0 ? flagsStart : 0) | (b == blocks-1 ? flagsEnd : 0);
+    V v[16];
+    for (unsigned i = 0; i < 8; i++)
+      v[i] = h[i];
+    for (unsigned i = 0; i < 4; i++)
+      v[8+i] = V{} + IV[i];
+    v[12] = counterLo;
+    v[13] = counterHi;
+    v[14] = V{} + static_cast<uint32_t>(blockSize);
+    v[15] = V{} + blockFlags;
+
+    rounds(v, m);
+    for (unsigned i = 0; i < 8; i++)
+      h[i] = v[i] ^ v[i+8];
+  }
+
+  for (unsigned j = 0; j < N; j++) {
+    for (unsigned i = 0; i < 8; i++)
+      memcpy(out + j*32 + i*4, &h[i][j], 4);
+  }
+}
+
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+typedef uint32_t u32x16 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2")))
+static void hashMany8Avx2(const uint8_t *const *inputs, size_t blocks, uint64_t counter, bool incrementCounter,
+                          uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd, uint8_t *out)
+{
+  hashManyVector<u32x8, 8>(inputs, blocks, counter, incrementCounter, flags, flagsStart, flagsEnd, out);
+}
+
+__attribute__((target("avx512f")))
+static void hashMany16Avx512(const uint8_t *const *inputs, size_t blocks, uint64_t counter, bool incrementCounter,
+                             uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd, uint8_t *out)
+{
+  hashManyVector<u32x16, 16>(inputs, blocks, counter, incrementCounter, flags, flagsStart, flagsEnd, out);
+}
+
+static bool hashManySelftest(HashManyFn *fn, unsigned n)
+{
+  uint8_t data[maxLanes * 2 * blockSize];
+  const uint8_t *inputs[maxLanes];
+  uint8_t out[maxLanes * 32];
+  uint8_t ref[maxLanes * 32];
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = static_cast<uint8_t>(i * 251 + 7);
+  for (unsigned j = 0; j < n; j++)
+    inputs[j] = data + j*2*blockSize;
+
+  uint64_t counter = 0xFFFFFFFEull;
+  fn(inputs, 2, counter, true, 0, ChunkStart, ChunkEnd, out);
+  hashManyPortable(inputs, n, 2, counter, true, 0, ChunkStart, ChunkEnd, ref);
+  return memcmp(out, ref, n*32) == 0;
+}
+#endif
+
+struct HashManyImpl {
+  HashManyFn *Fn = nullptr;
+  unsigned Lanes = 1;
+};
+
+// Kernels usable on this CPU, from portable to widest
+static std::vector<std::pair<std::string, HashManyImpl>> availableKernels()
+{
+  std::vector<std::pair<std::string, HashManyImpl>> kernels = { { "portable", HashManyImpl() } };
+#ifdef BLAKE3_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && hashManySelftest(hashMany8Avx2, 8))
+    kernels.push_back({ "avx2", { hashMany8Avx2, 8 } });
+  if (__builtin_cpu_supports("avx512f") && hashManySelftest(hashMany16Avx512, 16))
+    kernels.push_back({ "avx512", { hashMany16Avx512, 16 } });
+#endif
+  return kernels;
+}
+
+// Overrides set by tests, see blake3ForceKernel and blake3ForceThreading
+static bool gKernelForced = false;
+static HashManyImpl gForcedKernel;
+static unsigned gForcedThreads = 0;
+static size_t gParallelThreshold = 1u << 21;
+
+static void hashMany(const uint8_t *const *inputs, size_t count, size_t blocks, uint64_t counter, bool incrementCounter,
+                     uint8_t flags, uint8_t flagsStart, uint8_t flagsEnd, uint8_t *out)
+{
+  static const HashManyImpl defaultImpl = availableKernels().back().second;
+  const HashManyImpl &impl = gKernelForced ? gForcedKernel : defaultImpl;
+  if (impl.Fn) {
+    while (count >= impl.Lanes) {
+      impl.Fn(inputs, blocks, counter, incrementCounter, flags, flagsStart, flagsEnd, out);
+      inputs += impl.Lanes;
+      count -= impl.Lanes;
+      out += impl.Lanes*32;
+      if (incrementCounter)
+        counter += impl.Lanes;
+    }
+  }
+
+  hashManyPortable(inputs, count, blocks, counter, incrementCounter, flags, flagsStart, flagsEnd, out);
+}
+
+// Chaining values of complete chunks
+static void compressChunks(const uint8_t *input, size_t chunks, uint64_t counter, uint8_t *cvs)
+{
+  const uint8_t *inputs[maxLanes];
+  for (size_t i = 0; i < chunks; i += maxLanes) {
+    size_t count = std::min<size_t>(chunks - i, maxLanes);
+    for (size_t j = 0; j < count; j++)
+      inputs[j] = input + (i+j)*chunkSize;
+    hashMany(inputs, count, chunkSize / blockSize, counter + i, true, 0, ChunkStart, ChunkEnd, cvs + i*32);
+  }
+}
+
+// Replaces pairs of chaining values with their parents, works in place
+static void compressParents(const uint8_t *cvs, size_t parents, uint8_t *out)
+{
+  const uint8_t *inputs[maxLanes];
+  for (size_t i = 0; i < parents; i += maxLanes) {
+    size_t count = std::min<size_t>(parents - i, maxLanes);
+    for (size_t j = 0; j < count; j++)
+      inputs[j] = cvs + (i+j)*64;
+    hashMany(inputs, count, 1, 0, false, Parent, 0, 0, out + i*32);
+  }
+}
+
+// Chaining value of subtree of complete chunks, number of chunks is a power of 2.
+// Subtrees of gParallelThreshold bytes and more are split between threads
+static void compressSubtree(const uint8_t *input, size_t size, uint64_t counter, unsigned threads, uint8_t cv[32])
+{
+  static constexpr size_t groupChunks = 64;
+
+  size_t chunks = size / chunkSize;
+  if (chunks <= groupChunks) {
+    uint8_t cvs[groupChunks*32];
+    compressChunks(input, chunks, counter, cvs);
+    for (; chunks > 1; chunks /= 2)
+      compressParents(cvs, chunks / 2, cvs);
+    memcpy(cv, cvs, 32);
+    return;
+  }
+
+  size_t half = size / 2;
+  uint8_t block[64];
+  if (threads > 1 && size >= gParallelThreshold) {
+    unsigned leftThreads = threads / 2;
+    std::thread thread([&]() { compressSubtree(input, half, counter, leftThreads, block); });
+    compressSubtree(input + half, half, counter + chunks/2, threads - leftThreads, block + 32);
+    thread.join();
+  } else {
+    compressSubtree(input, half, counter, 1, block);
+    compressSubtree(input + half, half, counter + chunks/2, 1, block + 32);
+  }
+
+  compressParents(block, 1, cv);
+}
+
+static void parentCV(const uint8_t *block, uint8_t cv[32])
+{
+  compressParents(block, 1, cv);
+}
+
+Blake3Hasher::Blake3Hasher()
+{
+  chunkReset(0);
+}
+
+void Blake3Hasher::chunkReset(uint64_t counter)
+{
+  memcpy(Chunk_.CV, IV, sizeof(Chunk_.CV));
+  Chunk_.Counter = counter;
+  memset(Chunk_.Buffer, 0, sizeof(Chunk_.Buffer));
+  Chunk_.BufferSize = 0;
+  Chunk_.BlocksCompressed = 0;
+}
+
+void Blake3Hasher::chunkUpdate(const uint8_t *data, size_t size)
+{
+  while (size) {
+    // Last block of chunk stays in buffer until it known whether chunk is root
+    if (Chunk_.BufferSize == blockSize) {
+      uint8_t flags = Chunk_.BlocksCompressed == 0 ? ChunkStart : 0;
+      compressInPlace(Chunk_.CV, Chunk_.Buffer, blockSize, Chunk_.Counter, flags);
+      Chunk_.BlocksCompressed++;
+      Chunk_.BufferSize = 0;
+      memset(Chunk_.Buffer, 0, sizeof(Chunk_.Buffer));
+    }
+
+    size_t take = std::min(blockSize - Chunk_.BufferSize, size);
+    memcpy(Chunk_.Buffer + Chunk_.BufferSize, data, take);
+    Chunk_.BufferSize += static_cast<uint8_t>(take);
+    data += take;
+    size -= take;
+  }
+}
+
+void Blake3Hasher::mergeCVStack(uint64_t totalChunks)
+{
+  unsigned postMergeSize = popcount64(totalChunks);
+  while (CVStackSize_ > postMergeSize) {
+    uint8_t *block = CVStack_ + (CVStackSize_ - 2)*32;
+    parentCV(block, block);
+    CVStackSize_--;
+  }
+}
+
+void Blake3Hasher::pushCV(const uint8_t cv[32], uint64_t chunkCounter)
+{
+  mergeCVStack(chunkCounter);
+  memcpy(CVStack_ + CVStackSize_*32, cv, 32);
+  CVStackSize_++;
+}
+
+void Blake3Hasher::update(const void *data, size_t size)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+
+  // Finish partial chunk first
+  if (chunkLength() > 0) {
+    size_t take = std::min(chunkSize - chunkLength(), size);
+    chunkUpdate(p, take);
+    p += take;
+    size -= take;
+    if (size == 0)
+      return;
+
+    // More data follows, so this chunk is not root
+    uint32_t out[16];
+    uint8_t cv[32];
+    compress(Chunk_.CV, Chunk_.Buffer, Chunk_.BufferSize, Chunk_.Counter, (Chunk_.BlocksCompressed == 0 ? ChunkStart : 0) | ChunkEnd, out);
+    for (unsigned i = 0; i < 8; i++)
+      store32(cv + i*4, out[i]);
+    pushCV(cv, Chunk_.Counter);
+    chunkReset(Chunk_.Counter + 1);
+  }
+
+  // Hash largest complete subtrees aligned to chunks counter, last chunk stays in chunk state
+  unsigned threads = gForcedThreads ? gForcedThreads : std::max(1u, std::thread::hardware_concurrency());
+  while (size > chunkSize) {
+    size_t subtreeSize = size_t(1) << highestBit64(size);
+    uint64_t processed = Chunk_.Counter * chunkSize;
+    while ((subtreeSize - 1) & processed)
+      subtreeSize /= 2;
+    uint64_t subtreeChunks = subtreeSize / chunkSize;
+
+    if (subtreeChunks <= 1) {
+      uint8_t cv[32];
+      compressChunks(p, 1, Chunk_.Counter, cv);
+      pushCV(cv, Chunk_.Counter);
+    } else {
+      uint8_t cvs[64];
+      size_t half = subtreeSize / 2;
+      if (subtreeChunks == 2) {
+        compressChunks(p, 2, Chunk_.Counter, cvs);
+      } else if (threads > 1 && subtreeSize >= 2*gParallelThreshold) {
+        unsigned leftThreads = threads / 2;
+        std::thread thread([&]() { compressSubtree(p, half, Chunk_.Counter, leftThreads, cvs); });
+        compressSubtree(p + half, half, Chunk_.Counter + subtreeChunks/2, threads - leftThreads, cvs + 32);
+        thread.join();
+      } else {
+        compressSubtree(p, half, Chunk_.Counter, 1, cvs);
+        compressSubtree(p + half, half, Chunk_.Counter + subtreeChunks/2, 1, cvs + 32);
+      }
+      pushCV(cvs, Chunk_.Counter);
+      pushCV(cvs + 32, Chunk_.Counter + subtreeChunks/2);
+    }
+
+    Chunk_.Counter += subtreeChunks;
+    p += subtreeSize;
+    size -= subtreeSize;
+  }
+
+  if (size) {
+    chunkUpdate(p, size);
+    mergeCVStack(Chunk_.Counter);
+  }
+}
+
+void Blake3Hasher::final(uint8_t hash[32])
+{
+  // Output node: chaining value, block, block length, counter and flags
+  uint32_t cv[8];
+  uint8_t block[64];
+  uint8_t blockLen;
+  uint64_t counter;
+  uint8_t flags;
+  unsigned cvsRemaining;
+
+  if (chunkLength() > 0 || CVStackSize_ == 0) {
+    memcpy(cv, Chunk_.CV, sizeof(cv));
+    memcpy(block, Chunk_.Buffer, sizeof(block));
+    blockLen = Chunk_.BufferSize;
+    counter = Chunk_.Counter;
+    flags = (Chunk_.BlocksCompressed == 0 ? ChunkStart : 0) | ChunkEnd;
+    cvsRemaining = CVStackSize_;
+  } else {
+    cvsRemaining = CVStackSize_ - 2;
+    memcpy(cv, IV, sizeof(cv));
+    memcpy(block, CVStack_ + cvsRemaining*32, 64);
+    blockLen = blockSize;
+    counter = 0;
+    flags = Parent;
+  }
+
+  while (cvsRemaining > 0) {
+    cvsRemaining--;
+    uint32_t out[16];
+    compress(cv, block, blockLen, counter, flags, out);
+    memcpy(block, CVStack_ + cvsRemaining*32, 32);
+    for (unsigned i = 0; i < 8; i++)
+      store32(block + 32 + i*4, out[i]);
+    memcpy(cv, IV, sizeof(cv));
+    blockLen = blockSize;
+    counter = 0;
+    flags = Parent;
+  }
+
+  uint32_t out[16];
+  compress(cv, block, blockLen, 0, flags | Root, out);
+  for (unsigned i = 0; i < 8; i++)
+    store32(hash + i*4, out[i]);
+}
+
+static std::string blake3Hex(const uint8_t *hash)
+{
+  char hex[72] = {0};
+  bin2hexLowerCase(hash, hex, 32);
+  return hex;
+}
+
+std::string blake3FileHash(const std::filesystem::path &path)
+{
+  CFileStamp stamp;
+  std::string cachedHash;
+  if (hashCacheLookup(path, "blake3", stamp, cachedHash))
+    return cachedHash;
+
+  // Large files are mapped at once, so whole file goes to update in one call
+  // and its subtrees are hashed by all threads
+  Blake3Hasher hasher;
+  InputFile file;
+  if (!file.open(path) ||
+      !file.readAll([&hasher](const uint8_t *data, size_t size) { hasher.update(data, size); }))
+    return std::string();
+
+  uint8_t hash[32];
+  hasher.final(hash);
+  std::string hex = blake3Hex(hash);
+  hashCacheStore(path, "blake3", stamp, hex);
+  return hex;
+}
+
+std::string blake3StringHash(const std::string &s)
+{
+  uint8_t hash[32];
+  Blake3Hasher hasher;
+  hasher.update(s.data(), s.size());
+  hasher.final(hash);
+  return blake3Hex(hash);
+}
+
+void blake3FilesHash(const std::vector<std::filesystem::path> &paths, std::vector<std::string> &hashes)
+{
+  auto fileHash = [](InputFile &file) -> std::string {
+    Blake3Hasher hasher;
+    if (!file.readAll([&hasher](const uint8_t *data, size_t size) { hasher.update(data, size); }))
+      return std::string();
+    uint8_t hash[32];
+    hasher.final(hash);
+    return blake3Hex(hash);
+  };
+
+  // Small files are hashed one by one, each fits few chunks
+  auto multiHash = [](const std::string_view *messages, size_t count, std::string *hashes) {
+    for (size_t i = 0; i < count; i++) {
+      uint8_t hash[32];
+      Blake3Hasher hasher;
+      hasher.update(messages[i].data(), messages[i].size());
+      hasher.final(hash);
+      hashes[i] = blake3Hex(hash);
+    }
+  };
+
+  hashFilesBatched(paths, "blake3", fileHash, multiHash, hashes);
+}
+
+std::vector<std::string> blake3Kernels()
+{
+  std::vector<std::string> names;
+  for (const auto &kernel: availableKernels())
+    names.push_back(kernel.first);
+  return names;
+}
+
+bool blake3ForceKernel(const std::string &name)
+{
+  if (name.empty()) {
+    gKernelForced = false;
+    return true;
+  }
+
+  for (const auto &kernel: availableKernels()) {
+    if (kernel.first == name) {
+      gForcedKernel = kernel.second;
+      gKernelForced = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+void blake3ForceThreading(unsigned threads, size_t parallelThreshold)
+{
+  gForcedThreads = threads;
+  gParallelThreshold = parallelThreshold ? parallelThreshold : (1u << 21);
+}
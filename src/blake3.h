@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// BLAKE3 hash function, 256-bit output only. Chunks and parent nodes are compressed
+// in parallel SIMD lanes (8 with AVX2, 16 with AVX-512), large inputs passed to
+// update at once are split to subtrees hashed by several threads
+class Blake3Hasher {
+public:
+  Blake3Hasher();
+  void update(const void *data, size_t size);
+  void final(uint8_t hash[32]);
+
+private:
+  struct ChunkState {
+    uint32_t CV[8];
+    uint64_t Counter;
+    uint8_t Buffer[64];
+    uint8_t BufferSize;
+    uint8_t BlocksCompressed;
+  };
+
+  ChunkState Chunk_;
+  // Chaining values of completed subtrees, one per set bit of chunks counter
+  uint8_t CVStack_[54*32];
+  unsigned CVStackSize_ = 0;
+
+  void chunkReset(uint64_t counter);
+  void chunkUpdate(const uint8_t *data, size_t size);
+  size_t chunkLength() const { return Chunk_.BlocksCompressed*64u + Chunk_.BufferSize; }
+  void mergeCVStack(uint64_t totalChunks);
+  void pushCV(const uint8_t cv[32], uint64_t chunkCounter);
+};
+
+std::string blake3FileHash(const std::filesystem::path &path);
+std::string blake3StringHash(const std::string &s);
+// Hashes list of files, small files are read in batches; hash of unreadable file is empty string
+void blake3FilesHash(const std::vector<std::filesystem::path> &paths, std::vector<std::string> &hashes);
+
+// For tests, not thread safe, call only while nothing is hashed.
+// Names of kernels supported by CPU, "portable" first, widest last
+std::vector<std::string> blake3Kernels();
+// Uses given kernel instead of widest one, empty name restores default
+bool blake3ForceKernel(const std::string &name);
+// Splits subtrees of parallelThreshold bytes and more between given number of threads,
+// zeros restore hardware concurrency and default threshold
+void blake3ForceThreading(unsigned threads, size_t parallelThreshold);
@@ -135,19 +135,33 @@ bool cmakeExport(const CPackage &package,
   std::vector<std::filesystem::path> prefixes;
   std::unordered_set<std::string> libSet;
 
+  ProcessEnvironment packageEnv;
+  preparePackageEnvironment(packageEnv, package, globalSettings, systemInfo, compilers, tools, verbose);
+
   bool firstRun = true;
   for (size_t i = 0, ie = systemInfo.BuildType.size(); i != ie; ++i) {
     std::string args;
-    std::vector<std::string> env;
-    prepareBuildEnvironment(env, package, globalSettings, systemInfo, compilers, tools, systemInfo.BuildType[i].MappedTo, verbose);
+    ProcessEnvironment env(packageEnv);
+    prepareBuildEnvironment(env, package, systemInfo, compilers, tools, systemInfo.BuildType[i].MappedTo, verbose);
 
     args = "set -x; set -e; source ";
     args.append(pathConvert(package.BuildFile, EPathType::Posix).string());
     args.append("; artifacts;");
-    std::filesystem::path fullPath;
     std::string capturedOut;
     std::string capturedErr;
-    if (!run(package.BuildFile.parent_path(), "bash", {"-c", args}, env, fullPath, capturedOut, capturedErr, true)) {
+    bool result = runStreamOutput(package.BuildFile.parent_path(), "bash", {"-c", args}, env, [&capturedOut, &capturedErr](EOutputStream stream, const char *data, size_t size) {
+      if (stream == EOutputStream::StdOut) {
+        capturedOut.append(data, size);
+      } else {
+        // "set -x" trace is needed for error report only, keep its tail
+        static constexpr size_t traceLimit = 1u << 16;
+        capturedErr.append(data, size);
+        if (capturedErr.size() > 2*traceLimit)
+          capturedErr.erase(0, capturedErr.size() - traceLimit);
+      }
+      return true;
+    }, true, true);
+    if (!result) {
       fprintf(stderr, "ERROR: can't get build artifacts for %s\n", package.Name.c_str());
       fprintf(stderr, "%s\n", capturedErr.c_str());
       return false;
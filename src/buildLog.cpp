@@ -0,0 +1,145 @@
+#include "buildLog.h"
+
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef CXXPM_HAVE_ZSTD
+#include <zstd.h>
+
+// Fast level, build output compresses well anyway
+static constexpr int compressionLevel = 3;
+#endif
+
+BuildLog::~BuildLog()
+{
+  close();
+}
+
+bool BuildLog::open(const std::filesystem::path &path)
+{
+  Path_ = path;
+#ifdef CXXPM_HAVE_ZSTD
+  Path_ += ".zst";
+  Compressed_ = true;
+  Context_ = ZSTD_createCCtx();
+  if (!Context_)
+    return false;
+  ZSTD_CCtx_setParameter(Context_, ZSTD_c_compressionLevel, compressionLevel);
+  OutBuffer_.resize(ZSTD_CStreamOutSize());
+  Ring_.resize(TailSize_);
+#endif
+  File_ = fopen(Path_.string().c_str(), "w+b");
+  return File_ != nullptr;
+}
+
+bool BuildLog::close()
+{
+  if (!File_)
+    return true;
+
+  bool success = true;
+#ifdef CXXPM_HAVE_ZSTD
+  success = compress(nullptr, 0, ZSTD_e_end);
+  ZSTD_freeCCtx(Context_);
+  Context_ = nullptr;
+#endif
+  success &= fclose(File_) == 0;
+  File_ = nullptr;
+  return success;
+}
+
+#ifdef CXXPM_HAVE_ZSTD
+bool BuildLog::compress(const void *data, size_t size, int mode)
+{
+  ZSTD_inBuffer input = {data, size, 0};
+  for (;;) {
+    ZSTD_outBuffer output = {OutBuffer_.data(), OutBuffer_.size(), 0};
+    size_t remaining = ZSTD_compressStream2(Context_, &output, &input, static_cast<ZSTD_EndDirective>(mode));
+    if (ZSTD_isError(remaining))
+      return false;
+    if (output.pos && fwrite(OutBuffer_.data(), 1, output.pos, File_) != output.pos)
+      return false;
+    // continue: all input consumed; flush/end: internal buffers are empty
+    if (mode == ZSTD_e_continue ? input.pos == input.size : remaining == 0)
+      return true;
+  }
+}
+#endif
+
+void BuildLog::write(const void *data, size_t size)
+{
+  if (!File_)
+    return;
+  if (!Compressed_) {
+    fwrite(data, 1, size, File_);
+    return;
+  }
+
+#ifdef CXXPM_HAVE_ZSTD
+  compress(data, size, ZSTD_e_continue);
+
+  // Only last TailSize_ bytes can stay in ring
+  const char *p = static_cast<const char*>(data);
+  if (size >= TailSize_) {
+    p += size - TailSize_;
+    size = TailSize_;
+  }
+  while (size) {
+    size_t chunk = std::min(size, TailSize_ - RingPos_);
+    memcpy(Ring_.data() + RingPos_, p, chunk);
+    RingPos_ += chunk;
+    if (RingPos_ == TailSize_) {
+      RingPos_ = 0;
+      RingFull_ = true;
+    }
+    p += chunk;
+    size -= chunk;
+  }
+#endif
+}
+
+void BuildLog::print(const char *format, ...)
+{
+  char buffer[1024];
+  va_list args;
+  va_start(args, format);
+  int size = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (size <= 0)
+    return;
+
+  write(buffer, std::min(static_cast<size_t>(size), sizeof(buffer) - 1));
+#ifdef CXXPM_HAVE_ZSTD
+  // Messages are written at phase boundaries, make log decodable up to this point
+  if (File_) {
+    compress(nullptr, 0, ZSTD_e_flush);
+    fflush(File_);
+  }
+#endif
+}
+
+std::string BuildLog::tail()
+{
+  if (Compressed_) {
+    if (!RingFull_)
+      return std::string(Ring_.data(), RingPos_);
+    std::string result(Ring_.data() + RingPos_, TailSize_ - RingPos_);
+    result.append(Ring_.data(), RingPos_);
+    return result;
+  }
+
+  if (!File_)
+    return std::string();
+
+  // Plain log can be written through its descriptor, read tail from disk
+  fflush(File_);
+  fseek(File_, 0, SEEK_END);
+  long size = ftell(File_);
+  long offset = size > static_cast<long>(TailSize_) ? size - static_cast<long>(TailSize_) : 0;
+  std::string result(size - offset, '\0');
+  fseek(File_, offset, SEEK_SET);
+  result.resize(fread(result.data(), 1, result.size(), File_));
+  fseek(File_, 0, SEEK_END);
+  return result;
+}
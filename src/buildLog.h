@@ -0,0 +1,45 @@
+#pragma once
+
+#include "cxx-pm-config.h"
+#include <stdio.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#ifdef CXXPM_HAVE_ZSTD
+typedef struct ZSTD_CCtx_s ZSTD_CCtx;
+#endif
+
+// Build output sink. When cxx-pm is built with zstd, log is compressed to "<path>.zst" and
+// last tailSize bytes are kept in memory ring buffer for error reports; otherwise log is
+// plain file and its tail is read back from disk
+class BuildLog {
+public:
+  BuildLog(size_t tailSize = 64*1024) : TailSize_(tailSize) {}
+  ~BuildLog();
+
+  bool open(const std::filesystem::path &path);
+  bool close();
+  const std::filesystem::path &path() const { return Path_; }
+  // Plain log file, output can be written to it directly; nullptr for compressed log
+  FILE *file() const { return Compressed_ ? nullptr : File_; }
+
+  void write(const void *data, size_t size);
+  void print(const char *format, ...);
+  std::string tail();
+
+private:
+  std::filesystem::path Path_;
+  FILE *File_ = nullptr;
+  bool Compressed_ = false;
+  size_t TailSize_;
+  std::vector<char> Ring_;
+  size_t RingPos_ = 0;
+  bool RingFull_ = false;
+#ifdef CXXPM_HAVE_ZSTD
+  ZSTD_CCtx *Context_ = nullptr;
+  std::vector<char> OutBuffer_;
+
+  bool compress(const void *data, size_t size, int mode);
+#endif
+};
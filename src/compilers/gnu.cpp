@@ -71,19 +71,13 @@ RawData clangCpuFromNormalized(RawData cpu)
 
 bool loadGNUSettings(CCompilerInfo &info, bool verbose)
 {
-  std::string capturedOut;
-  std::string capturedErr;
-  if (!run(".", info.Command, {"-v"}, {}, info.Command, capturedOut, capturedErr, false)) {
-    if (verbose)
-      fprintf(stderr, "Can't run %s\n", info.Command.string().c_str());
-    return false;
-  }
-
   std::string id;
-  StringSplitter splitter(capturedErr, "\r\n");
-  while (splitter.next()) {
+  info.Command = findExecutable(info.Command);
+  bool result = !info.Command.empty() && runStreamLines(".", info.Command, {"-v"}, {}, [&info, &id](EOutputStream stream, std::string_view line) {
+    if (stream != EOutputStream::StdErr)
+      return true;
+
     size_t pos;
-    auto line = splitter.get();
     pos = line.find("Target: ");
     if (pos != line.npos) {
       const char *begin = line.data() + pos + strlen("Target: ");
@@ -106,6 +100,14 @@ bool loadGNUSettings(CCompilerInfo &info, bool verbose)
       if (id.back() == ' ')
         id.pop_back();
     }
+
+    return true;
+  }, true, false);
+
+  if (!result) {
+    if (verbose)
+      fprintf(stderr, "Can't run %s\n", info.Command.string().c_str());
+    return false;
   }
 
   if (!id.empty()) {
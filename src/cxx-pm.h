@@ -1,9 +1,18 @@
 #pragma once
 
+#include "hash.h"
 #include <filesystem>
 
 struct CxxPmSettings {
   std::filesystem::path PackageRoot;
   std::filesystem::path HomeDir;
   std::filesystem::path DistrDir;
+  // Hash function for new manifests, existing ones keep their own
+  EHashAlgorithm ManifestHash = EHashAlgorithm::SHA3;
+  // Wall-clock limits of installation phases in seconds, 0 is no limit
+  unsigned DownloadTimeout = 0;
+  unsigned ExtractTimeout = 0;
+  unsigned BuildTimeout = 0;
+  // Build output is only written to log, failed build shows log tail
+  bool QuietBuild = false;
 };
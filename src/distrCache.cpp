@@ -0,0 +1,259 @@
+#include "distrCache.h"
+#include "sourceCache.h"
+#include "strExtras.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+static const char usageLogName[] = "usage.log";
+
+// Prefetch threads record uses concurrently
+static std::mutex gUsageLogMutex;
+
+struct CDistrCacheItem {
+  std::string Name;
+  std::vector<std::filesystem::path> Files;
+  int64_t Time = -1;
+  uint64_t Size = 0;
+  bool SizeKnown = false;
+  bool Referenced = false;
+  bool Evicted = false;
+};
+
+static int64_t unixTime()
+{
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// file_time_type clock has no conversion to system clock in C++17, offset between clocks is used
+static int64_t modificationTime(const std::filesystem::path &path)
+{
+  std::error_code ec;
+  auto mtime = std::filesystem::last_write_time(path, ec);
+  if (ec)
+    return 0;
+  auto offset = std::chrono::duration_cast<std::chrono::system_clock::duration>(mtime - std::filesystem::file_time_type::clock::now());
+  return std::chrono::duration_cast<std::chrono::seconds>((std::chrono::system_clock::now() + offset).time_since_epoch()).count();
+}
+
+static std::string itemName(const std::filesystem::path &distrDir, const std::filesystem::path &path)
+{
+  return path.lexically_relative(distrDir).generic_string();
+}
+
+static uint64_t diskUsage(const std::filesystem::path &path)
+{
+  std::error_code ec;
+  std::filesystem::file_status status = std::filesystem::symlink_status(path, ec);
+  if (ec)
+    return 0;
+  if (std::filesystem::is_regular_file(status)) {
+    uint64_t size = std::filesystem::file_size(path, ec);
+    return ec ? 0 : size;
+  }
+  if (!std::filesystem::is_directory(status))
+    return 0;
+
+  uint64_t size = 0;
+  for (auto it = std::filesystem::recursive_directory_iterator(path, ec), end = std::filesystem::recursive_directory_iterator(); !ec && it != end; it.increment(ec)) {
+    std::error_code sizeEc;
+    if (it->is_regular_file(sizeEc) && !it->is_symlink(sizeEc)) {
+      uint64_t fileSize = it->file_size(sizeEc);
+      if (!sizeEc)
+        size += fileSize;
+    }
+  }
+  return size;
+}
+
+// Archives with sidecar and download state files, git mirrors, source cache entries with file
+// lists. Temporary files and directories of unfinished operations are not items
+static void collectItems(const std::filesystem::path &distrDir, std::map<std::string, CDistrCacheItem> &items)
+{
+  std::error_code ec;
+  for (const auto &element: std::filesystem::directory_iterator(distrDir, ec)) {
+    std::error_code typeEc;
+    if (!element.is_regular_file(typeEc))
+      continue;
+    std::string name = element.path().filename().string();
+    if (startsWith(name, usageLogName) || startsWith(name, "tmp-"))
+      continue;
+    for (const char *suffix: { ".state", ".part", ".sha3" }) {
+      if (endsWith(name, suffix))
+        name.resize(name.size() - strlen(suffix));
+    }
+    items[name].Files.push_back(element.path());
+  }
+
+  for (const auto &element: std::filesystem::directory_iterator(distrDir / "git", ec)) {
+    std::error_code typeEc;
+    if (element.is_directory(typeEc) && element.path().extension() == ".git")
+      items[itemName(distrDir, element.path())].Files.push_back(element.path());
+  }
+
+  for (const auto &element: std::filesystem::directory_iterator(distrDir / "src", ec)) {
+    std::filesystem::path path = element.path();
+    if (path.extension() == ".tmp")
+      continue;
+    if (path.extension() == ".files")
+      path.replace_extension();
+    items[itemName(distrDir, path)].Files.push_back(element.path());
+  }
+
+  for (auto &item: items)
+    item.second.Name = item.first;
+}
+
+static void loadUsageLog(const std::filesystem::path &distrDir, std::map<std::string, CDistrCacheItem> &items)
+{
+  std::ifstream log(distrDir / usageLogName, std::ios::binary);
+  std::string line;
+  while (std::getline(log, line)) {
+    size_t first = line.find('\t');
+    if (first == line.npos)
+      continue;
+    size_t second = line.find('\t', first + 1);
+    std::string name = line.substr((second == line.npos ? first : second) + 1);
+    auto It = items.find(name);
+    if (It == items.end())
+      continue;
+
+    // Item used after log was rewritten could grow (git mirror fetched)
+    CDistrCacheItem &item = It->second;
+    item.Time = std::max<int64_t>(item.Time, strtoll(line.c_str(), nullptr, 10));
+    item.SizeKnown = second != line.npos;
+    if (item.SizeKnown)
+      item.Size = strtoull(line.c_str() + first + 1, nullptr, 10);
+  }
+}
+
+static bool removeItem(const std::filesystem::path &distrDir, const CDistrCacheItem &item)
+{
+  std::error_code ec;
+  if (startsWith(item.Name, "src/"))
+    sourceCacheRemove(distrDir / item.Name);
+  bool success = true;
+  for (const auto &file: item.Files) {
+    std::filesystem::remove_all(file, ec);
+    success &= !std::filesystem::exists(file, ec);
+  }
+  return success;
+}
+
+void distrCacheTouch(const std::filesystem::path &distrDir, const std::filesystem::path &path)
+{
+  std::string line = std::to_string(unixTime()) + "\t" + itemName(distrDir, path) + "\n";
+  std::lock_guard lock(gUsageLogMutex);
+  // Short line appended by single write is not mixed with lines of concurrent processes
+  FILE *hLog = fopen((distrDir / usageLogName).string().c_str(), "ab");
+  if (!hLog)
+    return;
+  fwrite(line.data(), 1, line.size(), hLog);
+  fclose(hLog);
+}
+
+void distrCacheAddReferences(const std::filesystem::path &referencesFile,
+                             const std::filesystem::path &distrDir,
+                             const std::vector<std::filesystem::path> &paths)
+{
+  FILE *hReferences = fopen(referencesFile.string().c_str(), "ab");
+  if (!hReferences) {
+    fprintf(stderr, "WARNING: can't open file %s\n", referencesFile.string().c_str());
+    return;
+  }
+  for (const auto &path: paths)
+    fprintf(hReferences, "%s\n", itemName(distrDir, path).c_str());
+  fclose(hReferences);
+}
+
+void distrCacheLoadReferences(const std::filesystem::path &referencesFile, std::set<std::string> &items)
+{
+  std::ifstream references(referencesFile, std::ios::binary);
+  std::string line;
+  while (std::getline(references, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (!line.empty())
+      items.insert(line);
+  }
+}
+
+bool distrCacheCollect(const std::filesystem::path &distrDir,
+                       uint64_t quota,
+                       const std::set<std::string> &referencedItems,
+                       CDistrCacheStats &stats)
+{
+  std::map<std::string, CDistrCacheItem> items;
+  collectItems(distrDir, items);
+  loadUsageLog(distrDir, items);
+
+  std::vector<CDistrCacheItem*> order;
+  for (auto &element: items) {
+    CDistrCacheItem &item = element.second;
+    if (item.Time < 0) {
+      for (const auto &file: item.Files)
+        item.Time = std::max(item.Time, modificationTime(file));
+    }
+    if (!item.SizeKnown) {
+      item.Size = 0;
+      for (const auto &file: item.Files)
+        item.Size += diskUsage(file);
+      item.SizeKnown = true;
+    }
+    item.Referenced = referencedItems.count(item.Name) != 0;
+    stats.Size += item.Size;
+    order.push_back(&item);
+  }
+  stats.ItemsNum = items.size();
+
+  std::sort(order.begin(), order.end(), [](const CDistrCacheItem *lhs, const CDistrCacheItem *rhs) {
+    return lhs->Referenced != rhs->Referenced ? rhs->Referenced : lhs->Time < rhs->Time;
+  });
+
+  bool success = true;
+  for (CDistrCacheItem *item: order) {
+    if (quota ? stats.Size <= quota : item->Referenced)
+      break;
+    printf("Evicting %s from distr cache (%.1f MB)\n", item->Name.c_str(), item->Size / 1048576.0);
+    if (!removeItem(distrDir, *item)) {
+      fprintf(stderr, "ERROR: can't remove %s\n", (distrDir / item->Name).string().c_str());
+      success = false;
+      continue;
+    }
+    stats.Size -= item->Size;
+    stats.EvictedNum++;
+    stats.EvictedSize += item->Size;
+    item->Evicted = true;
+  }
+
+  // Uses recorded by concurrent process while log is rewritten are lost, only order of eviction
+  // depends on them
+  std::filesystem::path logPath = distrDir / usageLogName;
+  std::filesystem::path logTmpPath = logPath;
+  logTmpPath += ".tmp";
+  {
+    std::ofstream log(logTmpPath, std::ios::binary | std::ios::trunc);
+    for (const auto &element: items) {
+      if (!element.second.Evicted)
+        log << element.second.Time << '\t' << element.second.Size << '\t' << element.first << '\n';
+    }
+    if (!log) {
+      fprintf(stderr, "ERROR: can't write file %s\n", logTmpPath.string().c_str());
+      return false;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(logTmpPath, logPath, ec);
+  if (ec) {
+    fprintf(stderr, "ERROR: can't rename %s to %s\n", logTmpPath.string().c_str(), logPath.string().c_str());
+    return false;
+  }
+  return success;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <vector>
+
+// Size bounded DistrDir. Cache items are archives (with their hash sidecar and partial download
+// files), git mirrors and source cache entries, named by path relative to DistrDir. Each use of
+// item is appended to "<DistrDir>/usage.log" as "<unix time>\t<item>" line, collector rewrites
+// log as "<unix time>\t<size>\t<item>" lines; size of item used since then is measured again.
+// File system access time is not used, relatime and noatime mounts don't keep it.
+// Item not found in log is treated as used at its modification time
+void distrCacheTouch(const std::filesystem::path &distrDir, const std::filesystem::path &path);
+
+// References of installed prefix to items it was built from, file lists item per line
+void distrCacheAddReferences(const std::filesystem::path &referencesFile,
+                             const std::filesystem::path &distrDir,
+                             const std::vector<std::filesystem::path> &paths);
+void distrCacheLoadReferences(const std::filesystem::path &referencesFile, std::set<std::string> &items);
+
+struct CDistrCacheStats {
+  size_t ItemsNum = 0;
+  uint64_t Size = 0;
+  size_t EvictedNum = 0;
+  uint64_t EvictedSize = 0;
+};
+
+// Evicts least recently used items until their total size fits quota, referenced items are
+// evicted only after all other ones. Zero quota evicts all items not referenced
+bool distrCacheCollect(const std::filesystem::path &distrDir,
+                       uint64_t quota,
+                       const std::set<std::string> &referencedItems,
+                       CDistrCacheStats &stats);
@@ -0,0 +1,518 @@
+#include "downloader.h"
+extern "C" {
+#include "tiny_sha3.h"
+}
+#include "exec.h"
+#include "fileio.h"
+#include "sha3.h"
+#include "strExtras.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#ifdef CXXPM_HAVE_CURL
+#include <curl/curl.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#endif
+
+static std::string hashToString(sha3_ctx_t &ctx)
+{
+  uint8_t hash[32];
+  char hex[72] = {0};
+  sha3_final(hash, &ctx, 0);
+  bin2hexLowerCase(hash, hex, 32);
+  return hex;
+}
+
+static std::filesystem::path statePath(const std::filesystem::path &path)
+{
+  std::filesystem::path state = path;
+  state += ".state";
+  return state;
+}
+
+void Downloader::discard(const std::filesystem::path &path)
+{
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+  std::filesystem::remove(statePath(path), ec);
+}
+
+#ifdef CXXPM_HAVE_CURL
+// Files smaller than threshold are downloaded by single connection
+static constexpr uint64_t segmentThreshold = 8u << 20;
+static constexpr uint64_t minSegmentSize = 2u << 20;
+static constexpr unsigned maxSegments = 4;
+// Attempts to continue interrupted segment
+static constexpr unsigned maxRetries = 5;
+static constexpr uint64_t unknownSize = UINT64_MAX;
+
+namespace {
+struct CTransfer;
+
+struct CSegment {
+  uint64_t Pos = 0;
+  uint64_t End = unknownSize;
+  bool Ranged = false;
+  bool Completed = false;
+  unsigned Retries = 0;
+  CURL *Handle = nullptr;
+  CTransfer *Transfer = nullptr;
+  char Error[CURL_ERROR_SIZE] = {0};
+};
+
+struct CTransfer {
+  FILE *File = nullptr;
+  // Hash is calculated while data arrives when file is received sequentially
+  sha3_ctx_t *Hash = nullptr;
+  uint64_t Received = 0;
+  bool WriteError = false;
+  bool RangeIgnored = false;
+};
+}
+
+static bool writeAt(FILE *file, uint64_t offset, const char *data, size_t size)
+{
+#ifdef WIN32
+  return _fseeki64(file, offset, SEEK_SET) == 0 && fwrite(data, 1, size, file) == size;
+#else
+  while (size) {
+    ssize_t bytesWritten = pwrite(fileno(file), data, size, offset);
+    if (bytesWritten <= 0) {
+      if (bytesWritten == -1 && errno == EINTR)
+        continue;
+      return false;
+    }
+    data += bytesWritten;
+    size -= bytesWritten;
+    offset += bytesWritten;
+  }
+  return true;
+#endif
+}
+
+static size_t writeSegment(char *data, size_t size, size_t count, void *arg)
+{
+  CSegment &segment = *static_cast<CSegment*>(arg);
+  CTransfer &transfer = *segment.Transfer;
+  size *= count;
+
+  if (segment.Ranged) {
+    // Server sending whole file instead of requested range
+    long response = 0;
+    curl_easy_getinfo(segment.Handle, CURLINFO_RESPONSE_CODE, &response);
+    if (response != 206) {
+      transfer.RangeIgnored = true;
+      return 0;
+    }
+  }
+
+  size_t length = segment.End == unknownSize ? size : static_cast<size_t>(std::min<uint64_t>(size, segment.End - segment.Pos));
+  if (!writeAt(transfer.File, segment.Pos, data, length)) {
+    transfer.WriteError = true;
+    return 0;
+  }
+
+  if (transfer.Hash)
+    sha3_update(transfer.Hash, data, length);
+  segment.Pos += length;
+  transfer.Received += length;
+  return size;
+}
+
+// Accept-Ranges header of final response (after redirects)
+static size_t probeHeader(char *data, size_t size, size_t count, void *arg)
+{
+  bool &acceptRanges = *static_cast<bool*>(arg);
+  std::string line(data, size*count);
+  std::transform(line.begin(), line.end(), line.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+  if (startsWith(line, "http/"))
+    acceptRanges = false;
+  else if (startsWith(line, "accept-ranges:") && line.find("bytes") != line.npos)
+    acceptRanges = true;
+  return size*count;
+}
+
+static CURL *createHandle(const std::string &url)
+{
+  CURL *handle = curl_easy_init();
+  if (!handle)
+    return nullptr;
+  curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(handle, CURLOPT_MAXREDIRS, 16L);
+  curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(handle, CURLOPT_USERAGENT, "cxx-pm/" CXXPM_VERSION);
+  curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, 30L);
+  // Stalled connection is dropped and transfer continues from received position
+  curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, 1L);
+  curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, 60L);
+  return handle;
+}
+
+// Format: "<total size>" line followed by "<position> <end>" lines of not received ranges
+static bool loadState(const std::filesystem::path &path, uint64_t total, std::vector<std::pair<uint64_t, uint64_t>> &ranges)
+{
+  FILE *hFile = fopen(statePath(path).string().c_str(), "rb");
+  if (!hFile)
+    return false;
+
+  unsigned long long size;
+  unsigned long long pos;
+  unsigned long long end;
+  bool valid = fscanf(hFile, "%llu", &size) == 1 && size == total;
+  while (valid && fscanf(hFile, "%llu %llu", &pos, &end) == 2) {
+    valid = pos <= end && end <= total;
+    ranges.emplace_back(pos, end);
+  }
+  fclose(hFile);
+
+  std::error_code ec;
+  valid &= std::filesystem::file_size(path, ec) == total && !ec;
+  if (!valid)
+    ranges.clear();
+  return valid;
+}
+
+static void saveState(const std::filesystem::path &path, uint64_t total, const std::vector<CSegment> &segments)
+{
+  FILE *hFile = fopen(statePath(path).string().c_str(), "wb");
+  if (!hFile)
+    return;
+  fprintf(hFile, "%llu\n", static_cast<unsigned long long>(total));
+  for (const auto &segment: segments) {
+    if (segment.Pos != segment.End)
+      fprintf(hFile, "%llu %llu\n", static_cast<unsigned long long>(segment.Pos), static_cast<unsigned long long>(segment.End));
+  }
+  fclose(hFile);
+}
+
+Downloader::Downloader(bool showProgress) : ShowProgress_(showProgress)
+{
+  static std::once_flag initialized;
+  std::call_once(initialized, []() { curl_global_init(CURL_GLOBAL_DEFAULT); });
+  // Multi handle owns connection cache, it is reused by all transfers
+  Multi_ = curl_multi_init();
+}
+
+Downloader::~Downloader()
+{
+  if (Multi_)
+    curl_multi_cleanup(Multi_);
+}
+
+bool Downloader::download(const std::string &url, const std::filesystem::path &path, std::string &sha3, unsigned timeout, CProcessStats *stats)
+{
+  if (!Multi_) {
+    fprintf(stderr, "ERROR: can't initialize libcurl\n");
+    return false;
+  }
+
+  auto startTime = std::chrono::steady_clock::now();
+  auto deadline = timeout ? startTime + std::chrono::seconds(timeout) : std::chrono::steady_clock::time_point::max();
+
+  // Transfers of handles are performed concurrently until all completed or progress callback
+  // returns false; returns false on timeout or cancel
+  auto perform = [this, deadline](const std::vector<CURL*> &handles, const std::function<bool(CURL*, CURLcode)> &done, const std::function<bool()> &progress) -> bool {
+    for (CURL *handle: handles)
+      curl_multi_add_handle(Multi_, handle);
+    int running = static_cast<int>(handles.size());
+    while (running) {
+      if (Cancelled_ || std::chrono::steady_clock::now() >= deadline)
+        return false;
+      curl_multi_perform(Multi_, &running);
+      int messages;
+      CURLMsg *message;
+      while ((message = curl_multi_info_read(Multi_, &messages)) != nullptr) {
+        if (message->msg != CURLMSG_DONE)
+          continue;
+        CURL *handle = message->easy_handle;
+        CURLcode result = message->data.result;
+        curl_multi_remove_handle(Multi_, handle);
+        // Handle restarted by callback is added again
+        if (done(handle, result)) {
+          curl_multi_add_handle(Multi_, handle);
+          running++;
+        }
+      }
+      if (progress && !progress())
+        break;
+      if (running)
+        curl_multi_poll(Multi_, nullptr, 0, 100, nullptr);
+    }
+    return true;
+  };
+
+  // Probe size and range support; servers rejecting HEAD requests are handled as not supporting ranges
+  uint64_t total = unknownSize;
+  bool acceptRanges = false;
+  std::string effectiveUrl = url;
+  if (CURL *handle = createHandle(url)) {
+    CURLcode probeResult = CURLE_FAILED_INIT;
+    curl_easy_setopt(handle, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, probeHeader);
+    curl_easy_setopt(handle, CURLOPT_HEADERDATA, &acceptRanges);
+    perform({handle}, [&probeResult](CURL*, CURLcode result) { probeResult = result; return false; }, nullptr);
+    curl_multi_remove_handle(Multi_, handle);
+    curl_off_t length = -1;
+    char *location = nullptr;
+    if (probeResult == CURLE_OK &&
+        curl_easy_getinfo(handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK && length >= 0 &&
+        curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &location) == CURLE_OK && location) {
+      total = length;
+      effectiveUrl = location;
+    } else {
+      acceptRanges = false;
+    }
+    curl_easy_cleanup(handle);
+  }
+
+  CTransfer transfer;
+  bool resumable = acceptRanges && total != unknownSize;
+  for (;;) {
+    // Not received ranges: from resume state, after existing part of file or whole file
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    std::error_code ec;
+    uint64_t existing = resumable && std::filesystem::exists(path, ec) ? std::filesystem::file_size(path, ec) : 0;
+    if (ec)
+      existing = 0;
+    bool stateLoaded = resumable && loadState(path, total, ranges);
+    if (!stateLoaded) {
+      if (!resumable || existing > total)
+        existing = 0;
+      if (existing != total)
+        ranges.emplace_back(existing, total);
+    }
+
+    // Split large ranges for parallel connections
+    if (resumable && total >= segmentThreshold) {
+      while (ranges.size() < maxSegments) {
+        auto largest = std::max_element(ranges.begin(), ranges.end(), [](const auto &l, const auto &r) { return l.second - l.first < r.second - r.first; });
+        if (largest == ranges.end() || largest->second - largest->first < 2*minSegmentSize)
+          break;
+        uint64_t middle = largest->first + (largest->second - largest->first) / 2;
+        uint64_t end = largest->second;
+        largest->second = middle;
+        ranges.emplace_back(middle, end);
+      }
+    }
+
+    // Hash of sequentially received file is calculated on the fly, existing part is hashed first
+    sha3_ctx_t ctx;
+    sha3_init(&ctx, 32);
+    transfer.Hash = nullptr;
+    if (!stateLoaded && ranges.size() <= 1) {
+      InputFile part;
+      if (existing == 0 || (part.open(path) && part.readAll([&ctx](const uint8_t *data, size_t size) { sha3_update(&ctx, data, size); })))
+        transfer.Hash = &ctx;
+    }
+
+    transfer.File = fopen(path.string().c_str(), existing || stateLoaded ? "r+b" : "wb");
+    if (!transfer.File) {
+      fprintf(stderr, "ERROR: can't open file %s\n", path.string().c_str());
+      return false;
+    }
+
+    if (existing || stateLoaded)
+      printf("Resuming download of %s\n", url.c_str());
+
+    std::vector<CSegment> segments(ranges.size());
+    std::vector<CURL*> handles;
+    auto startSegment = [&](CSegment &segment) -> bool {
+      if (!segment.Handle && !(segment.Handle = createHandle(effectiveUrl)))
+        return false;
+      curl_easy_setopt(segment.Handle, CURLOPT_WRITEFUNCTION, writeSegment);
+      curl_easy_setopt(segment.Handle, CURLOPT_WRITEDATA, &segment);
+      curl_easy_setopt(segment.Handle, CURLOPT_ERRORBUFFER, segment.Error);
+      segment.Ranged = resumable && !(segment.Pos == 0 && segment.End == total);
+      if (segment.Ranged) {
+        std::string range = std::to_string(segment.Pos) + "-" + std::to_string(segment.End - 1);
+        curl_easy_setopt(segment.Handle, CURLOPT_RANGE, range.c_str());
+      } else {
+        curl_easy_setopt(segment.Handle, CURLOPT_RANGE, nullptr);
+      }
+      return true;
+    };
+
+    bool success = true;
+    for (size_t i = 0; i < ranges.size(); i++) {
+      segments[i].Pos = ranges[i].first;
+      segments[i].End = ranges[i].second;
+      segments[i].Transfer = &transfer;
+      if (!startSegment(segments[i])) {
+        success = false;
+        break;
+      }
+      handles.push_back(segments[i].Handle);
+    }
+
+    bool isTerminal = false;
+#ifdef WIN32
+    isTerminal = ShowProgress_ && _isatty(_fileno(stdout));
+#else
+    isTerminal = ShowProgress_ && isatty(STDOUT_FILENO);
+#endif
+
+    // Segments are written at their offsets, so file has full size from beginning and resume state
+    // is stored before and during transfer; killed process loses last second of data at most
+    if (success && resumable) {
+      saveState(path, total, segments);
+      std::filesystem::resize_file(path, total, ec);
+    }
+
+    auto lastState = std::chrono::steady_clock::now();
+    auto lastProgress = lastState;
+    bool progressShown = false;
+    bool failed = false;
+    auto progress = [&]() -> bool {
+      auto now = std::chrono::steady_clock::now();
+      if (resumable && now - lastState >= std::chrono::seconds(1)) {
+        lastState = now;
+        saveState(path, total, segments);
+      }
+      if (failed || !isTerminal || now - lastProgress < std::chrono::milliseconds(500))
+        return !failed;
+      lastProgress = now;
+      progressShown = true;
+      double elapsed = std::chrono::duration<double>(now - startTime).count();
+      if (total != unknownSize) {
+        uint64_t remaining = 0;
+        for (const auto &segment: segments)
+          remaining += segment.End - segment.Pos;
+        printf("\r  %.1f / %.1f MiB, %.1f MiB/s   ", (total - remaining) / 1048576.0, total / 1048576.0, transfer.Received / 1048576.0 / elapsed);
+      } else {
+        printf("\r  %.1f MiB, %.1f MiB/s   ", transfer.Received / 1048576.0, transfer.Received / 1048576.0 / elapsed);
+      }
+      fflush(stdout);
+      return true;
+    };
+
+    bool timedOut = success && !perform(handles, [&](CURL *handle, CURLcode result) -> bool {
+      auto It = std::find_if(segments.begin(), segments.end(), [handle](const CSegment &segment) { return segment.Handle == handle; });
+      if (It == segments.end())
+        return false;
+      CSegment &segment = *It;
+      if (result == CURLE_OK && (segment.End == unknownSize || segment.Pos == segment.End)) {
+        segment.Completed = true;
+        return false;
+      }
+
+      // Interrupted transfer continues from received position
+      bool retry = !failed &&
+                   !transfer.WriteError &&
+                   !transfer.RangeIgnored &&
+                   result != CURLE_HTTP_RETURNED_ERROR &&
+                   result != CURLE_UNSUPPORTED_PROTOCOL &&
+                   result != CURLE_URL_MALFORMAT &&
+                   (resumable || transfer.Hash) &&
+                   segment.Retries++ < maxRetries;
+      if (retry && !resumable) {
+        // Whole file is received again
+        transfer.Received -= segment.Pos;
+        segment.Pos = 0;
+        sha3_init(transfer.Hash, 32);
+      }
+      if (retry && startSegment(segment))
+        return true;
+
+      if (!failed && !transfer.RangeIgnored && !transfer.WriteError)
+        fprintf(stderr, "ERROR: download of %s failed: %s\n", url.c_str(), segment.Error[0] ? segment.Error : curl_easy_strerror(result));
+      failed = true;
+      return false;
+    }, progress);
+    if (progressShown)
+      printf("\n");
+
+    // Abort other transfers
+    for (auto &segment: segments) {
+      if (segment.Handle) {
+        curl_multi_remove_handle(Multi_, segment.Handle);
+        curl_easy_cleanup(segment.Handle);
+      }
+    }
+
+    if (Cancelled_)
+      timedOut = false;
+    success &= !failed && !timedOut && !Cancelled_ && !transfer.WriteError;
+    if (transfer.WriteError)
+      fprintf(stderr, "ERROR: can't write file %s\n", path.string().c_str());
+    if (timedOut)
+      fprintf(stderr, "ERROR: download of %s terminated after %u seconds timeout\n", url.c_str(), timeout);
+    success &= fclose(transfer.File) == 0;
+
+    if (transfer.RangeIgnored && resumable) {
+      // Server doesn't support ranges in fact, download whole file
+      transfer.RangeIgnored = false;
+      resumable = false;
+      Downloader::discard(path);
+      continue;
+    }
+
+    if (stats) {
+      stats->WallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+      stats->ReadBytes += transfer.Received;
+    }
+
+    std::error_code removeEc;
+    if (!success) {
+      // Received data is kept for next run
+      if (resumable)
+        saveState(path, total, segments);
+      else
+        std::filesystem::remove(path, removeEc);
+      return false;
+    }
+
+    std::filesystem::remove(statePath(path), removeEc);
+    sha3 = transfer.Hash ? hashToString(ctx) : sha3FileHash(path);
+    return !sha3.empty();
+  }
+}
+#else
+Downloader::Downloader(bool showProgress) : ShowProgress_(showProgress)
+{
+}
+
+Downloader::~Downloader()
+{
+}
+
+bool Downloader::download(const std::string &url, const std::filesystem::path &path, std::string &sha3, unsigned timeout, CProcessStats *stats)
+{
+  FILE *hPart = fopen(path.string().c_str(), "wb");
+  if (!hPart) {
+    fprintf(stderr, "ERROR: can't open file %s\n", path.string().c_str());
+    return false;
+  }
+
+  // Hash is calculated while data arrives
+  sha3_ctx_t ctx;
+  bool writeError = false;
+  sha3_init(&ctx, 32);
+  bool downloaded = runStreamOutput(".", "wget", { url, "-O", "-" }, {}, [&](EOutputStream, const char *data, size_t size) {
+    sha3_update(&ctx, data, size);
+    writeError = fwrite(data, 1, size, hPart) != size;
+    return !writeError && !Cancelled_;
+  }, false, true, stats, timeout);
+  writeError |= fclose(hPart) != 0;
+
+  if (!downloaded || writeError || Cancelled_) {
+    fprintf(stderr, writeError ? "Can't write file %s\n" : "Can't download file %s\n", writeError ? path.string().c_str() : url.c_str());
+    discard(path);
+    return false;
+  }
+
+  sha3 = hashToString(ctx);
+  return true;
+}
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "cxx-pm-config.h"
+#include <atomic>
+#include <filesystem>
+#include <string>
+
+struct CProcessStats;
+
+#ifdef CXXPM_HAVE_CURL
+typedef void CURLM;
+#endif
+
+// Downloads archives over HTTP(S). With libcurl transfer continues from existing part of
+// file, large files are fetched by several parallel range requests and connections are
+// reused by consecutive downloads; without libcurl files are downloaded by wget
+class Downloader {
+public:
+  Downloader(bool showProgress = true);
+  ~Downloader();
+  Downloader(const Downloader&) = delete;
+  Downloader &operator=(const Downloader&) = delete;
+
+  // Downloads url to path (".part" file), sha3 receives hash of complete file. Failed
+  // download keeps received data for resume; timeout is wall-clock limit in seconds
+  bool download(const std::string &url, const std::filesystem::path &path, std::string &sha3, unsigned timeout, CProcessStats *stats);
+  // Drops received data and resume state of path
+  static void discard(const std::filesystem::path &path);
+  // Stops current and next downloads from other thread, received data is kept for resume
+  void cancel() { Cancelled_ = true; }
+  bool cancelled() const { return Cancelled_; }
+
+private:
+  bool ShowProgress_;
+  std::atomic<bool> Cancelled_ = false;
+#ifdef CXXPM_HAVE_CURL
+  CURLM *Multi_ = nullptr;
+#endif
+};
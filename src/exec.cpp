@@ -1,12 +1,34 @@
 #include "exec.h"
+#include "cxx-pm-config.h"
 #include <strExtras.h>
 
+#include <stdio.h>
 #include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
 #ifndef WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
 extern char** environ;
 #else
+#include <ctype.h>
 #include <windows.h>
 #endif
 
@@ -21,7 +43,136 @@ public:
 };
 
 JobSingletone gJob;
+
+// Job object is shared by all children, so only process itself is accounted on Windows
+static void collectProcessStats(HANDLE process, std::chrono::steady_clock::time_point startTime, CProcessStats *stats)
+{
+  if (!stats)
+    return;
+
+  CProcessStats processStats;
+  FILETIME creationTime;
+  FILETIME exitTime;
+  FILETIME kernelTime;
+  FILETIME userTime;
+  if (GetProcessTimes(process, &creationTime, &exitTime, &kernelTime, &userTime)) {
+    // 100ns units
+    processStats.UserTime = ((static_cast<uint64_t>(userTime.dwHighDateTime) << 32) | userTime.dwLowDateTime) / 10000000.0;
+    processStats.SystemTime = ((static_cast<uint64_t>(kernelTime.dwHighDateTime) << 32) | kernelTime.dwLowDateTime) / 10000000.0;
+  }
+
+  IO_COUNTERS ioCounters;
+  if (GetProcessIoCounters(process, &ioCounters)) {
+    processStats.ReadBytes = ioCounters.ReadTransferCount;
+    processStats.WriteBytes = ioCounters.WriteTransferCount;
+  }
+
+  processStats.WallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  processStats.Processes = 1;
+  stats->add(processStats);
+}
+
+// Reading from anonymous pipes blocks until child exits, so timeout is watched by separate thread
+class ProcessWatchdog {
+public:
+  ProcessWatchdog(HANDLE process, unsigned timeout) {
+    if (timeout) {
+      Thread_ = std::thread([this, process, timeout]() {
+        if (WaitForSingleObject(process, timeout * 1000) == WAIT_TIMEOUT) {
+          TimedOut_ = true;
+          TerminateProcess(process, 1);
+        }
+      });
+    }
+  }
+
+  ~ProcessWatchdog() { wait(); }
+
+  // Call after process exited, returns true if it was terminated by timeout
+  bool wait() {
+    if (Thread_.joinable())
+      Thread_.join();
+    return TimedOut_;
+  }
+
+private:
+  std::thread Thread_;
+  bool TimedOut_ = false;
+};
+#endif
+
+void CProcessStats::add(const CProcessStats &stats)
+{
+  WallTime += stats.WallTime;
+  UserTime += stats.UserTime;
+  SystemTime += stats.SystemTime;
+  MaxRss = std::max(MaxRss, stats.MaxRss);
+  VoluntaryContextSwitches += stats.VoluntaryContextSwitches;
+  InvoluntaryContextSwitches += stats.InvoluntaryContextSwitches;
+  ReadBytes += stats.ReadBytes;
+  WriteBytes += stats.WriteBytes;
+  StorageReadBytes += stats.StorageReadBytes;
+  StorageWriteBytes += stats.StorageWriteBytes;
+  Processes += stats.Processes;
+}
+
+// Directory modified in the same clock tick after listing keeps its mtime,
+// so snapshots of directories modified less than second ago are not stored
+static constexpr uint64_t racyIntervalNs = 1000000000ull;
+
+static bool directoryMTime(const std::filesystem::path &path, uint64_t &mtime)
+{
+#ifndef WIN32
+  struct stat s;
+  if (stat(path.c_str(), &s) == -1 || !S_ISDIR(s.st_mode))
+    return false;
+  mtime = s.st_mtim.tv_sec*1000000000ull + s.st_mtim.tv_nsec;
+  return true;
+#else
+  std::error_code ec;
+  auto time = std::filesystem::last_write_time(path, ec);
+  if (ec || !std::filesystem::is_directory(path, ec))
+    return false;
+  mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+  return true;
 #endif
+}
+
+// Lists names of directory entries which may be executables. Mode and symlink target changes
+// don't touch directory mtime, so they are checked on lookup by isExecutableFile
+static void listExecutables(const std::filesystem::path &path, std::vector<std::string> &files)
+{
+#ifndef WIN32
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return;
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_type != DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+      files.emplace_back(entry->d_name);
+  }
+
+  closedir(dir);
+#else
+  std::error_code ec;
+  for (const auto &entry: std::filesystem::directory_iterator(path, ec)) {
+    if (entry.path().extension() == ".exe" && !entry.is_directory(ec))
+      files.emplace_back(entry.path().filename().string());
+  }
+#endif
+}
+
+static bool isExecutableFile(const std::filesystem::path &path)
+{
+#ifndef WIN32
+  struct stat s;
+  return stat(path.c_str(), &s) == 0 && S_ISREG(s.st_mode) && access(path.c_str(), X_OK) == 0;
+#else
+  std::error_code ec;
+  return std::filesystem::is_regular_file(path, ec);
+#endif
+}
 
 PathCache::PathCache()
 {
@@ -49,62 +200,845 @@ void PathCache::update()
   while (splitter.next()) {
     AllPath_.emplace_back(splitter.get());
   }
+  Built_ = false;
 }
 
-std::filesystem::path PathCache::get(const std::filesystem::path &name)
+void PathCache::setStorage(const std::filesystem::path &path)
 {
-  {
-    std::shared_lock lock(Mutex_);
-    const auto &It = Cache_.find(name.string());
-    if (It != Cache_.end())
-      return It->second;
+  std::unique_lock lock(Mutex_);
+  StoragePath_ = path;
+  load();
+  Built_ = false;
+}
+
+// Format: version line, then for each directory "<mtime_ns> <files count> <directory>" line
+// followed by file names, one per line
+static const char pathCacheVersion[] = "cxx-pm path cache 2";
+
+void PathCache::load()
+{
+  FILE *hFile = fopen(StoragePath_.string().c_str(), "rb");
+  if (!hFile)
+    return;
+
+  std::string data;
+  char buffer[65536];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), hFile)) > 0)
+    data.append(buffer, size);
+  fclose(hFile);
+
+  // Snapshots made before storage was loaded are replaced, directories missing in file are listed again
+  Snapshots_.clear();
+  Modified_ = false;
+
+  // Snapshots of older format contain executables only, they are built again
+  StringSplitter splitter(data, "\n");
+  if (!splitter.next() || splitter.get() != pathCacheVersion)
+    return;
+  while (splitter.next()) {
+    std::string header(splitter.get());
+    unsigned long long mtime;
+    unsigned long long count;
+    int offset = 0;
+    if (sscanf(header.c_str(), "%llu %llu %n", &mtime, &count, &offset) != 2 || offset == 0)
+      return;
+
+    CDirectorySnapshot snapshot;
+    snapshot.MTimeNs = mtime;
+    for (unsigned long long i = 0; i < count; i++) {
+      if (!splitter.next())
+        return;
+      snapshot.Files.emplace_back(splitter.get());
+    }
+
+    Snapshots_[header.substr(offset)] = std::move(snapshot);
+  }
+}
+
+void PathCache::save()
+{
+  uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  std::string data = pathCacheVersion;
+  data.push_back('\n');
+  for (const auto &directory: AllPath_) {
+    auto It = Snapshots_.find(directory.string());
+    if (It == Snapshots_.end() || It->second.MTimeNs + racyIntervalNs > now)
+      continue;
+
+    char header[64];
+    snprintf(header, sizeof(header), "%llu %llu ",
+             static_cast<unsigned long long>(It->second.MTimeNs),
+             static_cast<unsigned long long>(It->second.Files.size()));
+    data.append(header);
+    data.append(It->first);
+    data.push_back('\n');
+    for (const auto &file: It->second.Files) {
+      data.append(file);
+      data.push_back('\n');
+    }
+  }
+
+  std::filesystem::path tmp = StoragePath_;
+  tmp += ".tmp";
+  FILE *hFile = fopen(tmp.string().c_str(), "wb");
+  if (!hFile)
+    return;
+  bool success = fwrite(data.data(), 1, data.size(), hFile) == data.size();
+  success &= fclose(hFile) == 0;
+
+  std::error_code ec;
+  if (success)
+    std::filesystem::rename(tmp, StoragePath_, ec);
+  if (!success || ec)
+    std::filesystem::remove(tmp, ec);
+}
+
+void PathCache::build()
+{
+  Index_.clear();
+  // Last directory in PATH has highest priority
+  for (const auto &directory: AllPath_) {
+    uint64_t mtime;
+    if (!directoryMTime(directory, mtime))
+      continue;
+
+    CDirectorySnapshot &snapshot = Snapshots_[directory.string()];
+    if (snapshot.MTimeNs != mtime) {
+      snapshot.MTimeNs = mtime;
+      snapshot.Files.clear();
+      listExecutables(directory, snapshot.Files);
+      Modified_ = true;
+    }
+
+    for (const auto &file: snapshot.Files)
+      Index_[file].push_back(directory / file);
+  }
+
+  if (Modified_ && !StoragePath_.empty()) {
+    save();
+    Modified_ = false;
   }
+  Built_ = true;
+}
 
-  // Search executable
+std::filesystem::path PathCache::get(const std::filesystem::path &name)
+{
   std::filesystem::path nameForSearch = name;
 #ifdef WIN32
   if (nameForSearch.extension() != ".exe")
     nameForSearch += ".exe";
 #endif
 
-  for (auto I = AllPath_.rbegin(), IE = AllPath_.rend(); I != IE; ++I) {
-    std::filesystem::path current = *I / nameForSearch;
-    if (std::filesystem::exists(current) && !std::filesystem::is_directory(current)) {
-      {
-        std::unique_lock lock(Mutex_);
-        Cache_[name.string()] = current;
+  // Names with directory part are not indexed
+  if (nameForSearch.has_parent_path()) {
+    std::shared_lock lock(Mutex_);
+    for (auto I = AllPath_.rbegin(), IE = AllPath_.rend(); I != IE; ++I) {
+      std::filesystem::path current = *I / nameForSearch;
+      if (std::filesystem::exists(current) && !std::filesystem::is_directory(current))
+        return current;
+    }
+    return std::filesystem::path();
+  }
+
+  {
+    std::shared_lock lock(Mutex_);
+    if (Built_)
+      return find(nameForSearch.string());
+  }
+
+  std::unique_lock lock(Mutex_);
+  if (!Built_)
+    build();
+  return find(nameForSearch.string());
+}
+
+std::filesystem::path PathCache::find(const std::string &name) const
+{
+  auto It = Index_.find(name);
+  if (It == Index_.end())
+    return std::filesystem::path();
+  for (auto I = It->second.rbegin(), IE = It->second.rend(); I != IE; ++I) {
+    if (isExecutableFile(*I))
+      return *I;
+  }
+  return std::filesystem::path();
+}
+
+static PathCache gPathCache;
+
+void updatePath()
+{
+  gPathCache.update();
+}
+
+void pathCacheEnable(const std::filesystem::path &storagePath)
+{
+  gPathCache.setStorage(storagePath);
+}
+
+// Windows variable names are case insensitive, names of drive current directories start with '='
+static std::string environmentKey(const std::string &variable)
+{
+  std::string key = variable.substr(0, variable.find('=', 1));
+#ifdef WIN32
+  std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(toupper(c)); });
+#endif
+  return key;
+}
+
+ProcessEnvironment::ProcessEnvironment(const std::vector<std::string> &overrides)
+{
+  set(overrides);
+}
+
+ProcessEnvironment::ProcessEnvironment(const ProcessEnvironment &environment) :
+  Variables_(environment.Variables_), Index_(environment.Index_), Materialized_(environment.Materialized_)
+{
+  updatePointers();
+}
+
+ProcessEnvironment &ProcessEnvironment::operator=(const ProcessEnvironment &environment)
+{
+  Variables_ = environment.Variables_;
+  Index_ = environment.Index_;
+  Materialized_ = environment.Materialized_;
+  updatePointers();
+  return *this;
+}
+
+void ProcessEnvironment::materialize()
+{
+  if (Materialized_)
+    return;
+
+#ifndef WIN32
+  for (char **envPtr = environ; *envPtr; envPtr++)
+    Variables_.emplace_back(*envPtr);
+#else
+  char *envPtr = GetEnvironmentStringsA();
+  for (char *p = envPtr; *p; p += strlen(p) + 1)
+    Variables_.emplace_back(p);
+  FreeEnvironmentStringsA(envPtr);
+#endif
+
+  // Parent environment can't have duplicates, but keep last one anyway
+  Index_.reserve(Variables_.size());
+  for (size_t i = 0, ie = Variables_.size(); i != ie; ++i)
+    Index_[environmentKey(Variables_[i])] = i;
+  Materialized_ = true;
+  updatePointers();
+}
+
+void ProcessEnvironment::updatePointers()
+{
+  Pointers_.clear();
+  if (!Materialized_)
+    return;
+  Pointers_.reserve(Variables_.size() + 1);
+  for (auto &variable: Variables_)
+    Pointers_.push_back(variable.data());
+  Pointers_.push_back(nullptr);
+}
+
+void ProcessEnvironment::set(const std::string &variable)
+{
+  materialize();
+  auto It = Index_.find(environmentKey(variable));
+  if (It != Index_.end()) {
+    Variables_[It->second] = variable;
+    Pointers_[It->second] = Variables_[It->second].data();
+    return;
+  }
+
+  size_t capacity = Variables_.capacity();
+  Index_.emplace(environmentKey(variable), Variables_.size());
+  Variables_.push_back(variable);
+  if (Variables_.capacity() != capacity) {
+    updatePointers();
+  } else {
+    Pointers_.back() = Variables_.back().data();
+    Pointers_.push_back(nullptr);
+  }
+}
+
+void ProcessEnvironment::set(const std::vector<std::string> &variables)
+{
+  for (const auto &variable: variables)
+    set(variable);
+}
+
+#ifndef WIN32
+char **ProcessEnvironment::envp() const
+{
+  return Materialized_ ? const_cast<char**>(Pointers_.data()) : environ;
+}
+#else
+std::string ProcessEnvironment::block() const
+{
+  std::string result;
+  if (!Materialized_) {
+    char *envPtr = GetEnvironmentStringsA();
+    char *p = envPtr;
+    while (p[0] != 0 || p[1] != 0)
+      p++;
+    result.assign(envPtr, p + 1);
+    FreeEnvironmentStringsA(envPtr);
+  } else {
+    for (const auto &variable: Variables_) {
+      result.append(variable);
+      result.push_back('\0');
+    }
+  }
+
+  result.push_back('\0');
+  return result;
+}
+#endif
+
+std::filesystem::path findExecutable(const std::filesystem::path &path)
+{
+  return path.is_absolute() ? path : gPathCache.get(path);
+}
+
+// Prints timeout error, message is returned for build log
+static std::string reportTimeout(const std::filesystem::path &path, unsigned timeout)
+{
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), " terminated after %u seconds timeout\n", timeout);
+  std::string message = "ERROR: " + path.string() + buffer;
+  fputs(message.c_str(), stderr);
+  return message;
+}
+
+#ifndef WIN32
+// Pipes are created with close-on-exec flag, so processes spawned concurrently
+// from other threads don't inherit them
+static bool createPipe(int fds[2])
+{
+#ifdef __linux__
+  return pipe2(fds, O_CLOEXEC) == 0;
+#else
+  if (pipe(fds) == -1)
+    return false;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return true;
+#endif
+}
+
+// Running children are registered for terminateAllChildProcess, which is called from
+// signal handler, so registry is array of lock-free slots. Slot contains kill target:
+// negative process group id or pid of process sharing our group
+static constexpr size_t maxChildProcesses = 1024;
+static std::atomic<pid_t> gChildProcesses[maxChildProcesses];
+
+static void registerChildProcess(pid_t target)
+{
+  for (auto &slot: gChildProcesses) {
+    pid_t expected = 0;
+    if (slot.compare_exchange_strong(expected, target))
+      return;
+  }
+}
+
+static void unregisterChildProcess(pid_t target)
+{
+  for (auto &slot: gChildProcesses) {
+    pid_t expected = target;
+    if (slot.compare_exchange_strong(expected, 0))
+      return;
+  }
+}
+
+struct CChildProcess {
+  pid_t Pid = 0;
+  // Child leads own process group, group is killed with all descendants
+  bool OwnGroup = false;
+  std::chrono::steady_clock::time_point StartTime;
+  std::chrono::steady_clock::time_point Deadline = std::chrono::steady_clock::time_point::max();
+
+  pid_t killTarget() const { return OwnGroup ? -Pid : Pid; }
+  void kill() const { ::kill(killTarget(), SIGKILL); }
+  void setTimeout(unsigned seconds) {
+    if (seconds)
+      Deadline = StartTime + std::chrono::seconds(seconds);
+  }
+};
+
+// Milliseconds until deadline for poll, -1 for no deadline
+static int pollTimeout(std::chrono::steady_clock::time_point deadline)
+{
+  if (deadline == std::chrono::steady_clock::time_point::max())
+    return -1;
+  auto now = std::chrono::steady_clock::now();
+  if (now >= deadline)
+    return 0;
+  return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+}
+
+// Starts process with posix_spawn, which uses vfork-like clone and doesn't copy parent
+// page tables; stdoutFd/stderrFd equal to -1 are inherited from parent.
+// Working directory is changed by spawn file action, so it is safe to call from any thread.
+// Child started in new process group doesn't receive terminal signals unless it gets
+// terminal, it is killed with its descendants by terminateAllChildProcess
+static bool spawnProcess(const std::filesystem::path &workingDirectory,
+                         const std::filesystem::path &fullPath,
+                         const std::filesystem::path &path,
+                         const std::vector<std::string> &arguments,
+                         const ProcessEnvironment &environment,
+                         int stdoutFd,
+                         int stderrFd,
+                         bool newProcessGroup,
+                         CChildProcess &child,
+                         std::string &error)
+{
+  pid_t pid = 0;
+  std::vector<char*> cmdLine;
+  // command line
+  cmdLine.push_back(const_cast<char*>(path.c_str()));
+  for (const auto &arg: arguments)
+    cmdLine.push_back(const_cast<char*>(arg.c_str()));
+  cmdLine.push_back(0);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (stdoutFd != -1)
+    posix_spawn_file_actions_adddup2(&actions, stdoutFd, STDOUT_FILENO);
+  if (stderrFd != -1)
+    posix_spawn_file_actions_adddup2(&actions, stderrFd, STDERR_FILENO);
+
+  // Termination signals are blocked until child is registered, child gets original mask
+  sigset_t terminationSignals;
+  sigset_t oldMask;
+  sigemptyset(&terminationSignals);
+  sigaddset(&terminationSignals, SIGINT);
+  sigaddset(&terminationSignals, SIGTERM);
+  sigaddset(&terminationSignals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &terminationSignals, &oldMask);
+
+  int result = 0;
+#ifdef CXXPM_HAVE_POSIX_SPAWN_ADDCHDIR
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  short flags = POSIX_SPAWN_SETSIGMASK;
+  if (newProcessGroup) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attributes, 0);
+  }
+  posix_spawnattr_setflags(&attributes, flags);
+  posix_spawnattr_setsigmask(&attributes, &oldMask);
+
+  result = posix_spawn_file_actions_addchdir_np(&actions, workingDirectory.c_str());
+  if (result == 0)
+    result = posix_spawn(&pid, fullPath.c_str(), &actions, &attributes, &cmdLine[0], environment.envp());
+  posix_spawnattr_destroy(&attributes);
+#else
+  // No chdir file action: change directory in forked child
+  pid = fork();
+  if (pid == 0) {
+    if (newProcessGroup)
+      setpgid(0, 0);
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+    if (stdoutFd != -1)
+      dup2(stdoutFd, STDOUT_FILENO);
+    if (stderrFd != -1)
+      dup2(stderrFd, STDERR_FILENO);
+    if (chdir(workingDirectory.c_str()) == -1 || execve(fullPath.c_str(), &cmdLine[0], environment.envp()) == -1) {
+      fprintf(stderr, "execv ERROR %s\n", strerror(errno));
+      _exit(127);
+    }
+  }
+  result = pid == -1 ? errno : 0;
+  // Parent sets group too, so it exists before child reaches exec
+  if (pid > 0 && newProcessGroup)
+    setpgid(pid, pid);
+#endif
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (result == 0) {
+    child.Pid = pid;
+    child.OwnGroup = newProcessGroup;
+    child.StartTime = std::chrono::steady_clock::now();
+    registerChildProcess(child.killTarget());
+  }
+  pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+
+  if (result != 0) {
+    error = "execv ERROR ";
+    error.append(strerror(result));
+    error.append(": \"");
+    for (size_t i = 0, ie = cmdLine.size() - 1; i != ie; ++i) {
+      error.append(cmdLine[i]);
+      if (i != ie-1)
+        error.push_back(' ');
+    }
+    error.append("\" in ");
+    error.append(workingDirectory.string());
+    error.push_back('\n');
+    return false;
+  }
+
+  return true;
+}
+
+#ifdef __linux__
+// I/O counters of exited but not reaped process; they include counters of all its waited
+// descendants, so whole process tree is accounted
+static void readProcessIo(pid_t pid, CProcessStats &stats)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%i/io", static_cast<int>(pid));
+  FILE *hFile = fopen(path, "r");
+  if (!hFile)
+    return;
+
+  char name[32];
+  unsigned long long value;
+  while (fscanf(hFile, "%31s %llu", name, &value) == 2) {
+    if (strcmp(name, "rchar:") == 0)
+      stats.ReadBytes = value;
+    else if (strcmp(name, "wchar:") == 0)
+      stats.WriteBytes = value;
+    else if (strcmp(name, "read_bytes:") == 0)
+      stats.StorageReadBytes = value;
+    else if (strcmp(name, "write_bytes:") == 0)
+      stats.StorageWriteBytes = value;
+  }
+  fclose(hFile);
+}
+#endif
+
+// Waits for child exit; child running after its deadline is killed and timedOut is set
+static bool waitProcess(const CChildProcess &child, CProcessStats *stats, bool &timedOut)
+{
+  pid_t pid = child.Pid;
+  CProcessStats processStats;
+  if (child.Deadline != std::chrono::steady_clock::time_point::max()) {
+    // Poll for exit without reaping
+    for (;;) {
+      siginfo_t info;
+      info.si_pid = 0;
+      if (waitid(P_PID, pid, &info, WEXITED | WNOWAIT | WNOHANG) == -1) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      if (info.si_pid != 0)
+        break;
+      if (std::chrono::steady_clock::now() >= child.Deadline) {
+        timedOut = true;
+        child.kill();
+        break;
       }
-      return current;
+      poll(nullptr, 0, 10);
+    }
+  }
+
+  if (stats) {
+#ifdef __linux__
+    // Wait for exit, but keep zombie for reading /proc/<pid>/io
+    siginfo_t info;
+    while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == -1 && errno == EINTR)
+      continue;
+    readProcessIo(pid, processStats);
+#endif
+  }
+
+  int exitCode = 0;
+  struct rusage usage;
+  for (;;) {
+    if (wait4(pid, &exitCode, WUNTRACED, &usage) == -1) {
+      if (errno == EINTR)
+        continue;
+      unregisterChildProcess(child.killTarget());
+      return false;
+    }
+    if (WIFEXITED(exitCode) || WIFSIGNALED(exitCode))
+      break;
+    // Child owning terminal is stopped by Ctrl+Z, background one by reading terminal;
+    // nobody else would continue it
+    if (WIFSTOPPED(exitCode)) {
+      poll(nullptr, 0, 100);
+      ::kill(child.killTarget(), SIGCONT);
+    }
+  }
+  unregisterChildProcess(child.killTarget());
+
+  if (stats) {
+    // rusage of waited process includes resources of its waited descendants
+    processStats.WallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - child.StartTime).count();
+    processStats.UserTime = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+    processStats.SystemTime = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+#ifdef __APPLE__
+    processStats.MaxRss = usage.ru_maxrss;
+#else
+    processStats.MaxRss = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+    processStats.VoluntaryContextSwitches = usage.ru_nvcsw;
+    processStats.InvoluntaryContextSwitches = usage.ru_nivcsw;
+    processStats.Processes = 1;
+    stats->add(processStats);
+  }
+
+  return !timedOut && exitCode == 0;
+}
+
+// Controlling terminal is given to one child with inherited stdio at a time (git credential
+// prompt, patch question); concurrent children stay in background and must not read it
+static std::atomic<bool> gTerminalHandedOff = false;
+
+static int foregroundTerminalFd()
+{
+  for (int fd: {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO}) {
+    if (isatty(fd))
+      return tcgetpgrp(fd) == getpgrp() ? fd : -1;
+  }
+  return -1;
+}
+
+// Makes process group of child terminal foreground group, returns terminal descriptor or -1
+static int handOffTerminal(const CChildProcess &child)
+{
+  int fd = foregroundTerminalFd();
+  bool expected = false;
+  if (fd == -1 || !gTerminalHandedOff.compare_exchange_strong(expected, true))
+    return -1;
+  if (tcsetpgrp(fd, child.Pid) == -1) {
+    gTerminalHandedOff = false;
+    return -1;
+  }
+  // Child which touched terminal before handoff is stopped by SIGTTIN
+  ::kill(-child.Pid, SIGCONT);
+  return fd;
+}
+
+static void reclaimTerminal(int fd)
+{
+  if (fd == -1)
+    return;
+  // We are background group now, tcsetpgrp from background raises SIGTTOU
+  sigset_t ttou;
+  sigset_t oldMask;
+  sigemptyset(&ttou);
+  sigaddset(&ttou, SIGTTOU);
+  pthread_sigmask(SIG_BLOCK, &ttou, &oldMask);
+  tcsetpgrp(fd, getpgrp());
+  pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+  gTerminalHandedOff = false;
+}
+
+enum class EPumpResult {
+  Completed,
+  Stopped,
+  TimedOut
+};
+
+// Passes stdout and stderr of child process to callback as data arrives until both pipes
+// closed, so child never blocks on full pipe buffer
+static EPumpResult pumpPipes(int stdoutFd, int stderrFd, const OutputCallback &callback, std::chrono::steady_clock::time_point deadline)
+{
+  static constexpr size_t bufferSize = 1u << 16;
+  static thread_local std::unique_ptr<char[]> buffer(new char[bufferSize]);
+
+  // negative descriptor is ignored by poll
+  pollfd fds[2];
+  fds[0].fd = stdoutFd;
+  fds[0].events = POLLIN;
+  fds[1].fd = stderrFd;
+  fds[1].events = POLLIN;
+  EOutputStream streams[2] = {EOutputStream::StdOut, EOutputStream::StdErr};
+  unsigned opened = (stdoutFd >= 0) + (stderrFd >= 0);
+  while (opened) {
+    int result = poll(fds, 2, pollTimeout(deadline));
+    if (result == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (result == 0)
+      return EPumpResult::TimedOut;
+
+    for (unsigned i = 0; i < 2; i++) {
+      if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      ssize_t bytesRead = read(fds[i].fd, buffer.get(), bufferSize);
+      if (bytesRead > 0) {
+        if (!callback(streams[i], buffer.get(), bytesRead))
+          return EPumpResult::Stopped;
+      } else if (bytesRead == 0 || errno != EINTR) {
+        fds[i].fd = -1;
+        opened--;
+      }
+    }
+  }
+
+  return EPumpResult::Completed;
+}
+
+#ifdef __linux__
+static bool writeAll(int fd, const char *data, size_t size)
+{
+  while (size) {
+    ssize_t bytesWritten = write(fd, data, size);
+    if (bytesWritten == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += bytesWritten;
+    size -= bytesWritten;
+  }
+
+  return true;
+}
+
+// Moves size bytes from pipe to file with splice(2), or by read/write if target doesn't support it
+static bool spliceOrCopy(int pipeFd, int fd, size_t size, bool &spliceSupported)
+{
+  static constexpr size_t bufferSize = 1u << 16;
+  static thread_local std::unique_ptr<char[]> buffer(new char[bufferSize]);
+  while (size) {
+    if (spliceSupported) {
+      ssize_t bytesMoved = splice(pipeFd, nullptr, fd, nullptr, size, SPLICE_F_MOVE);
+      if (bytesMoved > 0) {
+        size -= bytesMoved;
+        continue;
+      }
+      if (bytesMoved == -1 && errno == EINTR)
+        continue;
+      if (bytesMoved == 0 || (errno != EINVAL && errno != ENOSYS))
+        return false;
+      spliceSupported = false;
+    }
+
+    ssize_t bytesRead = read(pipeFd, buffer.get(), std::min(size, bufferSize));
+    if (bytesRead == -1 && errno == EINTR)
+      continue;
+    if (bytesRead <= 0 || !writeAll(fd, buffer.get(), bytesRead))
+      return false;
+    size -= bytesRead;
+  }
+
+  return true;
+}
+
+// Passes size bytes from pipe to consumer
+static bool readToConsumer(int pipeFd, size_t size, const OutputCallback &consumer)
+{
+  static constexpr size_t bufferSize = 1u << 16;
+  static thread_local std::unique_ptr<char[]> buffer(new char[bufferSize]);
+  while (size) {
+    ssize_t bytesRead = read(pipeFd, buffer.get(), std::min(size, bufferSize));
+    if (bytesRead == -1 && errno == EINTR)
+      continue;
+    if (bytesRead <= 0)
+      return false;
+    consumer(EOutputStream::StdOut, buffer.get(), bytesRead);
+    size -= bytesRead;
+  }
+
+  return true;
+}
+
+// Fans child output out to log and stdout without extra copies: tee(2) duplicates pipe data
+// into stdout (or into intermediate pipe when stdout is not a pipe), splice(2) moves it to
+// log file logFd; without log file data is read once for consumer. Returns false if tee or
+// splice is not supported for these files; nothing is consumed from pipe by failed call,
+// so caller reads rest of output itself
+static bool spliceLog(int pipeFd, int logFd, const OutputCallback &consumer, bool echo, std::chrono::steady_clock::time_point deadline, EPumpResult &result)
+{
+  struct stat logStat;
+  struct stat stdoutStat;
+  if (logFd != -1 && (fstat(logFd, &logStat) == -1 || !S_ISREG(logStat.st_mode)))
+    return false;
+  if (!echo && logFd == -1)
+    return false;
+  if (echo && fstat(STDOUT_FILENO, &stdoutStat) == -1)
+    return false;
+
+  int auxPipe[2] = {-1, -1};
+  int teeFd = STDOUT_FILENO;
+  if (echo && !S_ISFIFO(stdoutStat.st_mode)) {
+    if (!createPipe(auxPipe))
+      return false;
+    teeFd = auxPipe[1];
+  }
+
+  // Data written with stdio must go before spliced one
+  if (echo)
+    fflush(stdout);
+
+  bool spliceToLog = true;
+  bool spliceToStdout = true;
+  bool completed = false;
+  result = EPumpResult::Completed;
+  pollfd fds;
+  fds.fd = pipeFd;
+  fds.events = POLLIN;
+  for (;;) {
+    int pollResult = poll(&fds, 1, pollTimeout(deadline));
+    if (pollResult == -1) {
+      if (errno == EINTR)
+        continue;
+      completed = true;
+      break;
+    }
+    if (pollResult == 0) {
+      result = EPumpResult::TimedOut;
+      completed = true;
+      break;
+    }
+
+    ssize_t size = echo ?
+      tee(pipeFd, teeFd, 1u << 20, 0) :
+      splice(pipeFd, nullptr, logFd, nullptr, 1u << 20, SPLICE_F_MOVE);
+    if (size == 0) {
+      // all writers closed pipe
+      completed = true;
+      break;
+    }
+    if (size == -1) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      break;
+    }
+    if (!echo)
+      continue;
+
+    bool consumed = logFd != -1 ?
+      spliceOrCopy(pipeFd, logFd, size, spliceToLog) :
+      readToConsumer(pipeFd, size, consumer);
+    if (!consumed || (auxPipe[0] != -1 && !spliceOrCopy(auxPipe[0], STDOUT_FILENO, size, spliceToStdout))) {
+      completed = true;
+      break;
     }
   }
 
-  return std::filesystem::path();
-}
-
-static PathCache gPathCache;
+  if (auxPipe[0] != -1) {
+    close(auxPipe[0]);
+    close(auxPipe[1]);
+  }
 
-void updatePath()
-{
-  gPathCache.update();
+  return completed;
 }
+#endif
+#endif
 
-bool run(const std::filesystem::path &workingDirectory,
-         const std::filesystem::path &path,
-         const std::vector<std::string> &arguments,
-         const std::vector<std::string> &environmentVariables,
-         std::filesystem::path &fullPath,
-         std::string &stdOut,
-         std::string &stdErr,
-         bool executableMustExists)
+// Runs resolved executable passing its output to callback; spawn error message is returned in error
+static bool runStream(const std::filesystem::path &workingDirectory,
+                      const std::filesystem::path &fullPath,
+                      const std::filesystem::path &path,
+                      const std::vector<std::string> &arguments,
+                      const ProcessEnvironment &environment,
+                      const OutputCallback &callback,
+                      bool captureStdErr,
+                      CProcessStats *stats,
+                      unsigned timeout,
+                      std::string &error)
 {
-  fullPath = path.is_absolute() ? path : gPathCache.get(path);
-  if (fullPath.empty()) {
-    if (executableMustExists)
-      fprintf(stderr, "ERROR: can't found executable %s\n", path.string().c_str());
-    return false;
-  }
-
 #ifdef WIN32
+  auto startTime = std::chrono::steady_clock::now();
   // Command line
   std::wstring cmdLine(fullPath);
   for (const auto& arg : arguments) {
@@ -119,153 +1053,163 @@ bool run(const std::filesystem::path &workingDirectory,
   }
   
   // Environment variables
-  char* envPtr = GetEnvironmentStringsA();
-  char* p = envPtr;
-  while (p[0] != 0 || p[1] != 0)
-    p++;
-  std::string childProcessEnv(envPtr, p + 1);
-  for (const auto variable : environmentVariables) {
-    childProcessEnv.append(variable);
-    childProcessEnv.push_back('\0');
-  }
-  childProcessEnv.push_back('\0');
-  FreeEnvironmentStringsA(envPtr);
+  std::string childProcessEnv = environment.block();
 
   HANDLE stdoutRead;
   HANDLE stdoutWrite;
-  HANDLE stderrRead;
-  HANDLE stderrWrite;
+  HANDLE stderrRead = NULL;
+  HANDLE stderrWrite = NULL;
   SECURITY_ATTRIBUTES attrs;
   attrs.nLength = sizeof(attrs);
   attrs.bInheritHandle = TRUE;
   attrs.lpSecurityDescriptor = NULL;
   if (!CreatePipe(&stdoutRead, &stdoutWrite, &attrs, 0))
     return false;
-  if (!CreatePipe(&stderrRead, &stderrWrite, &attrs, 0))
+  if (captureStdErr && !CreatePipe(&stderrRead, &stderrWrite, &attrs, 0)) {
+    CloseHandle(stdoutRead);
+    CloseHandle(stdoutWrite);
     return false;
+  }
 
   STARTUPINFOW startupInfo;
   memset(&startupInfo, 0, sizeof(startupInfo));
   startupInfo.cb = sizeof(startupInfo);
   startupInfo.dwFlags = STARTF_USESHOWWINDOW | STARTF_USESTDHANDLES;
   startupInfo.hStdOutput = stdoutWrite;
-  startupInfo.hStdError = stderrWrite;
+  startupInfo.hStdError = captureStdErr ? stderrWrite : GetStdHandle(STD_ERROR_HANDLE);
   startupInfo.wShowWindow = SW_HIDE;
   startupInfo.cb = sizeof(startupInfo);
 
   PROCESS_INFORMATION processInfo = { 0 };
-  BOOL result = CreateProcessW(NULL, const_cast<LPWSTR>(cmdLine.c_str()), NULL, NULL, TRUE, CREATE_NEW_CONSOLE, const_cast<char*>(childProcessEnv.c_str()), workingDirectory.c_str(), &startupInfo, &processInfo);
+  BOOL result = CreateProcessW(NULL, const_cast<LPWSTR>(cmdLine.c_str()), NULL, NULL, TRUE, captureStdErr ? CREATE_NEW_CONSOLE : 0, const_cast<char*>(childProcessEnv.c_str()), workingDirectory.c_str(), &startupInfo, &processInfo);
   CloseHandle(stdoutWrite);
-  CloseHandle(stderrWrite);
+  if (captureStdErr)
+    CloseHandle(stderrWrite);
   if (!result) {
     CloseHandle(stdoutRead);
-    CloseHandle(stderrRead);
+    if (captureStdErr)
+      CloseHandle(stderrRead);
     return false;
   }
 
   AssignProcessToJobObject(gJob.Job, processInfo.hProcess);
 
-  bool finished = false;
-  while (!finished) {
+  // Anonymous pipes can't be polled, stderr is drained by separate thread
+  // until child closes it; callback calls are serialized
+  std::mutex callbackMutex;
+  bool stopped = false;
+  auto drain = [&](HANDLE pipe, EOutputStream stream) {
     DWORD dwRead = 0;
-    char buffer[4096];
-    finished = WaitForSingleObject(processInfo.hProcess, 10) == WAIT_OBJECT_0;
-      
-    while (ReadFile(stdoutRead, buffer, sizeof(buffer), &dwRead, NULL) && dwRead)
-      stdOut.append(buffer, dwRead);
-    while (ReadFile(stderrRead, buffer, sizeof(buffer), &dwRead, NULL) && dwRead)
-      stdErr.append(buffer, dwRead);
-  }
+    std::unique_ptr<char[]> buffer(new char[65536]);
+    while (ReadFile(pipe, buffer.get(), 65536, &dwRead, NULL) && dwRead) {
+      std::lock_guard lock(callbackMutex);
+      if (!stopped && !callback(stream, buffer.get(), dwRead)) {
+        stopped = true;
+        TerminateProcess(processInfo.hProcess, 1);
+      }
+    }
+  };
+
+  ProcessWatchdog watchdog(processInfo.hProcess, timeout);
+  std::thread stderrThread;
+  if (captureStdErr)
+    stderrThread = std::thread(drain, stderrRead, EOutputStream::StdErr);
+  drain(stdoutRead, EOutputStream::StdOut);
+  if (captureStdErr)
+    stderrThread.join();
+  WaitForSingleObject(processInfo.hProcess, INFINITE);
+  bool timedOut = watchdog.wait();
+  if (timedOut)
+    reportTimeout(path, timeout);
 
   DWORD exitCode = 1;
   CloseHandle(stdoutRead);
-  CloseHandle(stderrRead);
+  if (captureStdErr)
+    CloseHandle(stderrRead);
   BOOL exitCodeReceived = GetExitCodeProcess(processInfo.hProcess, &exitCode);
+  collectProcessStats(processInfo.hProcess, startTime, stats);
   CloseHandle(processInfo.hProcess);
-  return exitCodeReceived && exitCode == 0;
+  return !timedOut && (stopped || (exitCodeReceived && exitCode == 0));
 #else
-  std::vector<char*> cmdLine;
-  std::vector<char*> env;
-  // command line
-  cmdLine.push_back(const_cast<char*>(path.c_str()));
-  for (const auto &arg: arguments)
-    cmdLine.push_back(const_cast<char*>(arg.c_str()));
-  cmdLine.push_back(0);
-  // environment
-  {
-    char **envPtr = environ;
-    while (*envPtr) {
-      env.push_back(*envPtr);
-      envPtr++;
-    }
-  }
-  for (const auto &envPtr: environmentVariables)
-    env.push_back(const_cast<char*>(envPtr.c_str()));
-  env.push_back(0);
-
-
-
   int stdoutPipe[2];
-  int stderrPipe[2];
-  if (pipe(stdoutPipe) == -1)
-    return false;
-  if (pipe(stderrPipe) == -1)
-    return false;
-  pid_t pid = fork();
-  if (pid == -1)
+  int stderrPipe[2] = {-1, -1};
+  if (!createPipe(stdoutPipe))
     return false;
-  if (pid == 0) {
-    dup2(stdoutPipe[1], STDOUT_FILENO);
-    dup2(stderrPipe[1], STDERR_FILENO);
+  if (captureStdErr && !createPipe(stderrPipe)) {
     close(stdoutPipe[0]);
     close(stdoutPipe[1]);
-    close(stderrPipe[0]);
-    close(stderrPipe[1]);
-    if (chdir(workingDirectory.c_str()) == -1) {
-      fprintf(stderr, "chdir ERROR %s: \"", strerror(errno));
-      exit(1);
-    }
+    return false;
+  }
 
-    if (execve(fullPath.c_str(), &cmdLine[0], &env[0]) == -1) {
-      fprintf(stderr, "execv ERROR %s: \"", strerror(errno));
-      for (size_t i = 0, ie = cmdLine.size() - 1; i != ie; ++i) {
-        fprintf(stderr, i != (ie-1) ? "%s " : "%s", cmdLine[i]);
-      }
-      fprintf(stderr, "\"\n");
-      exit(1);
-    } else {
-      exit(0);
-    }
-  } else {
-    close(stdoutPipe[1]);
+  CChildProcess child;
+  bool spawned = spawnProcess(workingDirectory, fullPath, path, arguments, environment, stdoutPipe[1], stderrPipe[1], true, child, error);
+  close(stdoutPipe[1]);
+  if (captureStdErr)
     close(stderrPipe[1]);
-    ssize_t bytesRead = 0;
-    char buffer[4096];
-    while ( (bytesRead = read(stdoutPipe[0], buffer, sizeof(buffer))) != 0)
-      stdOut.append(buffer, bytesRead);
-    while ( (bytesRead = read(stderrPipe[0], buffer, sizeof(buffer))) != 0)
-      stdErr.append(buffer, bytesRead);
-    int exitCode;
-    do {
-      waitpid(pid, &exitCode, WUNTRACED);
-     } while (!WIFEXITED(exitCode) && !WIFSIGNALED(exitCode));
-     return exitCode == 0;
+  if (!spawned) {
+    close(stdoutPipe[0]);
+    if (captureStdErr)
+      close(stderrPipe[0]);
+    return false;
   }
 
-  return true;
+  child.setTimeout(timeout);
+  EPumpResult pumpResult = pumpPipes(stdoutPipe[0], stderrPipe[0], callback, child.Deadline);
+  // Caller has everything it needs, rest of output is not interesting
+  if (pumpResult != EPumpResult::Completed)
+    child.kill();
+  if (pumpResult == EPumpResult::TimedOut)
+    reportTimeout(path, timeout);
+  close(stdoutPipe[0]);
+  if (captureStdErr)
+    close(stderrPipe[0]);
+  bool timedOut = false;
+  bool success = waitProcess(child, stats, timedOut);
+  return pumpResult == EPumpResult::Stopped || (pumpResult == EPumpResult::Completed && success);
 #endif
 }
 
-bool runCaptureLog(const std::filesystem::path &workingDirectory, const std::filesystem::path &path, const std::vector<std::string> &arguments, const std::vector<std::string> &environmentVariables, FILE *log, bool executableMustExists)
+bool run(const std::filesystem::path &workingDirectory,
+         const std::filesystem::path &path,
+         const std::vector<std::string> &arguments,
+         const ProcessEnvironment &environment,
+         std::filesystem::path &fullPath,
+         std::string &stdOut,
+         std::string &stdErr,
+         bool executableMustExists)
 {
-  std::filesystem::path fullPath = path.is_absolute() ? path : gPathCache.get(path);
+  fullPath = path.is_absolute() ? path : gPathCache.get(path);
   if (fullPath.empty()) {
     if (executableMustExists)
       fprintf(stderr, "ERROR: can't found executable %s\n", path.string().c_str());
     return false;
   }
 
+  std::string error;
+  bool result = runStream(workingDirectory, fullPath, path, arguments, environment, [&stdOut, &stdErr](EOutputStream stream, const char *data, size_t size) {
+    (stream == EOutputStream::StdOut ? stdOut : stdErr).append(data, size);
+    return true;
+  }, true, nullptr, 0, error);
+  stdErr.append(error);
+  return result;
+}
+
+// Runs resolved executable with stdout and stderr merged into one pipe. Output and error messages
+// are passed to consumer, echo copies output to our stdout. logFd is file behind consumer (or -1),
+// output may be spliced into it directly
+static bool runMerged(const std::filesystem::path &workingDirectory,
+                      const std::filesystem::path &fullPath,
+                      const std::filesystem::path &path,
+                      const std::vector<std::string> &arguments,
+                      const ProcessEnvironment &environment,
+                      const OutputCallback &consumer,
+                      int logFd,
+                      bool echo,
+                      CProcessStats *stats,
+                      unsigned timeout)
+{
 #ifdef WIN32
+  auto startTime = std::chrono::steady_clock::now();
   // Command line
   std::wstring cmdLine(fullPath);
   for (const auto& arg : arguments) {
@@ -281,17 +1225,7 @@ bool runCaptureLog(const std::filesystem::path &workingDirectory, const std::fil
   }
 
   // Environment variables
-  char *envPtr = GetEnvironmentStringsA();
-  char* p = envPtr;
-  while (p[0] != 0 || p[1] != 0)
-    p++;
-  std::string childProcessEnv(envPtr, p + 1);
-  for (const auto variable : environmentVariables) {
-    childProcessEnv.append(variable);
-    childProcessEnv.push_back('\0');
-  }
-  childProcessEnv.push_back('\0');
-  FreeEnvironmentStringsA(envPtr);
+  std::string childProcessEnv = environment.block();
 
   HANDLE outputRead;
   HANDLE outputWrite;
@@ -321,6 +1255,7 @@ bool runCaptureLog(const std::filesystem::path &workingDirectory, const std::fil
 
   AssignProcessToJobObject(gJob.Job, processInfo.hProcess);
 
+  ProcessWatchdog watchdog(processInfo.hProcess, timeout);
   bool finished = false;
   while (!finished) {
     DWORD dwRead = 0;
@@ -329,81 +1264,160 @@ bool runCaptureLog(const std::filesystem::path &workingDirectory, const std::fil
 
     while (ReadFile(outputRead, buffer, sizeof(buffer), &dwRead, NULL) && dwRead) {
       DWORD bytesWritten = 0;
-      fwrite(buffer, 1, dwRead, log);
-      WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), buffer, dwRead, &bytesWritten, NULL);
+      consumer(EOutputStream::StdOut, buffer, dwRead);
+      if (echo)
+        WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), buffer, dwRead, &bytesWritten, NULL);
     }
   }
 
+  bool timedOut = watchdog.wait();
+  if (timedOut) {
+    std::string message = reportTimeout(path, timeout);
+    consumer(EOutputStream::StdOut, message.data(), message.size());
+  }
+
   DWORD exitCode = 1;
   CloseHandle(outputRead);
   BOOL exitCodeReceived = GetExitCodeProcess(processInfo.hProcess, &exitCode);
+  collectProcessStats(processInfo.hProcess, startTime, stats);
   CloseHandle(processInfo.hProcess);
-  return exitCodeReceived && exitCode == 0;
+  return !timedOut && exitCodeReceived && exitCode == 0;
 #else
-  std::vector<char*> cmdLine;
-  std::vector<char*> env;
-  // command line
-  cmdLine.push_back(const_cast<char*>(path.c_str()));
-  for (const auto &arg: arguments)
-    cmdLine.push_back(const_cast<char*>(arg.c_str()));
-  cmdLine.push_back(0);
-  // environment
-  {
-    char **envPtr = environ;
-    while (*envPtr) {
-      env.push_back(*envPtr);
-      envPtr++;
-    }
+  int logPipe[2];
+  if (!createPipe(logPipe))
+    return false;
+
+  CChildProcess child;
+  std::string error;
+  bool spawned = spawnProcess(workingDirectory, fullPath, path, arguments, environment, logPipe[1], logPipe[1], true, child, error);
+  close(logPipe[1]);
+  if (!spawned) {
+    close(logPipe[0]);
+    consumer(EOutputStream::StdOut, error.data(), error.size());
+    fputs(error.c_str(), stderr);
+    return false;
   }
-  for (const auto &envPtr: environmentVariables)
-    env.push_back(const_cast<char*>(envPtr.c_str()));
-  env.push_back(0);
 
-  int logPipe[2];
-  if (pipe(logPipe) == -1)
+  child.setTimeout(timeout);
+  EPumpResult pumpResult = EPumpResult::Completed;
+  bool spliced = false;
+#ifdef __linux__
+  spliced = spliceLog(logPipe[0], logFd, consumer, echo, child.Deadline, pumpResult);
+#endif
+  // Rest of output (all of it when splice is not supported) is copied through userspace
+  if (!spliced) {
+    pumpResult = pumpPipes(logPipe[0], -1, [&consumer, echo](EOutputStream stream, const char *data, size_t size) {
+      consumer(stream, data, size);
+      if (echo)
+        fwrite(data, 1, size, stdout);
+      return true;
+    }, child.Deadline);
+  }
+  if (pumpResult == EPumpResult::TimedOut) {
+    child.kill();
+    std::string message = reportTimeout(path, timeout);
+    consumer(EOutputStream::StdOut, message.data(), message.size());
+  }
+  close(logPipe[0]);
+  bool timedOut = false;
+  return waitProcess(child, stats, timedOut) && pumpResult == EPumpResult::Completed;
+#endif
+}
+
+bool runCaptureLog(const std::filesystem::path &workingDirectory, const std::filesystem::path &path, const std::vector<std::string> &arguments, const ProcessEnvironment &environment, FILE *log, bool executableMustExists, CProcessStats *stats, unsigned timeout)
+{
+  std::filesystem::path fullPath = path.is_absolute() ? path : gPathCache.get(path);
+  if (fullPath.empty()) {
+    if (executableMustExists)
+      fprintf(stderr, "ERROR: can't found executable %s\n", path.string().c_str());
     return false;
-  pid_t pid = fork();
-  if (pid == -1)
+  }
+
+  // Output may be written to log descriptor directly, FILE position is synchronized after
+  fflush(log);
+#ifdef WIN32
+  int logFd = -1;
+#else
+  int logFd = fileno(log);
+#endif
+  bool result = runMerged(workingDirectory, fullPath, path, arguments, environment, [log](EOutputStream, const char *data, size_t size) {
+    fwrite(data, 1, size, log);
+    return true;
+  }, logFd, true, stats, timeout);
+  fseek(log, 0, SEEK_END);
+  return result;
+}
+
+bool runCaptureOutput(const std::filesystem::path &workingDirectory, const std::filesystem::path &path, const std::vector<std::string> &arguments, const ProcessEnvironment &environment, const OutputCallback &consumer, bool echo, bool executableMustExists, CProcessStats *stats, unsigned timeout)
+{
+  std::filesystem::path fullPath = path.is_absolute() ? path : gPathCache.get(path);
+  if (fullPath.empty()) {
+    if (executableMustExists)
+      fprintf(stderr, "ERROR: can't found executable %s\n", path.string().c_str());
     return false;
-  if (pid == 0) {
-    dup2(logPipe[1], STDOUT_FILENO);
-    dup2(logPipe[1], STDERR_FILENO);
-    close(logPipe[0]);
-    close(logPipe[1]);
-    if (chdir(workingDirectory.c_str()) == -1) {
-      fprintf(stderr, "chdir ERROR %s: \"", strerror(errno));
-      exit(1);
-    }
-    if (execve(fullPath.c_str(), &cmdLine[0], &env[0]) == -1) {
-      fprintf(stderr, "execv ERROR %s: \"", strerror(errno));
-      for (size_t i = 0, ie = cmdLine.size() - 1; i != ie; ++i) {
-        fprintf(stderr, i != (ie-1) ? "%s " : "%s", cmdLine[i]);
+  }
+
+  return runMerged(workingDirectory, fullPath, path, arguments, environment, consumer, -1, echo, stats, timeout);
+}
+
+bool runStreamOutput(const std::filesystem::path &workingDirectory, const std::filesystem::path &path, const std::vector<std::string> &arguments, const ProcessEnvironment &environment, const OutputCallback &callback, bool captureStdErr, bool executableMustExists, CProcessStats *stats, unsigned timeout)
+{
+  std::filesystem::path fullPath = path.is_absolute() ? path : gPathCache.get(path);
+  if (fullPath.empty()) {
+    if (executableMustExists)
+      fprintf(stderr, "ERROR: can't found executable %s\n", path.string().c_str());
+    return false;
+  }
+
+  std::string error;
+  bool result = runStream(workingDirectory, fullPath, path, arguments, environment, callback, captureStdErr, stats, timeout, error);
+  fputs(error.c_str(), stderr);
+  return result;
+}
+
+bool runStreamLines(const std::filesystem::path &workingDirectory, const std::filesystem::path &path, const std::vector<std::string> &arguments, const ProcessEnvironment &environment, const OutputLineCallback &callback, bool captureStdErr, bool executableMustExists)
+{
+  // Incomplete last line of each stream waits for next chunk
+  std::string pending[2];
+  bool stopped = false;
+  auto emitLine = [&](EOutputStream stream, std::string_view line) {
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    stopped = !callback(stream, line);
+    return !stopped;
+  };
+
+  bool result = runStreamOutput(workingDirectory, path, arguments, environment, [&](EOutputStream stream, const char *data, size_t size) {
+    std::string &tail = pending[static_cast<unsigned>(stream)];
+    const char *end = data + size;
+    const char *p;
+    while ( (p = static_cast<const char*>(memchr(data, '\n', end - data))) ) {
+      bool next;
+      if (tail.empty()) {
+        next = emitLine(stream, std::string_view(data, p - data));
+      } else {
+        tail.append(data, p - data);
+        next = emitLine(stream, tail);
+        tail.clear();
       }
-      fprintf(stderr, "\"\n");
-      exit(1);
-    } else {
-      exit(0);
-    }
-  } else {
-    close(logPipe[1]);
-    ssize_t bytesRead = 0;
-    char buffer[4096];
-    while ( (bytesRead = read(logPipe[0], buffer, sizeof(buffer))) != 0) {
-      fwrite(buffer, 1, bytesRead, log);
-      fwrite(buffer, 1, bytesRead, stdout);
+      if (!next)
+        return false;
+      data = p + 1;
     }
-    int exitCode;
-    do {
-      waitpid(pid, &exitCode, WUNTRACED);
-     } while (!WIFEXITED(exitCode) && !WIFSIGNALED(exitCode));
-     return exitCode == 0;
+
+    tail.append(data, end - data);
+    return true;
+  }, captureStdErr, executableMustExists);
+
+  for (unsigned i = 0; i < 2 && !stopped; i++) {
+    if (!pending[i].empty())
+      emitLine(static_cast<EOutputStream>(i), pending[i]);
   }
 
-  return true;
-#endif
+  return result;
 }
 
-bool runNoCapture(const std::filesystem::path &workingDirectory, const std::filesystem::path &path, const std::vector<std::string> &arguments, const std::vector<std::string> &environmentVariables, bool executableMustExists)
+bool runNoCapture(const std::filesystem::path &workingDirectory, const std::filesystem::path &path, const std::vector<std::string> &arguments, const ProcessEnvironment &environment, bool executableMustExists, CProcessStats *stats, unsigned timeout, bool interactive)
 {
   std::filesystem::path fullPath = path.is_absolute() ? path : gPathCache.get(path);
   if (fullPath.empty()) {
@@ -413,6 +1427,7 @@ bool runNoCapture(const std::filesystem::path &workingDirectory, const std::file
   }
 
 #ifdef WIN32
+  auto startTime = std::chrono::steady_clock::now();
   // Command line
   std::wstring cmdLine(fullPath);
   for (const auto& arg : arguments) {
@@ -428,17 +1443,7 @@ bool runNoCapture(const std::filesystem::path &workingDirectory, const std::file
   }
 
   // Environment variables
-  char* envPtr = GetEnvironmentStringsA();
-  char* p = envPtr;
-  while (p[0] != 0 || p[1] != 0)
-    p++;
-  std::string childProcessEnv(envPtr, p + 1);
-  for (const auto variable : environmentVariables) {
-    childProcessEnv.append(variable);
-    childProcessEnv.push_back('\0');
-  }
-  childProcessEnv.push_back('\0');
-  FreeEnvironmentStringsA(envPtr);
+  std::string childProcessEnv = environment.block();
 
   STARTUPINFOW startupInfo;
   memset(&startupInfo, 0, sizeof(startupInfo));
@@ -457,66 +1462,378 @@ bool runNoCapture(const std::filesystem::path &workingDirectory, const std::file
   AssignProcessToJobObject(gJob.Job, processInfo.hProcess);
 
   bool finished = false;
-  while (!finished)
+  bool timedOut = false;
+  while (!finished) {
     finished = WaitForSingleObject(processInfo.hProcess, 10) == WAIT_OBJECT_0;
+    if (!finished && timeout && std::chrono::steady_clock::now() - startTime >= std::chrono::seconds(timeout)) {
+      timedOut = true;
+      TerminateProcess(processInfo.hProcess, 1);
+    }
+  }
+
+  if (timedOut)
+    reportTimeout(path, timeout);
 
   DWORD exitCode = 1;
   BOOL exitCodeReceived = GetExitCodeProcess(processInfo.hProcess, &exitCode);
+  collectProcessStats(processInfo.hProcess, startTime, stats);
   CloseHandle(processInfo.hProcess);
-  return exitCodeReceived && exitCode == 0;
+  return !timedOut && exitCodeReceived && exitCode == 0;
 #else
-  std::vector<char*> cmdLine;
-  std::vector<char*> env;
-  // command line
-  cmdLine.push_back(const_cast<char*>(path.c_str()));
-  for (const auto &arg: arguments)
-    cmdLine.push_back(const_cast<char*>(arg.c_str()));
-  cmdLine.push_back(0);
-  // environment
+  // Child leads own process group, so timeout and termination kill its descendants too;
+  // interactive one may ask user (git credentials), so it gets terminal while running
+  CChildProcess child;
+  std::string error;
+  if (!spawnProcess(workingDirectory, fullPath, path, arguments, environment, -1, -1, true, child, error)) {
+    fputs(error.c_str(), stderr);
+    return false;
+  }
+
+  int terminalFd = interactive ? handOffTerminal(child) : -1;
+  child.setTimeout(timeout);
+  bool timedOut = false;
+  bool result = waitProcess(child, stats, timedOut);
+  reclaimTerminal(terminalFd);
+  if (timedOut)
+    reportTimeout(path, timeout);
+  return result;
+#endif
+}
+
+void terminateAllChildProcess()
+{
+#ifdef WIN32
+  TerminateJobObject(gJob.Job, 0);
+#else
+  // Async-signal-safe: only atomic loads and kill
+  for (auto &slot: gChildProcesses) {
+    pid_t target = slot.load();
+    if (target != 0)
+      kill(target, SIGKILL);
+  }
+#endif
+}
+
+struct ProcessExecutor::CTask {
+  std::filesystem::path WorkingDirectory;
+  std::filesystem::path FullPath;
+  std::filesystem::path Path;
+  std::vector<std::string> Arguments;
+  ProcessEnvironment Environment;
+  OutputCallback Callback;
+  bool CaptureStdErr = false;
+  unsigned Timeout = 0;
+  std::promise<CProcessResult> Promise;
+  CProcessResult Result;
+#ifdef __linux__
+  CChildProcess Child;
+  int Fds[2] = {-1, -1};
+  int PidFd = -1;
+  bool Exited = false;
+  bool Stopped = false;
+  bool TimedOut = false;
+#endif
+};
+
+ProcessExecutor::ProcessExecutor(unsigned concurrency) :
+  Concurrency_(concurrency ? concurrency : std::max(std::thread::hardware_concurrency(), 1u))
+{
+#ifdef __linux__
+  WakeupFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  Threads_.emplace_back(&ProcessExecutor::loop, this);
+#else
+  for (unsigned i = 0; i < Concurrency_; i++)
+    Threads_.emplace_back(&ProcessExecutor::worker, this);
+#endif
+}
+
+ProcessExecutor::~ProcessExecutor()
+{
+  {
+    std::unique_lock lock(Mutex_);
+    Stopping_ = true;
+  }
+  Queued_.notify_all();
+#ifdef __linux__
+  uint64_t value = 1;
+  write(WakeupFd_, &value, sizeof(value));
+#endif
+  for (auto &thread: Threads_)
+    thread.join();
+#ifdef __linux__
+  close(WakeupFd_);
+#endif
+}
+
+std::future<CProcessResult> ProcessExecutor::launch(const std::filesystem::path &workingDirectory,
+                                                    const std::filesystem::path &path,
+                                                    const std::vector<std::string> &arguments,
+                                                    const ProcessEnvironment &environment,
+                                                    const OutputCallback &callback,
+                                                    bool captureStdErr,
+                                                    bool executableMustExists,
+                                                    unsigned timeout)
+{
+  std::unique_ptr<CTask> task(new CTask);
+  std::future<CProcessResult> future = task->Promise.get_future();
+  task->FullPath = path.is_absolute() ? path : gPathCache.get(path);
+  if (task->FullPath.empty()) {
+    if (executableMustExists)
+      fprintf(stderr, "ERROR: can't found executable %s\n", path.string().c_str());
+    task->Promise.set_value(task->Result);
+    return future;
+  }
+
+  task->WorkingDirectory = workingDirectory;
+  task->Path = path;
+  task->Arguments = arguments;
+  task->Environment = environment;
+  task->Callback = callback;
+  task->CaptureStdErr = captureStdErr;
+  task->Timeout = timeout;
+
   {
-    char **envPtr = environ;
-    while (*envPtr) {
-      env.push_back(*envPtr);
-      envPtr++;
+    std::unique_lock lock(Mutex_);
+    Queue_.push_back(std::move(task));
+    Active_++;
+  }
+  Queued_.notify_one();
+#ifdef __linux__
+  uint64_t value = 1;
+  write(WakeupFd_, &value, sizeof(value));
+#endif
+  return future;
+}
+
+void ProcessExecutor::wait()
+{
+  std::unique_lock lock(Mutex_);
+  Finished_.wait(lock, [this]() { return Active_ == 0; });
+}
+
+// Fallback for systems without epoll: blocking run function in each of concurrency threads
+void ProcessExecutor::worker()
+{
+  for (;;) {
+    std::unique_ptr<CTask> task;
+    {
+      std::unique_lock lock(Mutex_);
+      Queued_.wait(lock, [this]() { return Stopping_ || !Queue_.empty(); });
+      if (Queue_.empty())
+        return;
+      task = std::move(Queue_.front());
+      Queue_.pop_front();
     }
+
+    task->Result.Success = task->Callback ?
+      runStreamOutput(task->WorkingDirectory, task->FullPath, task->Arguments, task->Environment, task->Callback, task->CaptureStdErr, true, &task->Result.Stats, task->Timeout) :
+      runNoCapture(task->WorkingDirectory, task->FullPath, task->Arguments, task->Environment, true, &task->Result.Stats, task->Timeout);
+    task->Promise.set_value(task->Result);
+
+    std::unique_lock lock(Mutex_);
+    Active_--;
+    Finished_.notify_all();
   }
-  for (const auto &envPtr: environmentVariables)
-    env.push_back(const_cast<char*>(envPtr.c_str()));
-  env.push_back(0);
+}
 
-  pid_t pid = fork();
-  if (pid == -1)
-    return false;
-  if (pid == 0) {
-    if (chdir(workingDirectory.c_str()) == -1) {
-      fprintf(stderr, "chdir ERROR %s: \"", strerror(errno));
-      exit(1);
-    }
-    if (execve(fullPath.c_str(), &cmdLine[0], &env[0]) == -1) {
-      fprintf(stderr, "execv ERROR %s: \"", strerror(errno));
-      for (size_t i = 0, ie = cmdLine.size() - 1; i != ie; ++i) {
-        fprintf(stderr, i != (ie-1) ? "%s " : "%s", cmdLine[i]);
+#ifdef __linux__
+static void closeFd(int epollFd, int &fd)
+{
+  if (fd == -1)
+    return;
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  fd = -1;
+}
+
+void ProcessExecutor::loop()
+{
+  static constexpr size_t bufferSize = 1u << 16;
+  std::unique_ptr<char[]> buffer(new char[bufferSize]);
+
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  auto watch = [epollFd](int fd) {
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+  };
+  watch(WakeupFd_);
+
+  std::vector<std::unique_ptr<CTask>> running;
+  // Descriptor -> task and stream (0, 1 for pipes, 2 for pidfd)
+  std::unordered_map<int, std::pair<CTask*, unsigned>> sources;
+
+  auto start = [&](CTask &task) -> bool {
+    int stdoutPipe[2] = {-1, -1};
+    int stderrPipe[2] = {-1, -1};
+    if (task.Callback) {
+      if (!createPipe(stdoutPipe))
+        return false;
+      if (task.CaptureStdErr && !createPipe(stderrPipe)) {
+        close(stdoutPipe[0]);
+        close(stdoutPipe[1]);
+        return false;
       }
-      fprintf(stderr, "\"\n");
-      exit(1);
-    } else {
-      exit(0);
     }
-  } else {
-    int exitCode;
-    do {
-      waitpid(pid, &exitCode, WUNTRACED);
-     } while (!WIFEXITED(exitCode) && !WIFSIGNALED(exitCode));
-     return exitCode == 0;
-  }
 
-  return true;
+    std::string error;
+    bool spawned = spawnProcess(task.WorkingDirectory, task.FullPath, task.Path, task.Arguments, task.Environment, stdoutPipe[1], stderrPipe[1], true, task.Child, error);
+    for (int fd: {stdoutPipe[1], stderrPipe[1]}) {
+      if (fd != -1)
+        close(fd);
+    }
+    if (!spawned) {
+      fputs(error.c_str(), stderr);
+      for (int fd: {stdoutPipe[0], stderrPipe[0]}) {
+        if (fd != -1)
+          close(fd);
+      }
+      return false;
+    }
+
+    task.Child.setTimeout(task.Timeout);
+    task.Fds[0] = stdoutPipe[0];
+    task.Fds[1] = stderrPipe[0];
+    for (unsigned i = 0; i < 2; i++) {
+      if (task.Fds[i] != -1) {
+        fcntl(task.Fds[i], F_SETFL, O_NONBLOCK);
+        watch(task.Fds[i]);
+        sources[task.Fds[i]] = std::make_pair(&task, i);
+      }
+    }
+
+#ifdef SYS_pidfd_open
+    // Without pidfd (kernels older than 5.3) exit is polled
+    task.PidFd = static_cast<int>(syscall(SYS_pidfd_open, task.Child.Pid, 0));
+    if (task.PidFd != -1) {
+      fcntl(task.PidFd, F_SETFD, FD_CLOEXEC);
+      watch(task.PidFd);
+      sources[task.PidFd] = std::make_pair(&task, 2u);
+    }
 #endif
-}
+    return true;
+  };
 
-#ifdef WIN32
-void terminateAllChildProcess()
+  auto stopReading = [&](CTask &task) {
+    for (unsigned i = 0; i < 2; i++) {
+      sources.erase(task.Fds[i]);
+      closeFd(epollFd, task.Fds[i]);
+    }
+  };
+
+  epoll_event events[64];
+  for (;;) {
+    // Start queued processes
+    std::vector<std::unique_ptr<CTask>> failed;
+    {
+      std::unique_lock lock(Mutex_);
+      while (running.size() < Concurrency_ && !Queue_.empty()) {
+        std::unique_ptr<CTask> task = std::move(Queue_.front());
+        Queue_.pop_front();
+        if (start(*task))
+          running.push_back(std::move(task));
+        else
+          failed.push_back(std::move(task));
+      }
+      if (Stopping_ && Queue_.empty() && running.empty() && failed.empty())
+        break;
+    }
+
+    for (auto &task: failed) {
+      task->Promise.set_value(task->Result);
+      std::unique_lock lock(Mutex_);
+      Active_--;
+      Finished_.notify_all();
+    }
+    if (!failed.empty())
+      continue;
+
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    bool pollExit = false;
+    for (const auto &task: running) {
+      if (!task->TimedOut)
+        deadline = std::min(deadline, task->Child.Deadline);
+      pollExit |= task->PidFd == -1 && !task->Exited;
+    }
+
+    int timeout = pollTimeout(deadline);
+    if (pollExit && (timeout == -1 || timeout > 10))
+      timeout = 10;
+    int count = epoll_wait(epollFd, events, sizeof(events)/sizeof(events[0]), timeout);
+    for (int i = 0; i < count; i++) {
+      int fd = events[i].data.fd;
+      if (fd == WakeupFd_) {
+        uint64_t value;
+        read(WakeupFd_, &value, sizeof(value));
+        continue;
+      }
+
+      auto It = sources.find(fd);
+      if (It == sources.end())
+        continue;
+      CTask &task = *It->second.first;
+      unsigned stream = It->second.second;
+      if (stream == 2) {
+        task.Exited = true;
+        sources.erase(It);
+        closeFd(epollFd, task.PidFd);
+        continue;
+      }
+
+      ssize_t bytesRead = read(fd, buffer.get(), bufferSize);
+      if (bytesRead > 0) {
+        if (!task.Callback(static_cast<EOutputStream>(stream), buffer.get(), bytesRead)) {
+          // Caller has everything it needs, rest of output is not interesting
+          task.Stopped = true;
+          task.Child.kill();
+          stopReading(task);
+        }
+      } else if (bytesRead == 0 || (errno != EINTR && errno != EAGAIN)) {
+        sources.erase(It);
+        closeFd(epollFd, task.Fds[stream]);
+      }
+    }
+
+    // Check deadlines and exits, complete processes with closed pipes
+    auto now = std::chrono::steady_clock::now();
+    for (auto I = running.begin(); I != running.end();) {
+      CTask &task = **I;
+      if (!task.TimedOut && now >= task.Child.Deadline) {
+        task.TimedOut = true;
+        task.Child.kill();
+        reportTimeout(task.Path, task.Timeout);
+        stopReading(task);
+      }
+
+      if (!task.Exited && task.PidFd == -1) {
+        siginfo_t info;
+        info.si_pid = 0;
+        task.Exited = waitid(P_PID, task.Child.Pid, &info, WEXITED | WNOWAIT | WNOHANG) == -1 || info.si_pid != 0;
+      }
+
+      if (!task.Exited || task.Fds[0] != -1 || task.Fds[1] != -1) {
+        ++I;
+        continue;
+      }
+
+      // Process already exited, waitProcess doesn't block
+      bool timedOut = false;
+      bool success = waitProcess(task.Child, &task.Result.Stats, timedOut);
+      task.Result.Success = task.Stopped || (!task.TimedOut && success);
+      task.Promise.set_value(task.Result);
+      I = running.erase(I);
+
+      std::unique_lock lock(Mutex_);
+      Active_--;
+      Finished_.notify_all();
+    }
+  }
+
+  close(epollFd);
+}
+#else
+void ProcessExecutor::loop()
 {
-  TerminateJobObject(gJob.Job, 0);
 }
 #endif
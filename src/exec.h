@@ -1,46 +1,225 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <shared_mutex>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+// Resolves executables with PATH directory snapshots: each directory is listed once and
+// name lookup is a single hash lookup, names missing in all directories are resolved
+// without touching file system too. Snapshots are revalidated by directory mtime
 class PathCache {
 public:
   PathCache();
 	void update();
+  // Stores snapshots in file for reuse by next runs
+  void setStorage(const std::filesystem::path &path);
   std::filesystem::path get(const std::filesystem::path &name);
 
 private:
+  struct CDirectorySnapshot {
+    uint64_t MTimeNs = 0;
+    std::vector<std::string> Files;
+  };
+
+  void build();
+  void load();
+  void save();
+  std::filesystem::path find(const std::string &name) const;
+
   std::shared_mutex Mutex_;
-  std::unordered_map<std::string, std::filesystem::path> Cache_;
+  // File name -> full paths of files in PATH directories, lowest priority first
+  std::unordered_map<std::string, std::vector<std::filesystem::path>> Index_;
+  std::unordered_map<std::string, CDirectorySnapshot> Snapshots_;
   std::vector<std::filesystem::path> AllPath_;
+  std::filesystem::path StoragePath_;
+  bool Built_ = false;
+  bool Modified_ = false;
+};
+
+// Environment of child processes: environment of cxx-pm with "NAME=value" overrides, last
+// definition of variable wins. Block is prepared once and shared by all spawns it passed to,
+// environment without overrides is inherited as is
+class ProcessEnvironment {
+public:
+  ProcessEnvironment() = default;
+  ProcessEnvironment(const std::vector<std::string> &overrides);
+  ProcessEnvironment(const ProcessEnvironment &environment);
+  ProcessEnvironment(ProcessEnvironment &&environment) = default;
+  ProcessEnvironment &operator=(const ProcessEnvironment &environment);
+  ProcessEnvironment &operator=(ProcessEnvironment &&environment) = default;
+
+  void set(const std::string &variable);
+  void set(const std::vector<std::string> &variables);
+
+#ifndef WIN32
+  // Null terminated array for execve
+  char **envp() const;
+#else
+  // Double null terminated block for CreateProcess
+  std::string block() const;
+#endif
+
+private:
+  void materialize();
+  void updatePointers();
+
+  std::vector<std::string> Variables_;
+  std::unordered_map<std::string, size_t> Index_;
+  std::vector<char*> Pointers_;
+  bool Materialized_ = false;
+};
+
+// Resources used by child processes; each process is accounted with all descendants it waited for
+struct CProcessStats {
+  double WallTime = 0.0;
+  double UserTime = 0.0;
+  double SystemTime = 0.0;
+  // Peak resident set size of largest process, bytes
+  uint64_t MaxRss = 0;
+  uint64_t VoluntaryContextSwitches = 0;
+  uint64_t InvoluntaryContextSwitches = 0;
+  // Bytes passed through read/write calls and bytes fetched from/sent to storage
+  uint64_t ReadBytes = 0;
+  uint64_t WriteBytes = 0;
+  uint64_t StorageReadBytes = 0;
+  uint64_t StorageWriteBytes = 0;
+  unsigned Processes = 0;
+
+  void add(const CProcessStats &stats);
 };
 
 void updatePath();
+// Enables persistent PATH snapshots stored in file
+void pathCacheEnable(const std::filesystem::path &storagePath);
+// Full path of executable, empty if it not found in PATH
+std::filesystem::path findExecutable(const std::filesystem::path &path);
 
 bool run(const std::filesystem::path &workingDirectory,
 	     const std::filesystem::path &path,
 	     const std::vector<std::string> &arguments,
-	     const std::vector<std::string> &environmentVariables,
+	     const ProcessEnvironment &environment,
 	     std::filesystem::path &fullPath,
 	     std::string &stdOut,
 	     std::string &stdErr,
 	     bool executableMustExists);
 
+// Optional stats accumulate resources used by process. Optional timeout is wall-clock
+// limit in seconds, process tree running longer is killed and run function fails
 bool runCaptureLog(const std::filesystem::path &workingDirectory,
 	               const std::filesystem::path &path,
 	               const std::vector<std::string> &arguments,
-	               const std::vector<std::string> &environmentVariables, 
+	               const ProcessEnvironment &environment, 
 	               FILE *log,
-	               bool executableMustExists);
+	               bool executableMustExists,
+	               CProcessStats *stats = nullptr,
+	               unsigned timeout = 0);
+
+enum class EOutputStream : unsigned {
+  StdOut = 0,
+  StdErr
+};
 
+// Output consumers return false when they got everything they need: reading stops,
+// process is killed and run function returns true
+typedef std::function<bool(EOutputStream, const char*, size_t)> OutputCallback;
+typedef std::function<bool(EOutputStream, std::string_view)> OutputLineCallback;
+
+// Passes output of process to callback as data arrives; stderr is passed only when
+// captureStdErr is set, otherwise it is inherited from parent
+bool runStreamOutput(const std::filesystem::path &workingDirectory,
+	                 const std::filesystem::path &path,
+	                 const std::vector<std::string> &arguments,
+	                 const ProcessEnvironment &environment,
+	                 const OutputCallback &callback,
+	                 bool captureStdErr,
+	                 bool executableMustExists,
+	                 CProcessStats *stats = nullptr,
+	                 unsigned timeout = 0);
+
+// Passes merged stdout and stderr of process to consumer (build logs), echo copies it to stdout
+bool runCaptureOutput(const std::filesystem::path &workingDirectory,
+	                  const std::filesystem::path &path,
+	                  const std::vector<std::string> &arguments,
+	                  const ProcessEnvironment &environment,
+	                  const OutputCallback &consumer,
+	                  bool echo,
+	                  bool executableMustExists,
+	                  CProcessStats *stats = nullptr,
+	                  unsigned timeout = 0);
+
+// Same as runStreamOutput, but output is split to lines without line terminators
+bool runStreamLines(const std::filesystem::path &workingDirectory,
+	                const std::filesystem::path &path,
+	                const std::vector<std::string> &arguments,
+	                const ProcessEnvironment &environment,
+	                const OutputLineCallback &callback,
+	                bool captureStdErr,
+	                bool executableMustExists);
+
+// Child inherits stdio; interactive child gets terminal while it runs, so it can ask user
 bool runNoCapture(const std::filesystem::path &workingDirectory, 
 	              const std::filesystem::path &path, 
 	              const std::vector<std::string> &arguments,
-	              const std::vector<std::string> &environmentVariables,
-	              bool executableMustExists);
+	              const ProcessEnvironment &environment,
+	              bool executableMustExists,
+	              CProcessStats *stats = nullptr,
+	              unsigned timeout = 0,
+	              bool interactive = true);
+
+struct CProcessResult {
+  // Same meaning as result of blocking run functions
+  bool Success = false;
+  CProcessStats Stats;
+};
+
+// Runs child processes concurrently: one event loop thread multiplexes output pipes and
+// exit notifications of all children (epoll and pidfd on Linux, worker threads elsewhere).
+// No more than concurrency children run at once, other wait in queue. Callbacks are called
+// from executor thread, they must not block. Without callback output is inherited from parent
+class ProcessExecutor {
+public:
+  ProcessExecutor(unsigned concurrency = 0);
+  // Waits for all launched processes
+  ~ProcessExecutor();
 
-#ifdef WIN32
+  std::future<CProcessResult> launch(const std::filesystem::path &workingDirectory,
+                                     const std::filesystem::path &path,
+                                     const std::vector<std::string> &arguments,
+                                     const ProcessEnvironment &environment,
+                                     const OutputCallback &callback,
+                                     bool captureStdErr,
+                                     bool executableMustExists,
+                                     unsigned timeout = 0);
+  void wait();
+
+private:
+  struct CTask;
+
+  void loop();
+  void worker();
+
+  unsigned Concurrency_;
+  std::mutex Mutex_;
+  std::condition_variable Queued_;
+  std::condition_variable Finished_;
+  std::deque<std::unique_ptr<CTask>> Queue_;
+  unsigned Active_ = 0;
+  bool Stopping_ = false;
+  // eventfd waking up event loop
+  int WakeupFd_ = -1;
+  std::vector<std::thread> Threads_;
+};
+
+// Kills all running children with their descendants, safe to call from signal handler
 void terminateAllChildProcess();
-#endif
@@ -0,0 +1,1837 @@
+#include "extract.h"
+extern "C" {
+#include "tiny_sha3.h"
+}
+#include "exec.h"
+#include "fileio.h"
+#include "strExtras.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#ifdef CXXPM_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CXXPM_HAVE_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef CXXPM_HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef CXXPM_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Archive is read, hashed and decompressed by chunks of this size
+static constexpr size_t readChunkSize = 1 << 20;
+static constexpr size_t outputBufferSize = 256 * 1024;
+// Files up to this size are buffered and written by thread pool, larger ones are streamed
+static constexpr size_t smallFileLimit = 1 << 20;
+// Limit of buffered data waiting for writers
+static constexpr size_t maxPendingBytes = 64 << 20;
+static constexpr unsigned maxWriters = 8;
+// Blocks queued between pipeline stages (reading, decompression, parsing)
+static constexpr size_t pipelineDepth = 8;
+
+typedef std::function<bool(const uint8_t*, size_t)> DataSink;
+
+enum class ECompression : unsigned {
+  None = 0,
+  Gzip,
+  Bzip2,
+  Xz,
+  Lzma,
+  Lzip,
+  Zstd
+};
+
+static std::string hashToString(sha3_ctx_t &ctx)
+{
+  uint8_t hash[32];
+  char hex[72] = {0};
+  sha3_final(hash, &ctx, 0);
+  bin2hexLowerCase(hash, hex, 32);
+  return hex;
+}
+
+static bool archiveFormat(const std::filesystem::path &archive, bool &zip, ECompression &compression)
+{
+  std::string name = archive.filename().string();
+  zip = false;
+  compression = ECompression::None;
+  if (endsWith(name, ".zip"))
+    zip = true;
+  else if (endsWith(name, ".tar"))
+    compression = ECompression::None;
+  else if (endsWith(name, ".tar.gz") || endsWith(name, ".tgz"))
+    compression = ECompression::Gzip;
+  else if (endsWith(name, ".tar.bz2") || endsWith(name, ".tbz2"))
+    compression = ECompression::Bzip2;
+  else if (endsWith(name, ".tar.xz") || endsWith(name, ".txz"))
+    compression = ECompression::Xz;
+  else if (endsWith(name, ".tar.lzma"))
+    compression = ECompression::Lzma;
+  else if (endsWith(name, ".tar.lz"))
+    compression = ECompression::Lzip;
+  else if (endsWith(name, ".tar.zst") || endsWith(name, ".tzst"))
+    compression = ECompression::Zstd;
+  else
+    return false;
+  return true;
+}
+
+static bool compressionSupported(ECompression compression)
+{
+  switch (compression) {
+    case ECompression::None :
+      return true;
+#ifdef CXXPM_HAVE_ZLIB
+    case ECompression::Gzip :
+      return true;
+#endif
+#ifdef CXXPM_HAVE_BZIP2
+    case ECompression::Bzip2 :
+      return true;
+#endif
+#ifdef CXXPM_HAVE_LZMA
+    case ECompression::Xz :
+    case ECompression::Lzma :
+      return true;
+#if LZMA_VERSION >= 50040000
+    case ECompression::Lzip :
+      return true;
+#endif
+#endif
+#ifdef CXXPM_HAVE_ZSTD
+    case ECompression::Zstd :
+      return true;
+#endif
+    default :
+      return false;
+  }
+}
+
+// Creates extracted files. Small files are buffered and written by thread pool, large ones are
+// streamed by reader thread. Links and zip attributes are applied when all files written, so
+// file can't be written through symlink from archive
+class ExtractWriter {
+public:
+  ExtractWriter(const std::filesystem::path &destination, unsigned threadsNum) : Destination_(destination) {
+    for (unsigned i = 0; i < threadsNum; i++)
+      Threads_.emplace_back([this]() { worker(); });
+  }
+
+  ~ExtractWriter() {
+    {
+      std::lock_guard lock(Mutex_);
+      Stopping_ = true;
+    }
+    Queued_.notify_all();
+    for (auto &thread: Threads_)
+      thread.join();
+    closeCurrent(false);
+  }
+
+  // Converts archive entry name to path in destination; false for names leaving destination.
+  // Empty path is returned for destination itself
+  bool resolve(const std::string &name, std::filesystem::path &path) {
+    path.clear();
+    StringSplitter splitter(name, "/");
+    while (splitter.next()) {
+      std::string_view component = splitter.get();
+      if (component.empty() || component == ".")
+        continue;
+#ifdef WIN32
+      if (component == ".." || component.find_first_of(":\\") != component.npos) {
+#else
+      if (component == "..") {
+#endif
+        fprintf(stderr, "ERROR: unsafe path in archive: %s\n", name.c_str());
+        return false;
+      }
+      path /= std::string(component);
+    }
+    return true;
+  }
+
+  bool directory(const std::string &name) {
+    std::filesystem::path relative;
+    if (!resolve(name, relative))
+      return false;
+    return relative.empty() || createDirectory(Destination_ / relative);
+  }
+
+  // Unknown size is passed as UINT64_MAX
+  bool beginFile(const std::string &name, unsigned mode, int64_t mtime, uint64_t size) {
+    std::filesystem::path relative;
+    if (!resolve(name, relative))
+      return false;
+    if (relative.empty()) {
+      fprintf(stderr, "ERROR: invalid file name in archive: %s\n", name.c_str());
+      return false;
+    }
+
+    Current_ = Destination_ / relative;
+    CurrentMode_ = mode;
+    CurrentMTime_ = mtime;
+    CurrentData_.clear();
+    if (!createDirectory(Current_.parent_path()))
+      return false;
+    if (size > smallFileLimit)
+      return openCurrent();
+    CurrentData_.reserve(size);
+    return true;
+  }
+
+  bool fileData(const uint8_t *data, size_t size) {
+    if (!isOpen() && CurrentData_.size() + size > smallFileLimit) {
+      // File is larger than declared, stream it
+      if (!openCurrent())
+        return false;
+    }
+
+    if (isOpen())
+      return writeCurrent(data, size);
+    CurrentData_.insert(CurrentData_.end(), data, data + size);
+    return true;
+  }
+
+  bool endFile() {
+    if (isOpen())
+      return closeCurrent(true);
+
+    CFileJob job;
+    job.Path = std::move(Current_);
+    job.Mode = CurrentMode_;
+    job.MTime = CurrentMTime_;
+    job.Data = std::move(CurrentData_);
+    CurrentData_ = std::vector<uint8_t>();
+    std::unique_lock lock(Mutex_);
+    Drained_.wait(lock, [this]() { return PendingBytes_ < maxPendingBytes || Failed_; });
+    if (Failed_)
+      return false;
+    PendingBytes_ += job.Data.size();
+    Queue_.push_back(std::move(job));
+    lock.unlock();
+    Queued_.notify_one();
+    return true;
+  }
+
+  bool symlink(const std::string &name, const std::string &target) {
+    std::filesystem::path relative;
+    if (!resolve(name, relative))
+      return false;
+    if (relative.empty() || !createDirectory((Destination_ / relative).parent_path()))
+      return false;
+    Symlinks_.emplace_back(Destination_ / relative, target);
+    return true;
+  }
+
+  bool hardlink(const std::string &name, const std::string &target) {
+    std::filesystem::path relative;
+    std::filesystem::path targetRelative;
+    if (!resolve(name, relative) || !resolve(target, targetRelative))
+      return false;
+    if (relative.empty() || targetRelative.empty() || !createDirectory((Destination_ / relative).parent_path()))
+      return false;
+    Hardlinks_.emplace_back(Destination_ / relative, Destination_ / targetRelative);
+    return true;
+  }
+
+  // Mode known after file written (zip central directory); symlink mode converts file contents to link
+  void setMode(const std::string &name, unsigned mode) {
+    std::filesystem::path relative;
+    if (resolve(name, relative) && !relative.empty())
+      Modes_.emplace_back(Destination_ / relative, mode);
+  }
+
+  // Waits for all writers and creates links
+  bool finish() {
+    {
+      std::unique_lock lock(Mutex_);
+      Drained_.wait(lock, [this]() { return (Queue_.empty() && Busy_ == 0) || Failed_; });
+    }
+    if (Failed_)
+      return false;
+
+    std::error_code ec;
+    for (const auto &[path, mode]: Modes_) {
+#ifndef WIN32
+      if (S_ISLNK(mode)) {
+        std::string target;
+        InputFile file;
+        if (file.open(path)) {
+          target.resize(file.size());
+          if (!file.readAt(target.data(), target.size(), 0))
+            target.clear();
+        }
+        file.close();
+        if (!target.empty())
+          Symlinks_.emplace_back(path, target);
+        continue;
+      }
+      chmod(path.string().c_str(), mode & 07777);
+#endif
+    }
+
+    for (const auto &[path, target]: Hardlinks_) {
+      std::filesystem::remove(path, ec);
+      std::filesystem::create_hard_link(target, path, ec);
+      if (ec && !std::filesystem::copy_file(target, path, ec)) {
+        fprintf(stderr, "ERROR: can't create link %s to %s\n", path.string().c_str(), target.string().c_str());
+        return false;
+      }
+    }
+
+    for (const auto &[path, target]: Symlinks_) {
+      std::filesystem::remove(path, ec);
+      std::filesystem::create_symlink(target, path, ec);
+      if (ec)
+        fprintf(stderr, "WARNING: can't create symlink %s\n", path.string().c_str());
+    }
+    return true;
+  }
+
+  uint64_t written() const { return Written_; }
+
+private:
+  struct CFileJob {
+    std::filesystem::path Path;
+    unsigned Mode = 0;
+    int64_t MTime = 0;
+    std::vector<uint8_t> Data;
+  };
+
+  bool createDirectory(const std::filesystem::path &path) {
+    if (path.empty() || CreatedDirectories_.count(path.string()))
+      return true;
+    std::error_code ec;
+    std::filesystem::create_directories(path, ec);
+    if (ec) {
+      fprintf(stderr, "ERROR: can't create directory at %s\n", path.string().c_str());
+      return false;
+    }
+    CreatedDirectories_.insert(path.string());
+    return true;
+  }
+
+  void worker() {
+    for (;;) {
+      CFileJob job;
+      {
+        std::unique_lock lock(Mutex_);
+        Queued_.wait(lock, [this]() { return !Queue_.empty() || Stopping_; });
+        if (Queue_.empty())
+          return;
+        job = std::move(Queue_.front());
+        Queue_.pop_front();
+        Busy_++;
+      }
+
+      bool success = writeFile(job.Path, job.Mode, job.MTime, job.Data.data(), job.Data.size());
+      {
+        std::lock_guard lock(Mutex_);
+        PendingBytes_ -= job.Data.size();
+        Busy_--;
+        if (!success)
+          Failed_ = true;
+      }
+      Drained_.notify_all();
+    }
+  }
+
+#ifndef WIN32
+  static void setMTime(int fd, int64_t mtime) {
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = mtime;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    futimens(fd, times);
+  }
+
+  bool writeFile(const std::filesystem::path &path, unsigned mode, int64_t mtime, const uint8_t *data, size_t size) {
+    int fd = ::open(path.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode & 07777);
+    if (fd == -1) {
+      fprintf(stderr, "ERROR: can't open file %s\n", path.string().c_str());
+      return false;
+    }
+    bool success = writeAll(fd, data, size);
+    if (success)
+      setMTime(fd, mtime);
+    success &= ::close(fd) == 0;
+    if (!success)
+      fprintf(stderr, "ERROR: can't write file %s\n", path.string().c_str());
+    Written_ += size;
+    return success;
+  }
+
+  static bool writeAll(int fd, const uint8_t *data, size_t size) {
+    while (size) {
+      ssize_t bytesWritten = ::write(fd, data, size);
+      if (bytesWritten <= 0) {
+        if (bytesWritten == -1 && errno == EINTR)
+          continue;
+        return false;
+      }
+      data += bytesWritten;
+      size -= bytesWritten;
+    }
+    return true;
+  }
+
+  bool isOpen() const { return Fd_ != -1; }
+
+  bool openCurrent() {
+    Fd_ = ::open(Current_.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, CurrentMode_ & 07777);
+    if (Fd_ == -1) {
+      fprintf(stderr, "ERROR: can't open file %s\n", Current_.string().c_str());
+      return false;
+    }
+    bool success = writeCurrent(CurrentData_.data(), CurrentData_.size());
+    CurrentData_.clear();
+    return success;
+  }
+
+  bool writeCurrent(const uint8_t *data, size_t size) {
+    if (!writeAll(Fd_, data, size)) {
+      fprintf(stderr, "ERROR: can't write file %s\n", Current_.string().c_str());
+      return false;
+    }
+    Written_ += size;
+    return true;
+  }
+
+  bool closeCurrent(bool setTime) {
+    if (Fd_ == -1)
+      return true;
+    if (setTime)
+      setMTime(Fd_, CurrentMTime_);
+    bool success = ::close(Fd_) == 0;
+    Fd_ = -1;
+    if (!success)
+      fprintf(stderr, "ERROR: can't write file %s\n", Current_.string().c_str());
+    return success;
+  }
+#else
+  // Modification time and mode are not restored on Windows
+  bool writeFile(const std::filesystem::path &path, unsigned, int64_t, const uint8_t *data, size_t size) {
+    FILE *hFile = fopen(path.string().c_str(), "wb");
+    if (!hFile) {
+      fprintf(stderr, "ERROR: can't open file %s\n", path.string().c_str());
+      return false;
+    }
+    bool success = fwrite(data, 1, size, hFile) == size;
+    success &= fclose(hFile) == 0;
+    if (!success)
+      fprintf(stderr, "ERROR: can't write file %s\n", path.string().c_str());
+    Written_ += size;
+    return success;
+  }
+
+  bool isOpen() const { return File_ != nullptr; }
+
+  bool openCurrent() {
+    File_ = fopen(Current_.string().c_str(), "wb");
+    if (!File_) {
+      fprintf(stderr, "ERROR: can't open file %s\n", Current_.string().c_str());
+      return false;
+    }
+    bool success = writeCurrent(CurrentData_.data(), CurrentData_.size());
+    CurrentData_.clear();
+    return success;
+  }
+
+  bool writeCurrent(const uint8_t *data, size_t size) {
+    if (fwrite(data, 1, size, File_) != size) {
+      fprintf(stderr, "ERROR: can't write file %s\n", Current_.string().c_str());
+      return false;
+    }
+    Written_ += size;
+    return true;
+  }
+
+  bool closeCurrent(bool) {
+    if (!File_)
+      return true;
+    bool success = fclose(File_) == 0;
+    File_ = nullptr;
+    if (!success)
+      fprintf(stderr, "ERROR: can't write file %s\n", Current_.string().c_str());
+    return success;
+  }
+#endif
+
+  std::filesystem::path Destination_;
+  std::unordered_set<std::string> CreatedDirectories_;
+  // File being received from archive
+  std::filesystem::path Current_;
+  unsigned CurrentMode_ = 0;
+  int64_t CurrentMTime_ = 0;
+  std::vector<uint8_t> CurrentData_;
+#ifndef WIN32
+  int Fd_ = -1;
+#else
+  FILE *File_ = nullptr;
+#endif
+  std::vector<std::pair<std::filesystem::path, std::string>> Symlinks_;
+  std::vector<std::pair<std::filesystem::path, std::filesystem::path>> Hardlinks_;
+  std::vector<std::pair<std::filesystem::path, unsigned>> Modes_;
+  std::atomic<uint64_t> Written_ = 0;
+
+  std::mutex Mutex_;
+  std::condition_variable Queued_;
+  std::condition_variable Drained_;
+  std::deque<CFileJob> Queue_;
+  size_t PendingBytes_ = 0;
+  unsigned Busy_ = 0;
+  bool Stopping_ = false;
+  std::atomic<bool> Failed_ = false;
+  std::vector<std::thread> Threads_;
+};
+
+// Push parsers of archive formats: data arrives in chunks of any size
+class ArchiveReader {
+public:
+  ArchiveReader(ExtractWriter &writer) : Writer_(writer) {}
+  virtual ~ArchiveReader() {}
+  virtual bool process(const uint8_t *data, size_t size) = 0;
+  // Input ended, archive must be complete
+  virtual bool finish() = 0;
+  bool unsupported() const { return Unsupported_; }
+  const std::string &error() const { return Error_; }
+
+protected:
+  bool fail(const char *error) {
+    Error_ = error;
+    return false;
+  }
+
+  bool unsupported(const char *error) {
+    Unsupported_ = true;
+    return fail(error);
+  }
+
+  // Accumulates fixed size structure in Buffer_, returns true when it is complete
+  bool fill(const uint8_t *&data, size_t &size, size_t need) {
+    size_t bytes = std::min(size, need - std::min(need, Buffer_.size()));
+    Buffer_.insert(Buffer_.end(), data, data + bytes);
+    data += bytes;
+    size -= bytes;
+    return Buffer_.size() >= need;
+  }
+
+  ExtractWriter &Writer_;
+  std::vector<uint8_t> Buffer_;
+  std::string Error_;
+  bool Unsupported_ = false;
+};
+
+class TarReader : public ArchiveReader {
+public:
+  using ArchiveReader::ArchiveReader;
+
+  bool process(const uint8_t *data, size_t size) override {
+    while (size) {
+      switch (State_) {
+        case EState::Header : {
+          if (!fill(data, size, blockSize))
+            break;
+          bool success = header();
+          Buffer_.clear();
+          if (!success)
+            return false;
+          break;
+        }
+        case EState::Data : {
+          size_t bytes = static_cast<size_t>(std::min<uint64_t>(Remaining_, size));
+          if (Type_ == EEntry::File && !Writer_.fileData(data, bytes))
+            return fail("write error");
+          if (Type_ == EEntry::Meta)
+            Buffer_.insert(Buffer_.end(), data, data + bytes);
+          data += bytes;
+          size -= bytes;
+          Remaining_ -= bytes;
+          if (Remaining_ == 0 && !endEntry())
+            return false;
+          break;
+        }
+        case EState::Padding : {
+          size_t bytes = static_cast<size_t>(std::min<uint64_t>(Remaining_, size));
+          data += bytes;
+          size -= bytes;
+          Remaining_ -= bytes;
+          if (Remaining_ == 0)
+            State_ = EState::Header;
+          break;
+        }
+        case EState::End :
+          // Zero blocks and padding after end of archive
+          return true;
+      }
+    }
+    return true;
+  }
+
+  bool finish() override {
+    // Some archivers omit end of archive blocks
+    if (State_ == EState::End || (State_ == EState::Header && Buffer_.empty()))
+      return true;
+    return fail("unexpected end of tar archive");
+  }
+
+private:
+  static constexpr size_t blockSize = 512;
+
+  enum class EState : unsigned {
+    Header = 0,
+    Data,
+    Padding,
+    End
+  };
+
+  enum class EEntry : unsigned {
+    Skip = 0,
+    File,
+    Meta
+  };
+
+  static std::string field(const uint8_t *data, size_t size) {
+    return std::string(reinterpret_cast<const char*>(data), strnlen(reinterpret_cast<const char*>(data), size));
+  }
+
+  // Octal number or base-256 for large values (GNU extension)
+  static bool number(const uint8_t *data, size_t size, uint64_t &value) {
+    value = 0;
+    if (data[0] & 0x80) {
+      value = data[0] & 0x3F;
+      for (size_t i = 1; i < size; i++)
+        value = (value << 8) | data[i];
+      return true;
+    }
+
+    size_t i = 0;
+    while (i < size && data[i] == ' ')
+      i++;
+    bool digits = false;
+    for (; i < size && data[i] >= '0' && data[i] <= '7'; i++) {
+      value = (value << 3) | (data[i] - '0');
+      digits = true;
+    }
+    return digits || i == size || data[i] == 0;
+  }
+
+  bool header() {
+    const uint8_t *h = Buffer_.data();
+    if (std::all_of(h, h + blockSize, [](uint8_t c) { return c == 0; })) {
+      State_ = EState::End;
+      return true;
+    }
+
+    uint64_t checksum;
+    if (!number(h + 148, 8, checksum))
+      return fail("invalid tar header");
+    uint64_t sum = 0;
+    int64_t signedSum = 0;
+    for (size_t i = 0; i < blockSize; i++) {
+      uint8_t c = (i >= 148 && i < 156) ? ' ' : h[i];
+      sum += c;
+      signedSum += static_cast<int8_t>(c);
+    }
+    if (checksum != sum && static_cast<int64_t>(checksum) != signedSum)
+      return fail("tar header checksum mismatch");
+
+    uint64_t size;
+    uint64_t mode;
+    uint64_t mtime;
+    if (!number(h + 124, 12, size) || !number(h + 100, 8, mode) || !number(h + 136, 12, mtime))
+      return fail("invalid tar header");
+
+    std::string name = field(h, 100);
+    if (memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+      std::string prefix = field(h + 345, 155);
+      name = prefix + "/" + name;
+    }
+    std::string linkName = field(h + 157, 100);
+    char type = static_cast<char>(h[156]);
+
+    // Extended headers override fields of next entry
+    if (!LongName_.empty())
+      name = std::move(LongName_);
+    if (!LongLink_.empty())
+      linkName = std::move(LongLink_);
+    if (PaxSize_)
+      size = *PaxSize_;
+    if (PaxMTime_)
+      mtime = *PaxMTime_;
+    LongName_.clear();
+    LongLink_.clear();
+    PaxSize_.reset();
+    PaxMTime_.reset();
+
+    Type_ = EEntry::Skip;
+    MetaType_ = 0;
+    switch (type) {
+      case '0' :
+      case '\0' :
+      case '7' :
+        if (!name.empty() && name.back() == '/') {
+          if (!Writer_.directory(name))
+            return fail("can't create directory");
+          break;
+        }
+        if (!Writer_.beginFile(name, static_cast<unsigned>(mode), static_cast<int64_t>(mtime), size))
+          return fail("can't create file");
+        Type_ = EEntry::File;
+        break;
+      case '5' :
+        if (!Writer_.directory(name))
+          return fail("can't create directory");
+        break;
+      case '2' :
+        if (!Writer_.symlink(name, linkName))
+          return fail("invalid symbolic link");
+        break;
+      case '1' :
+        if (!Writer_.hardlink(name, linkName))
+          return fail("invalid hard link");
+        break;
+      case 'L' :
+      case 'K' :
+      case 'x' :
+        if (size > (1 << 20))
+          return fail("too large extended header");
+        Type_ = EEntry::Meta;
+        MetaType_ = type;
+        break;
+      case 'S' :
+        return unsupported("sparse files");
+      default :
+        // Global headers, devices, fifos and vendor extensions
+        break;
+    }
+
+    Remaining_ = size;
+    Padding_ = (blockSize - size % blockSize) % blockSize;
+    Buffer_.clear();
+    if (Remaining_ == 0)
+      return endEntry();
+    State_ = EState::Data;
+    return true;
+  }
+
+  bool endEntry() {
+    if (Type_ == EEntry::File && !Writer_.endFile())
+      return fail("write error");
+    if (Type_ == EEntry::Meta) {
+      std::string data(Buffer_.begin(), Buffer_.end());
+      Buffer_.clear();
+      if (MetaType_ == 'L')
+        LongName_ = field(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+      else if (MetaType_ == 'K')
+        LongLink_ = field(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+      else if (!paxHeader(data))
+        return fail("invalid pax header");
+    }
+
+    Type_ = EEntry::Skip;
+    Remaining_ = Padding_;
+    State_ = Remaining_ ? EState::Padding : EState::Header;
+    return true;
+  }
+
+  // Records "<length> <key>=<value>\n"
+  bool paxHeader(const std::string &data) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+      size_t space = data.find(' ', pos);
+      if (space == data.npos)
+        return false;
+      size_t length = strtoul(data.c_str() + pos, nullptr, 10);
+      if (length <= space - pos || pos + length > data.size())
+        return false;
+      std::string record = data.substr(space + 1, pos + length - space - 2);
+      pos += length;
+      size_t equal = record.find('=');
+      if (equal == record.npos)
+        return false;
+      std::string key = record.substr(0, equal);
+      std::string value = record.substr(equal + 1);
+      if (key == "path")
+        LongName_ = value;
+      else if (key == "linkpath")
+        LongLink_ = value;
+      else if (key == "size")
+        PaxSize_ = strtoull(value.c_str(), nullptr, 10);
+      else if (key == "mtime")
+        PaxMTime_ = strtoull(value.c_str(), nullptr, 10);
+    }
+    return true;
+  }
+
+  EState State_ = EState::Header;
+  EEntry Type_ = EEntry::Skip;
+  char MetaType_ = 0;
+  uint64_t Remaining_ = 0;
+  uint64_t Padding_ = 0;
+  std::string LongName_;
+  std::string LongLink_;
+  std::optional<uint64_t> PaxSize_;
+  std::optional<uint64_t> PaxMTime_;
+};
+
+#ifdef CXXPM_HAVE_ZLIB
+static uint16_t load16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t load32(const uint8_t *p) { return load16(p) | (static_cast<uint32_t>(load16(p + 2)) << 16); }
+static uint64_t load64(const uint8_t *p) { return load32(p) | (static_cast<uint64_t>(load32(p + 4)) << 32); }
+
+// Reads zip sequentially by local headers; modes and symlinks are taken from central directory
+// at the end. Integrity of entries is not checked by CRC, whole archive is verified by SHA3
+class ZipReader : public ArchiveReader {
+public:
+  ZipReader(ExtractWriter &writer) : ArchiveReader(writer), Output_(outputBufferSize) {
+    memset(&Stream_, 0, sizeof(Stream_));
+  }
+
+  ~ZipReader() {
+    if (StreamInitialized_)
+      inflateEnd(&Stream_);
+  }
+
+  bool process(const uint8_t *data, size_t size) override {
+    while (size) {
+      switch (State_) {
+        case EState::Signature : {
+          if (!fill(data, size, 4))
+            break;
+          uint32_t signature = load32(Buffer_.data());
+          Buffer_.clear();
+          if (signature == 0x04034b50)
+            State_ = EState::Local;
+          else if (signature == 0x02014b50)
+            State_ = EState::Central;
+          else if (signature == 0x06054b50 || signature == 0x06064b50 || signature == 0x07064b50 || signature == 0x05054b50)
+            State_ = EState::End;
+          else
+            return fail("invalid zip signature");
+          break;
+        }
+        case EState::Local :
+          if (fill(data, size, 26) && !localHeader())
+            return false;
+          break;
+        case EState::LocalNames :
+          if (fill(data, size, Need_) && !localNames())
+            return false;
+          break;
+        case EState::Data :
+          if (!entryData(data, size))
+            return false;
+          break;
+        case EState::Descriptor : {
+          if (!fill(data, size, 4))
+            break;
+          // Signature of data descriptor is optional
+          size_t need = DescriptorSize_ + (load32(Buffer_.data()) == 0x08074b50 ? 4 : 0);
+          if (fill(data, size, need)) {
+            Buffer_.clear();
+            State_ = EState::Signature;
+          }
+          break;
+        }
+        case EState::Central :
+          if (fill(data, size, 42)) {
+            Need_ = 42 + load16(Buffer_.data() + 24) + load16(Buffer_.data() + 26) + load16(Buffer_.data() + 28);
+            State_ = EState::CentralNames;
+          }
+          break;
+        case EState::CentralNames :
+          if (fill(data, size, Need_))
+            centralEntry();
+          break;
+        case EState::End :
+          return true;
+      }
+    }
+    return true;
+  }
+
+  bool finish() override {
+    if (State_ == EState::End)
+      return true;
+    return fail("unexpected end of zip archive");
+  }
+
+private:
+  enum class EState : unsigned {
+    Signature = 0,
+    Local,
+    LocalNames,
+    Data,
+    Descriptor,
+    Central,
+    CentralNames,
+    End
+  };
+
+  bool localHeader() {
+    const uint8_t *h = Buffer_.data();
+    Flags_ = load16(h + 2);
+    Method_ = load16(h + 4);
+    uint16_t time = load16(h + 6);
+    uint16_t date = load16(h + 8);
+    CompressedSize_ = load32(h + 14);
+    Size_ = load32(h + 18);
+    NameLength_ = load16(h + 22);
+    Need_ = 26 + NameLength_ + load16(h + 24);
+
+    // DOS time is local
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    t.tm_year = (date >> 9) + 80;
+    t.tm_mon = ((date >> 5) & 0xF) - 1;
+    t.tm_mday = date & 0x1F;
+    t.tm_hour = time >> 11;
+    t.tm_min = (time >> 5) & 0x3F;
+    t.tm_sec = (time & 0x1F) * 2;
+    t.tm_isdst = -1;
+    MTime_ = mktime(&t);
+
+    if (Flags_ & 0x1)
+      return unsupported("encrypted zip entries");
+    if (Method_ != 0 && Method_ != 8)
+      return unsupported("zip compression method");
+    State_ = EState::LocalNames;
+    return true;
+  }
+
+  bool localNames() {
+    const uint8_t *p = Buffer_.data() + 26;
+    std::string name(reinterpret_cast<const char*>(p), NameLength_);
+    const uint8_t *extra = p + NameLength_;
+    const uint8_t *extraEnd = Buffer_.data() + Need_;
+
+    // Zip64 sizes
+    bool zip64 = false;
+    while (extra + 4 <= extraEnd) {
+      uint16_t id = load16(extra);
+      uint16_t length = load16(extra + 2);
+      const uint8_t *value = extra + 4;
+      if (value + length > extraEnd)
+        break;
+      if (id == 0x0001) {
+        zip64 = true;
+        const uint8_t *field = value;
+        if (Size_ == 0xFFFFFFFF && field + 8 <= value + length) {
+          Size_ = load64(field);
+          field += 8;
+        }
+        if (CompressedSize_ == 0xFFFFFFFF && field + 8 <= value + length)
+          CompressedSize_ = load64(field);
+      }
+      extra = value + length;
+    }
+    Buffer_.clear();
+    DescriptorSize_ = zip64 ? 20 : 12;
+
+    bool hasDescriptor = Flags_ & 0x8;
+    if (hasDescriptor && Method_ == 0)
+      return unsupported("stored zip entries with data descriptor");
+
+    IsFile_ = name.empty() || name.back() != '/';
+    if (!IsFile_) {
+      if (!Writer_.directory(name))
+        return fail("can't create directory");
+    } else if (!Writer_.beginFile(name, 0666, MTime_, hasDescriptor ? UINT64_MAX : Size_)) {
+      return fail("can't create file");
+    }
+
+    Remaining_ = CompressedSize_;
+    if (Method_ == 8) {
+      int result = StreamInitialized_ ? inflateReset(&Stream_) : inflateInit2(&Stream_, -MAX_WBITS);
+      if (result != Z_OK)
+        return fail("can't initialize zlib");
+      StreamInitialized_ = true;
+    }
+
+    State_ = EState::Data;
+    if (Method_ == 0 && Remaining_ == 0)
+      return endEntry();
+    return true;
+  }
+
+  bool entryData(const uint8_t *&data, size_t &size) {
+    if (Method_ == 0) {
+      size_t bytes = static_cast<size_t>(std::min<uint64_t>(Remaining_, size));
+      if (IsFile_ && !Writer_.fileData(data, bytes))
+        return fail("write error");
+      data += bytes;
+      size -= bytes;
+      Remaining_ -= bytes;
+      return Remaining_ != 0 || endEntry();
+    }
+
+    // Deflate stream knows its end, compressed size is not needed
+    Stream_.next_in = const_cast<uint8_t*>(data);
+    Stream_.avail_in = static_cast<uInt>(std::min<size_t>(size, UINT32_MAX));
+    size_t availIn = Stream_.avail_in;
+    int result = Z_OK;
+    while (Stream_.avail_in && result != Z_STREAM_END) {
+      Stream_.next_out = Output_.data();
+      Stream_.avail_out = static_cast<uInt>(Output_.size());
+      result = inflate(&Stream_, Z_NO_FLUSH);
+      if (result != Z_OK && result != Z_STREAM_END)
+        return fail("corrupted deflate stream");
+      size_t produced = Output_.size() - Stream_.avail_out;
+      if (IsFile_ && produced && !Writer_.fileData(Output_.data(), produced))
+        return fail("write error");
+    }
+
+    size_t consumed = availIn - Stream_.avail_in;
+    data += consumed;
+    size -= consumed;
+    return result != Z_STREAM_END || endEntry();
+  }
+
+  bool endEntry() {
+    if (IsFile_ && !Writer_.endFile())
+      return fail("write error");
+    State_ = (Flags_ & 0x8) ? EState::Descriptor : EState::Signature;
+    return true;
+  }
+
+  void centralEntry() {
+    const uint8_t *h = Buffer_.data();
+    uint16_t versionMadeBy = load16(h);
+    uint32_t externalAttributes = load32(h + 34);
+    std::string name(reinterpret_cast<const char*>(h + 42), load16(h + 24));
+    Buffer_.clear();
+    State_ = EState::Signature;
+
+    // Unix mode is stored in high word of external attributes
+    unsigned mode = externalAttributes >> 16;
+    if ((versionMadeBy >> 8) == 3 && mode && (name.empty() || name.back() != '/'))
+      Writer_.setMode(name, mode);
+  }
+
+  EState State_ = EState::Signature;
+  z_stream Stream_;
+  bool StreamInitialized_ = false;
+  std::vector<uint8_t> Output_;
+  size_t Need_ = 0;
+  uint16_t Flags_ = 0;
+  uint16_t Method_ = 0;
+  uint16_t NameLength_ = 0;
+  uint64_t CompressedSize_ = 0;
+  uint64_t Size_ = 0;
+  uint64_t Remaining_ = 0;
+  size_t DescriptorSize_ = 12;
+  int64_t MTime_ = 0;
+  bool IsFile_ = false;
+};
+#endif
+
+// Bounded queue passing data blocks between pipeline stages
+class BlockQueue {
+public:
+  BlockQueue(size_t capacity) : Capacity_(capacity) {}
+
+  // Waits for free space, false if consumer aborted queue
+  bool push(std::vector<uint8_t> &&block) {
+    std::unique_lock lock(Mutex_);
+    Popped_.wait(lock, [this]() { return Blocks_.size() < Capacity_ || Aborted_; });
+    if (Aborted_)
+      return false;
+    Blocks_.push_back(std::move(block));
+    lock.unlock();
+    Pushed_.notify_one();
+    return true;
+  }
+
+  // Waits for next block, false when queue closed and empty or aborted
+  bool pop(std::vector<uint8_t> &block) {
+    std::unique_lock lock(Mutex_);
+    Pushed_.wait(lock, [this]() { return !Blocks_.empty() || Closed_ || Aborted_; });
+    if (Blocks_.empty() || Aborted_)
+      return false;
+    block = std::move(Blocks_.front());
+    Blocks_.pop_front();
+    lock.unlock();
+    Popped_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard lock(Mutex_);
+    Closed_ = true;
+    Pushed_.notify_all();
+  }
+
+  void abort() {
+    std::lock_guard lock(Mutex_);
+    Aborted_ = true;
+    Pushed_.notify_all();
+    Popped_.notify_all();
+  }
+
+private:
+  size_t Capacity_;
+  std::mutex Mutex_;
+  std::condition_variable Pushed_;
+  std::condition_variable Popped_;
+  std::deque<std::vector<uint8_t>> Blocks_;
+  bool Closed_ = false;
+  bool Aborted_ = false;
+};
+
+// Decodes independent parts of compressed stream by thread pool, decoded data goes to sink
+// in input order
+class UnitDecoder {
+public:
+  typedef std::function<bool(const std::vector<uint8_t>&, std::vector<uint8_t>&)> DecodeFunction;
+
+  UnitDecoder(unsigned threadsNum, DecodeFunction decode) : ThreadsNum_(threadsNum), Decode_(std::move(decode)) {
+    for (unsigned i = 0; i < ThreadsNum_; i++)
+      Threads_.emplace_back([this]() { worker(); });
+  }
+
+  ~UnitDecoder() {
+    {
+      std::lock_guard lock(Mutex_);
+      Stopping_ = true;
+    }
+    Queued_.notify_all();
+    for (auto &thread: Threads_)
+      thread.join();
+  }
+
+  // Queues job and passes already decoded jobs to sink, waits while too many jobs in flight
+  bool submit(std::vector<uint8_t> &&input, const DataSink &sink) {
+    auto job = std::make_shared<CJob>();
+    job->Input = std::move(input);
+    {
+      std::lock_guard lock(Mutex_);
+      Jobs_.push_back(job);
+      Pending_.push_back(job);
+    }
+    Queued_.notify_one();
+    return deliver(sink, 2*ThreadsNum_);
+  }
+
+  bool finish(const DataSink &sink) {
+    return deliver(sink, 0);
+  }
+
+private:
+  struct CJob {
+    std::vector<uint8_t> Input;
+    std::vector<uint8_t> Output;
+    bool Done = false;
+    bool Success = false;
+  };
+
+  bool deliver(const DataSink &sink, size_t maxInFlight) {
+    for (;;) {
+      std::shared_ptr<CJob> job;
+      {
+        std::unique_lock lock(Mutex_);
+        if (Jobs_.empty())
+          return true;
+        if (Jobs_.size() > maxInFlight)
+          Decoded_.wait(lock, [this]() { return Jobs_.front()->Done; });
+        else if (!Jobs_.front()->Done)
+          return true;
+        job = std::move(Jobs_.front());
+        Jobs_.pop_front();
+      }
+      if (!job->Success || !sink(job->Output.data(), job->Output.size()))
+        return false;
+    }
+  }
+
+  void worker() {
+    for (;;) {
+      std::shared_ptr<CJob> job;
+      {
+        std::unique_lock lock(Mutex_);
+        Queued_.wait(lock, [this]() { return !Pending_.empty() || Stopping_; });
+        if (Pending_.empty())
+          return;
+        job = std::move(Pending_.front());
+        Pending_.pop_front();
+      }
+
+      bool success = Decode_(job->Input, job->Output);
+      job->Input = std::vector<uint8_t>();
+      {
+        std::lock_guard lock(Mutex_);
+        job->Success = success;
+        job->Done = true;
+      }
+      Decoded_.notify_all();
+    }
+  }
+
+  unsigned ThreadsNum_;
+  DecodeFunction Decode_;
+  std::mutex Mutex_;
+  std::condition_variable Queued_;
+  std::condition_variable Decoded_;
+  // All jobs in input order and jobs not taken by workers yet
+  std::deque<std::shared_ptr<CJob>> Jobs_;
+  std::deque<std::shared_ptr<CJob>> Pending_;
+  bool Stopping_ = false;
+  std::vector<std::thread> Threads_;
+};
+
+class Decompressor {
+public:
+  virtual ~Decompressor() {}
+  virtual bool process(const uint8_t *data, size_t size, const DataSink &sink) = 0;
+  // Input ended, compressed stream must be complete
+  virtual bool finish(const DataSink &sink) = 0;
+  const std::string &error() const { return Error_; }
+
+protected:
+  bool fail(const char *error) {
+    Error_ = error;
+    return false;
+  }
+
+  std::vector<uint8_t> Output_ = std::vector<uint8_t>(outputBufferSize);
+  std::string Error_;
+};
+
+class NoneDecompressor : public Decompressor {
+public:
+  bool process(const uint8_t *data, size_t size, const DataSink &sink) override { return sink(data, size); }
+  bool finish(const DataSink&) override { return true; }
+};
+
+// Base for formats built of independently compressed units (zstd frames, BGZF members). Complete
+// units are grouped to jobs and decoded in parallel; from first unit which size can't be found
+// stream is decoded sequentially
+class UnitDecompressor : public Decompressor {
+public:
+  UnitDecompressor(unsigned threadsNum, const char *corruptedError) :
+    ThreadsNum_(threadsNum), CorruptedError_(corruptedError), Sequential_(threadsNum <= 1) {}
+
+  bool process(const uint8_t *data, size_t size, const DataSink &sink) override {
+    if (Sequential_)
+      return processSequential(data, size, sink);
+
+    Input_.insert(Input_.end(), data, data + size);
+    for (;;) {
+      size_t unit = unitSize(Input_.data() + Scanned_, Input_.size() - Scanned_);
+      if (unit == SIZE_MAX || (unit == 0 && Input_.size() - Scanned_ > maxUnitSize))
+        return switchToSequential(sink);
+      if (unit == 0)
+        return true;
+      Scanned_ += unit;
+      if (Scanned_ >= minJobSize && !submit(sink))
+        return false;
+    }
+  }
+
+  bool finish(const DataSink &sink) override {
+    if (!Sequential_) {
+      // Whole stream consisted of complete units
+      if (Scanned_ == Input_.size() && Scanned_ + Submitted_ != 0)
+        return submit(sink) && (!Units_ || Units_->finish(sink) || fail(CorruptedError_));
+      if (!switchToSequential(sink))
+        return false;
+    }
+    return finishSequential(sink);
+  }
+
+protected:
+  // Size of unit at beginning of data; 0 if more input needed, SIZE_MAX if unit can't be decoded separately
+  virtual size_t unitSize(const uint8_t *data, size_t size) = 0;
+  // Decodes sequence of complete units, called by worker threads
+  virtual bool decodeUnits(const std::vector<uint8_t> &input, std::vector<uint8_t> &output) = 0;
+  virtual bool processSequential(const uint8_t *data, size_t size, const DataSink &sink) = 0;
+  virtual bool finishSequential(const DataSink &sink) = 0;
+  // Sequential decoding starts at unit boundary after parallel decoded units
+  bool unitsDecoded() const { return Submitted_ != 0; }
+
+private:
+  // Units are grouped to jobs of this size at least; stream without unit end in this limit
+  // is decoded sequentially
+  static constexpr size_t minJobSize = 1 << 20;
+  static constexpr size_t maxUnitSize = 32 << 20;
+
+  bool submit(const DataSink &sink) {
+    if (Scanned_ == 0)
+      return true;
+    if (!Units_) {
+      Units_ = std::make_unique<UnitDecoder>(ThreadsNum_, [this](const std::vector<uint8_t> &input, std::vector<uint8_t> &output) {
+        return decodeUnits(input, output);
+      });
+    }
+
+    std::vector<uint8_t> job(Input_.begin(), Input_.begin() + Scanned_);
+    Input_.erase(Input_.begin(), Input_.begin() + Scanned_);
+    Submitted_ += Scanned_;
+    Scanned_ = 0;
+    return Units_->submit(std::move(job), sink) || fail(CorruptedError_);
+  }
+
+  bool switchToSequential(const DataSink &sink) {
+    if (!submit(sink) || (Units_ && !Units_->finish(sink)))
+      return Error_.empty() ? fail(CorruptedError_) : false;
+    Sequential_ = true;
+    std::vector<uint8_t> input = std::move(Input_);
+    return processSequential(input.data(), input.size(), sink);
+  }
+
+  unsigned ThreadsNum_;
+  const char *CorruptedError_;
+  bool Sequential_;
+  std::vector<uint8_t> Input_;
+  // Bytes of complete units at beginning of Input_ and total bytes passed to workers
+  size_t Scanned_ = 0;
+  uint64_t Submitted_ = 0;
+  std::unique_ptr<UnitDecoder> Units_;
+};
+
+#ifdef CXXPM_HAVE_ZLIB
+// Concatenated gzip members are decompressed one by one (pigz, multi-member archives).
+// BGZF members (bgzip) keep their compressed size in header and are decoded in parallel
+class GzipDecompressor : public UnitDecompressor {
+public:
+  GzipDecompressor(unsigned threadsNum) : UnitDecompressor(threadsNum, "corrupted gzip stream") {
+    memset(&Stream_, 0, sizeof(Stream_));
+    Initialized_ = inflateInit2(&Stream_, 16 + MAX_WBITS) == Z_OK;
+  }
+
+  ~GzipDecompressor() {
+    if (Initialized_)
+      inflateEnd(&Stream_);
+  }
+
+protected:
+  size_t unitSize(const uint8_t *data, size_t size) override {
+    // Fixed header and extra field length
+    if (size < 12)
+      return 0;
+    if (data[0] != 0x1F || data[1] != 0x8B || data[2] != Z_DEFLATED || !(data[3] & 0x04))
+      return SIZE_MAX;
+    size_t extraSize = load16(data + 10);
+    if (size < 12 + extraSize)
+      return 0;
+    // BC subfield holds member size minus one
+    const uint8_t *end = data + 12 + extraSize;
+    for (const uint8_t *p = data + 12; p + 4 <= end; p += 4 + load16(p + 2)) {
+      if (p[0] == 'B' && p[1] == 'C' && load16(p + 2) == 2 && p + 6 <= end) {
+        size_t memberSize = load16(p + 4) + 1;
+        return memberSize <= size ? memberSize : 0;
+      }
+    }
+    return SIZE_MAX;
+  }
+
+  bool decodeUnits(const std::vector<uint8_t> &input, std::vector<uint8_t> &output) override {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+      return false;
+    stream.next_in = const_cast<uint8_t*>(input.data());
+    stream.avail_in = static_cast<uInt>(input.size());
+    int result = Z_OK;
+    while (stream.avail_in || (result == Z_OK && stream.avail_out == 0)) {
+      if (result == Z_STREAM_END)
+        inflateReset(&stream);
+      size_t offset = output.size();
+      output.resize(offset + outputBufferSize);
+      stream.next_out = output.data() + offset;
+      stream.avail_out = static_cast<uInt>(outputBufferSize);
+      result = inflate(&stream, Z_NO_FLUSH);
+      output.resize(output.size() - stream.avail_out);
+      if (result != Z_OK && result != Z_STREAM_END)
+        break;
+    }
+    inflateEnd(&stream);
+    return result == Z_STREAM_END;
+  }
+
+  bool processSequential(const uint8_t *data, size_t size, const DataSink &sink) override {
+    if (!Initialized_)
+      return fail("can't initialize zlib");
+    if (!Started_) {
+      Started_ = true;
+      StreamEnd_ = unitsDecoded();
+    }
+
+    while (size && !Trailing_) {
+      if (StreamEnd_) {
+        // Next member or trailing garbage
+        if (data[0] != 0x1F) {
+          Trailing_ = true;
+          break;
+        }
+        inflateReset(&Stream_);
+        StreamEnd_ = false;
+      }
+
+      Stream_.next_in = const_cast<uint8_t*>(data);
+      Stream_.avail_in = static_cast<uInt>(std::min<size_t>(size, UINT32_MAX));
+      size_t availIn = Stream_.avail_in;
+      int result = Z_OK;
+      while (Stream_.avail_in && result != Z_STREAM_END) {
+        Stream_.next_out = Output_.data();
+        Stream_.avail_out = static_cast<uInt>(Output_.size());
+        result = inflate(&Stream_, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END)
+          return fail("corrupted gzip stream");
+        size_t produced = Output_.size() - Stream_.avail_out;
+        if (produced && !sink(Output_.data(), produced))
+          return false;
+      }
+
+      // Output left in zlib window is flushed before stream end
+      while (result != Z_STREAM_END && Stream_.avail_out == 0) {
+        Stream_.next_out = Output_.data();
+        Stream_.avail_out = static_cast<uInt>(Output_.size());
+        result = inflate(&Stream_, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+          return fail("corrupted gzip stream");
+        size_t produced = Output_.size() - Stream_.avail_out;
+        if (produced && !sink(Output_.data(), produced))
+          return false;
+      }
+
+      StreamEnd_ = result == Z_STREAM_END;
+      size_t consumed = availIn - Stream_.avail_in;
+      data += consumed;
+      size -= consumed;
+    }
+    return true;
+  }
+
+  bool finishSequential(const DataSink&) override {
+    return StreamEnd_ || Trailing_ || fail("unexpected end of gzip stream");
+  }
+
+private:
+  z_stream Stream_;
+  bool Initialized_ = false;
+  bool Started_ = false;
+  bool StreamEnd_ = false;
+  bool Trailing_ = false;
+};
+#endif
+
+#ifdef CXXPM_HAVE_BZIP2
+class Bzip2Decompressor : public Decompressor {
+public:
+  Bzip2Decompressor() {
+    memset(&Stream_, 0, sizeof(Stream_));
+    Initialized_ = BZ2_bzDecompressInit(&Stream_, 0, 0) == BZ_OK;
+  }
+
+  ~Bzip2Decompressor() {
+    if (Initialized_)
+      BZ2_bzDecompressEnd(&Stream_);
+  }
+
+  bool process(const uint8_t *data, size_t size, const DataSink &sink) override {
+    while (size && !Trailing_) {
+      if (StreamEnd_) {
+        // Next stream (pbzip2) or trailing garbage
+        if (data[0] != 'B') {
+          Trailing_ = true;
+          break;
+        }
+        BZ2_bzDecompressEnd(&Stream_);
+        memset(&Stream_, 0, sizeof(Stream_));
+        Initialized_ = BZ2_bzDecompressInit(&Stream_, 0, 0) == BZ_OK;
+        StreamEnd_ = false;
+      }
+      if (!Initialized_)
+        return fail("can't initialize bzip2");
+
+      Stream_.next_in = reinterpret_cast<char*>(const_cast<uint8_t*>(data));
+      Stream_.avail_in = static_cast<unsigned>(std::min<size_t>(size, UINT32_MAX));
+      size_t availIn = Stream_.avail_in;
+      int result = BZ_OK;
+      do {
+        Stream_.next_out = reinterpret_cast<char*>(Output_.data());
+        Stream_.avail_out = static_cast<unsigned>(Output_.size());
+        result = BZ2_bzDecompress(&Stream_);
+        if (result != BZ_OK && result != BZ_STREAM_END)
+          return fail("corrupted bzip2 stream");
+        size_t produced = Output_.size() - Stream_.avail_out;
+        if (produced && !sink(Output_.data(), produced))
+          return false;
+      } while (result != BZ_STREAM_END && (Stream_.avail_in || Stream_.avail_out == 0));
+
+      StreamEnd_ = result == BZ_STREAM_END;
+      size_t consumed = availIn - Stream_.avail_in;
+      data += consumed;
+      size -= consumed;
+    }
+    return true;
+  }
+
+  bool finish(const DataSink&) override {
+    return StreamEnd_ || Trailing_ || fail("unexpected end of bzip2 stream");
+  }
+
+private:
+  bz_stream Stream_;
+  bool Initialized_ = false;
+  bool StreamEnd_ = false;
+  bool Trailing_ = false;
+};
+#endif
+
+#ifdef CXXPM_HAVE_LZMA
+// xz, legacy lzma and lzip streams. xz blocks with sizes in headers (xz -T) are decoded by
+// liblzma threads
+class LzmaDecompressor : public Decompressor {
+public:
+  LzmaDecompressor(ECompression compression, unsigned threadsNum) {
+    lzma_ret result = LZMA_PROG_ERROR;
+#if LZMA_VERSION >= 50040000
+    if (compression == ECompression::Xz && threadsNum > 1) {
+      lzma_mt options;
+      memset(&options, 0, sizeof(options));
+      options.flags = LZMA_CONCATENATED;
+      options.threads = threadsNum;
+      options.memlimit_threading = lzmaThreadingMemoryLimit;
+      options.memlimit_stop = UINT64_MAX;
+      result = lzma_stream_decoder_mt(&Stream_, &options);
+    } else
+#endif
+    if (compression == ECompression::Xz)
+      result = lzma_stream_decoder(&Stream_, UINT64_MAX, LZMA_CONCATENATED);
+    else if (compression == ECompression::Lzma)
+      result = lzma_alone_decoder(&Stream_, UINT64_MAX);
+#if LZMA_VERSION >= 50040000
+    else if (compression == ECompression::Lzip)
+      result = lzma_lzip_decoder(&Stream_, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+    Initialized_ = result == LZMA_OK;
+  }
+
+  ~LzmaDecompressor() {
+    lzma_end(&Stream_);
+  }
+
+  bool process(const uint8_t *data, size_t size, const DataSink &sink) override {
+    return code(data, size, LZMA_RUN, sink);
+  }
+
+  bool finish(const DataSink &sink) override {
+    return code(nullptr, 0, LZMA_FINISH, sink) && (StreamEnd_ || fail("unexpected end of lzma stream"));
+  }
+
+private:
+  bool code(const uint8_t *data, size_t size, lzma_action action, const DataSink &sink) {
+    if (!Initialized_)
+      return fail("can't initialize lzma");
+    Stream_.next_in = data;
+    Stream_.avail_in = size;
+    while (!StreamEnd_ && (Stream_.avail_in || action == LZMA_FINISH)) {
+      Stream_.next_out = Output_.data();
+      Stream_.avail_out = Output_.size();
+      lzma_ret result = lzma_code(&Stream_, action);
+      if (result != LZMA_OK && result != LZMA_STREAM_END)
+        return fail("corrupted lzma stream");
+      size_t produced = Output_.size() - Stream_.avail_out;
+      if (produced && !sink(Output_.data(), produced))
+        return false;
+      StreamEnd_ = result == LZMA_STREAM_END;
+      if (action == LZMA_FINISH && produced == 0 && result == LZMA_OK)
+        break;
+    }
+    return true;
+  }
+
+  // Above this limit liblzma decodes in fewer threads
+  static constexpr uint64_t lzmaThreadingMemoryLimit = 1ull << 30;
+
+  lzma_stream Stream_ = LZMA_STREAM_INIT;
+  bool Initialized_ = false;
+  bool StreamEnd_ = false;
+};
+#endif
+
+#ifdef CXXPM_HAVE_ZSTD
+// Frames with content size in header (pzstd, zstd --block-size) are decoded in parallel
+class ZstdDecompressor : public UnitDecompressor {
+public:
+  ZstdDecompressor(unsigned threadsNum) : UnitDecompressor(threadsNum, "corrupted zstd stream"), Stream_(ZSTD_createDStream()) {}
+  ~ZstdDecompressor() { ZSTD_freeDStream(Stream_); }
+
+protected:
+  size_t unitSize(const uint8_t *data, size_t size) override {
+    // Magic and skippable frame size
+    if (size < 8)
+      return 0;
+    uint32_t magic = data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    if ((magic & ZSTD_MAGIC_SKIPPABLE_MASK) == ZSTD_MAGIC_SKIPPABLE_START) {
+      size_t frameSize = 8 + (data[4] | (data[5] << 8) | (data[6] << 16) | (static_cast<size_t>(data[7]) << 24));
+      return frameSize <= size ? frameSize : 0;
+    }
+    if (magic != ZSTD_MAGICNUMBER)
+      return SIZE_MAX;
+
+    // Header is 18 bytes at most
+    unsigned long long contentSize = ZSTD_getFrameContentSize(data, size);
+    if (contentSize == ZSTD_CONTENTSIZE_ERROR)
+      return size < 18 ? 0 : SIZE_MAX;
+    if (contentSize == ZSTD_CONTENTSIZE_UNKNOWN || contentSize > maxFrameContentSize)
+      return SIZE_MAX;
+    size_t frameSize = ZSTD_findFrameCompressedSize(data, size);
+    return ZSTD_isError(frameSize) ? 0 : frameSize;
+  }
+
+  bool decodeUnits(const std::vector<uint8_t> &input, std::vector<uint8_t> &output) override {
+    ZSTD_DStream *stream = ZSTD_createDStream();
+    if (!stream)
+      return false;
+    ZSTD_inBuffer in = {input.data(), input.size(), 0};
+    size_t result = 0;
+    bool outputFull = false;
+    while (in.pos < in.size || outputFull) {
+      size_t offset = output.size();
+      output.resize(offset + outputBufferSize);
+      ZSTD_outBuffer out = {output.data() + offset, outputBufferSize, 0};
+      result = ZSTD_decompressStream(stream, &out, &in);
+      output.resize(offset + out.pos);
+      if (ZSTD_isError(result))
+        break;
+      outputFull = out.pos == out.size;
+    }
+    ZSTD_freeDStream(stream);
+    return result == 0;
+  }
+
+  bool processSequential(const uint8_t *data, size_t size, const DataSink &sink) override {
+    if (!Stream_)
+      return fail("can't initialize zstd");
+    ZSTD_inBuffer input = {data, size, 0};
+    while (input.pos < input.size) {
+      ZSTD_outBuffer output = {Output_.data(), Output_.size(), 0};
+      size_t result = ZSTD_decompressStream(Stream_, &output, &input);
+      if (ZSTD_isError(result))
+        return fail("corrupted zstd stream");
+      if (output.pos && !sink(Output_.data(), output.pos))
+        return false;
+      // Frame is complete and flushed when 0 returned
+      FrameEnd_ = result == 0;
+    }
+    return true;
+  }
+
+  bool finishSequential(const DataSink &sink) override {
+    if (!Stream_)
+      return fail("can't initialize zstd");
+    // Flush data buffered in decoder
+    while (!FrameEnd_) {
+      ZSTD_inBuffer input = {nullptr, 0, 0};
+      ZSTD_outBuffer output = {Output_.data(), Output_.size(), 0};
+      size_t result = ZSTD_decompressStream(Stream_, &output, &input);
+      if (ZSTD_isError(result))
+        return fail("corrupted zstd stream");
+      if (output.pos && !sink(Output_.data(), output.pos))
+        return false;
+      FrameEnd_ = result == 0;
+      if (output.pos == 0)
+        break;
+    }
+    return FrameEnd_ || fail("unexpected end of zstd stream");
+  }
+
+private:
+  // Larger frames are decoded sequentially to bound memory of jobs in flight
+  static constexpr unsigned long long maxFrameContentSize = 16 << 20;
+
+  ZSTD_DStream *Stream_;
+  bool FrameEnd_ = false;
+};
+#endif
+
+static std::unique_ptr<Decompressor> createDecompressor(ECompression compression, unsigned threadsNum)
+{
+  switch (compression) {
+#ifdef CXXPM_HAVE_ZLIB
+    case ECompression::Gzip :
+      return std::make_unique<GzipDecompressor>(threadsNum);
+#endif
+#ifdef CXXPM_HAVE_BZIP2
+    case ECompression::Bzip2 :
+      return std::make_unique<Bzip2Decompressor>();
+#endif
+#ifdef CXXPM_HAVE_LZMA
+    case ECompression::Xz :
+    case ECompression::Lzma :
+    case ECompression::Lzip :
+      return std::make_unique<LzmaDecompressor>(compression, threadsNum);
+#endif
+#ifdef CXXPM_HAVE_ZSTD
+    case ECompression::Zstd :
+      return std::make_unique<ZstdDecompressor>(threadsNum);
+#endif
+    default :
+      return std::make_unique<NoneDecompressor>();
+  }
+}
+
+bool archiveExtractSupported(const std::filesystem::path &archive)
+{
+  bool zip;
+  ECompression compression;
+  if (!archiveFormat(archive, zip, compression))
+    return false;
+#ifndef CXXPM_HAVE_ZLIB
+  if (zip)
+    return false;
+#endif
+  return compressionSupported(compression);
+}
+
+EExtractResult archiveExtract(const std::filesystem::path &archive,
+                              const std::filesystem::path &destination,
+                              std::string &sha3,
+                              unsigned timeout,
+                              CProcessStats *stats,
+                              unsigned threads)
+{
+  bool zip;
+  ECompression compression;
+  if (!archiveExtractSupported(archive) || !archiveFormat(archive, zip, compression))
+    return EExtractResult::Unsupported;
+
+  auto startTime = std::chrono::steady_clock::now();
+  auto deadline = timeout ? startTime + std::chrono::seconds(timeout) : std::chrono::steady_clock::time_point::max();
+  unsigned threadsNum = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+
+  InputFile file;
+  if (!file.open(archive)) {
+    fprintf(stderr, "ERROR: can't open file %s\n", archive.string().c_str());
+    return EExtractResult::Failed;
+  }
+
+  ExtractWriter writer(destination, std::min(threadsNum, maxWriters));
+  std::unique_ptr<ArchiveReader> reader;
+#ifdef CXXPM_HAVE_ZLIB
+  if (zip)
+    reader = std::make_unique<ZipReader>(writer);
+#endif
+  if (!reader)
+    reader = std::make_unique<TarReader>(writer);
+  std::unique_ptr<Decompressor> decompressor = createDecompressor(compression, threadsNum);
+
+  // Hash is calculated by reading stage, so archive is read once
+  sha3_ctx_t ctx;
+  sha3_init(&ctx, 32);
+  bool timedOut = false;
+  uint64_t offset = 0;
+  auto readArchive = [&](const std::function<bool(std::vector<uint8_t>&)> &consume) -> bool {
+    std::vector<uint8_t> block;
+    while (offset < file.size()) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        timedOut = true;
+        return false;
+      }
+
+      size_t size = static_cast<size_t>(std::min<uint64_t>(readChunkSize, file.size() - offset));
+      block.resize(size);
+      if (!file.readAt(block.data(), size, offset)) {
+        fprintf(stderr, "ERROR: can't read file %s\n", archive.string().c_str());
+        return false;
+      }
+      sha3_update(&ctx, block.data(), size);
+      offset += size;
+      if (!consume(block))
+        return false;
+    }
+    return true;
+  };
+
+  bool readSuccess = true;
+  bool decompressSuccess = true;
+  bool parseSuccess = true;
+  if (threadsNum > 1) {
+    // Reading, decompression and parsing run in own threads connected by bounded queues;
+    // failed stage aborts its input queue, so upstream stages stop too
+    BlockQueue compressed(pipelineDepth);
+    BlockQueue decompressed(pipelineDepth);
+    std::atomic<bool> inputComplete = false;
+    std::thread parseThread([&]() {
+      std::vector<uint8_t> block;
+      while (parseSuccess && decompressed.pop(block))
+        parseSuccess = reader->process(block.data(), block.size());
+      if (!parseSuccess)
+        decompressed.abort();
+    });
+    std::thread decompressThread([&]() {
+      DataSink sink = [&decompressed](const uint8_t *data, size_t size) {
+        return decompressed.push(std::vector<uint8_t>(data, data + size));
+      };
+      std::vector<uint8_t> block;
+      while (decompressSuccess && compressed.pop(block))
+        decompressSuccess = decompressor->process(block.data(), block.size(), sink);
+      decompressSuccess = decompressSuccess && inputComplete && decompressor->finish(sink);
+      if (!decompressSuccess)
+        compressed.abort();
+      decompressed.close();
+    });
+
+    readSuccess = readArchive([&compressed](std::vector<uint8_t> &block) { return compressed.push(std::move(block)); });
+    inputComplete = readSuccess;
+    compressed.close();
+    decompressThread.join();
+    parseThread.join();
+  } else {
+    DataSink sink = [&reader](const uint8_t *data, size_t size) { return reader->process(data, size); };
+    readSuccess = readArchive([&](std::vector<uint8_t> &block) {
+      return decompressSuccess = decompressor->process(block.data(), block.size(), sink);
+    });
+    decompressSuccess = readSuccess && decompressSuccess && decompressor->finish(sink);
+  }
+
+  bool success = readSuccess && decompressSuccess && parseSuccess && reader->finish();
+  success = writer.finish() && success;
+
+  if (stats) {
+    stats->WallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    stats->ReadBytes += offset;
+    stats->WriteBytes += writer.written();
+  }
+
+  if (!success) {
+    if (reader->unsupported())
+      return EExtractResult::Unsupported;
+    if (timedOut)
+      fprintf(stderr, "ERROR: extraction of %s terminated after %u seconds timeout\n", archive.string().c_str(), timeout);
+    else if (!decompressor->error().empty())
+      fprintf(stderr, "ERROR: can't extract %s: %s\n", archive.string().c_str(), decompressor->error().c_str());
+    else if (!reader->error().empty())
+      fprintf(stderr, "ERROR: can't extract %s: %s\n", archive.string().c_str(), reader->error().c_str());
+    return EExtractResult::Failed;
+  }
+
+  sha3 = hashToString(ctx);
+  return EExtractResult::Success;
+}
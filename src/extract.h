@@ -0,0 +1,32 @@
+#pragma once
+
+#include "cxx-pm-config.h"
+#include <filesystem>
+#include <string>
+
+struct CProcessStats;
+
+enum class EExtractResult : unsigned {
+  Success = 0,
+  // Archive format, compression or some entry is not supported by built-in extractor,
+  // external tools should be used. Files extracted before are left in destination
+  Unsupported,
+  Failed
+};
+
+// Built-in extractor knows archive format and its compression library is compiled in:
+// tar (.tar, .tar.gz, .tgz, .tar.bz2, .tar.xz, .tar.lzma, .tar.lz, .tar.zst) and zip
+bool archiveExtractSupported(const std::filesystem::path &archive);
+
+// Extracts archive to destination in process. Archive is read once, data goes through
+// decompressor and tar/zip reader to file writers, small files are created by thread pool.
+// No temporary files are used. sha3 receives hash of archive calculated from the same read,
+// it is valid only on success; timeout is wall-clock limit in seconds.
+// With several threads (0 means all cores) reading, decompression and parsing are pipelined,
+// multi-frame zstd, BGZF gzip and multi-block xz streams are decompressed in parallel
+EExtractResult archiveExtract(const std::filesystem::path &archive,
+                              const std::filesystem::path &destination,
+                              std::string &sha3,
+                              unsigned timeout,
+                              CProcessStats *stats,
+                              unsigned threads = 0);
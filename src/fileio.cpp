@@ -0,0 +1,373 @@
+#include "fileio.h"
+#include "cxx-pm-config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef CXXPM_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+// Files larger than this are mapped to memory instead of reading
+static constexpr uint64_t mapThreshold = 1u << 20;
+static constexpr size_t readBufferSize = 1u << 20;
+
+static uint8_t *threadReadBuffer()
+{
+  static thread_local std::unique_ptr<uint8_t[]> buffer;
+  if (!buffer)
+    buffer.reset(new uint8_t[readBufferSize]);
+  return buffer.get();
+}
+
+InputFile::InputFile(InputFile &&file)
+{
+#ifdef WIN32
+  File_ = file.File_;
+  file.File_ = nullptr;
+#else
+  Fd_ = file.Fd_;
+  file.Fd_ = -1;
+#endif
+  Size_ = file.Size_;
+}
+
+InputFile::~InputFile()
+{
+  close();
+}
+
+bool InputFile::open(const std::filesystem::path &path)
+{
+  close();
+#ifdef WIN32
+  File_ = _wfopen(path.c_str(), L"rb");
+  if (!File_)
+    return false;
+  _fseeki64(File_, 0, SEEK_END);
+  Size_ = _ftelli64(File_);
+  _fseeki64(File_, 0, SEEK_SET);
+  return true;
+#else
+  Fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (Fd_ == -1)
+    return false;
+
+  struct stat s;
+  if (fstat(Fd_, &s) == -1 || !S_ISREG(s.st_mode)) {
+    close();
+    return false;
+  }
+
+  Size_ = s.st_size;
+  return true;
+#endif
+}
+
+void InputFile::close()
+{
+#ifdef WIN32
+  if (File_)
+    fclose(File_);
+  File_ = nullptr;
+#else
+  if (Fd_ != -1)
+    ::close(Fd_);
+  Fd_ = -1;
+#endif
+  Size_ = 0;
+}
+
+bool InputFile::readAll(const std::function<void(const uint8_t*, size_t)> &consumer)
+{
+#ifndef WIN32
+  if (Size_ >= mapThreshold) {
+    void *data = mmap(nullptr, Size_, PROT_READ, MAP_PRIVATE, Fd_, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, Size_, MADV_SEQUENTIAL);
+      consumer(static_cast<const uint8_t*>(data), Size_);
+      munmap(data, Size_);
+      return true;
+    }
+  }
+#endif
+
+  uint8_t *buffer = threadReadBuffer();
+  uint64_t offset = 0;
+  while (offset < Size_) {
+    size_t chunkSize = static_cast<size_t>(std::min<uint64_t>(Size_ - offset, readBufferSize));
+    if (!readAt(buffer, chunkSize, offset))
+      return false;
+    consumer(buffer, chunkSize);
+    offset += chunkSize;
+  }
+
+  return true;
+}
+
+bool InputFile::readAt(void *data, size_t size, uint64_t offset)
+{
+  uint8_t *p = static_cast<uint8_t*>(data);
+#ifdef WIN32
+  if (_fseeki64(File_, offset, SEEK_SET) != 0)
+    return false;
+  return fread(p, 1, size, File_) == size;
+#else
+  while (size) {
+    ssize_t bytesRead = pread(Fd_, p, size, offset);
+    if (bytesRead == -1 && errno == EINTR)
+      continue;
+    if (bytesRead <= 0)
+      return false;
+    p += bytesRead;
+    size -= bytesRead;
+    offset += bytesRead;
+  }
+
+  return true;
+#endif
+}
+
+#ifdef CXXPM_HAVE_IO_URING
+// Minimal io_uring submission/completion rings over raw syscalls,
+// used only for batches of reads
+class IoUring {
+public:
+  ~IoUring();
+  bool init(unsigned entries);
+  unsigned entries() const { return Entries_; }
+  // Reads files[i] to buffers[i] completely, result[i] receives bytes read or negative errno.
+  // Returns false if ring failed with reads possibly in flight, it must not be used anymore
+  bool read(const int *fds, uint8_t *const *buffers, const unsigned *sizes, int *result, unsigned count);
+
+private:
+  int Fd_ = -1;
+  unsigned Entries_ = 0;
+  void *SqRing_ = nullptr;
+  void *CqRing_ = nullptr;
+  size_t SqRingSize_ = 0;
+  size_t CqRingSize_ = 0;
+  io_uring_sqe *Sqes_ = nullptr;
+  size_t SqesSize_ = 0;
+
+  unsigned *SqHead_ = nullptr;
+  unsigned *SqTail_ = nullptr;
+  unsigned *SqMask_ = nullptr;
+  unsigned *SqArray_ = nullptr;
+  unsigned *CqHead_ = nullptr;
+  unsigned *CqTail_ = nullptr;
+  unsigned *CqMask_ = nullptr;
+  io_uring_cqe *Cqes_ = nullptr;
+};
+
+IoUring::~IoUring()
+{
+  if (Sqes_)
+    munmap(Sqes_, SqesSize_);
+  if (CqRing_ && CqRing_ != SqRing_)
+    munmap(CqRing_, CqRingSize_);
+  if (SqRing_)
+    munmap(SqRing_, SqRingSize_);
+  if (Fd_ != -1)
+    ::close(Fd_);
+}
+
+bool IoUring::init(unsigned entries)
+{
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  // io_uring can be disabled by kernel settings or seccomp filter
+  Fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (Fd_ < 0) {
+    Fd_ = -1;
+    return false;
+  }
+
+  SqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  CqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMap)
+    SqRingSize_ = CqRingSize_ = std::max(SqRingSize_, CqRingSize_);
+
+  SqRing_ = mmap(nullptr, SqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd_, IORING_OFF_SQ_RING);
+  if (SqRing_ == MAP_FAILED) {
+    SqRing_ = nullptr;
+    return false;
+  }
+
+  if (singleMap) {
+    CqRing_ = SqRing_;
+  } else {
+    CqRing_ = mmap(nullptr, CqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd_, IORING_OFF_CQ_RING);
+    if (CqRing_ == MAP_FAILED) {
+      CqRing_ = nullptr;
+      return false;
+    }
+  }
+
+  SqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, SqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    return false;
+  Sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  uint8_t *sq = static_cast<uint8_t*>(SqRing_);
+  uint8_t *cq = static_cast<uint8_t*>(CqRing_);
+  SqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  SqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  SqMask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  SqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  CqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  CqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  CqMask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  Cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  Entries_ = params.sq_entries;
+  return true;
+}
+
+bool IoUring::read(const int *fds, uint8_t *const *buffers, const unsigned *sizes, int *result, unsigned count)
+{
+  // We are the only producer, tail can be read without synchronization
+  unsigned tail = *SqTail_;
+  for (unsigned i = 0; i < count; i++) {
+    // Not completed reads are retried by caller with pread
+    result[i] = -EIO;
+    unsigned index = tail & *SqMask_;
+    io_uring_sqe *sqe = &Sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fds[i];
+    sqe->addr = reinterpret_cast<uint64_t>(buffers[i]);
+    sqe->len = sizes[i];
+    sqe->off = 0;
+    sqe->user_data = i;
+    SqArray_[index] = index;
+    tail++;
+  }
+  __atomic_store_n(SqTail_, tail, __ATOMIC_RELEASE);
+
+  // Buffers are returned to caller and reused by next batch, so after submission error reads
+  // in flight are waited for: their late completion would overwrite data
+  unsigned submitted = 0;
+  unsigned completed = 0;
+  bool failed = false;
+  while (failed ? completed < submitted : completed < count) {
+    unsigned toSubmit = failed ? 0 : count - submitted;
+    unsigned toWait = failed ? 1 : count - completed;
+    int res = static_cast<int>(syscall(__NR_io_uring_enter, Fd_, toSubmit, toWait, IORING_ENTER_GETEVENTS, nullptr, 0));
+    if (res < 0 && errno != EINTR) {
+      if (failed || (errno != EAGAIN && errno != EBUSY))
+        return false;
+      // Reads not taken by kernel are withdrawn, next call would submit them with stale buffers
+      failed = true;
+      __atomic_store_n(SqTail_, __atomic_load_n(SqHead_, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    }
+    if (res > 0)
+      submitted += res;
+
+    unsigned head = *CqHead_;
+    unsigned cqTail = __atomic_load_n(CqTail_, __ATOMIC_ACQUIRE);
+    while (head != cqTail) {
+      const io_uring_cqe *cqe = &Cqes_[head & *CqMask_];
+      result[cqe->user_data] = cqe->res;
+      head++;
+      completed++;
+    }
+    __atomic_store_n(CqHead_, head, __ATOMIC_RELEASE);
+  }
+
+  return true;
+}
+
+static thread_local std::unique_ptr<IoUring> gThreadIoUring;
+static thread_local bool gThreadIoUringInitialized = false;
+
+static IoUring *threadIoUring()
+{
+  if (!gThreadIoUringInitialized) {
+    gThreadIoUringInitialized = true;
+    gThreadIoUring.reset(new IoUring);
+    if (!gThreadIoUring->init(64))
+      gThreadIoUring.reset();
+  }
+
+  return gThreadIoUring.get();
+}
+#endif
+
+void readFilesBatch(std::vector<InputFile> &files, std::vector<uint8_t> &data, std::vector<size_t> &offsets, std::vector<bool> &success)
+{
+  offsets.resize(files.size() + 1);
+  size_t totalSize = 0;
+  for (size_t i = 0, ie = files.size(); i != ie; ++i) {
+    offsets[i] = totalSize;
+    totalSize += files[i].size();
+  }
+  offsets[files.size()] = totalSize;
+  data.resize(totalSize);
+  success.assign(files.size(), false);
+
+#ifdef CXXPM_HAVE_IO_URING
+  if (IoUring *ring = threadIoUring()) {
+    static constexpr unsigned maxBatch = 64;
+    int fds[maxBatch];
+    uint8_t *buffers[maxBatch];
+    unsigned sizes[maxBatch];
+    int result[maxBatch];
+    unsigned count = 0;
+    for (size_t first = 0, ie = files.size(); first < ie; first += count) {
+      count = static_cast<unsigned>(std::min<size_t>(ring ? std::min(ring->entries(), maxBatch) : maxBatch, ie - first));
+      for (unsigned i = 0; i < count; i++) {
+        fds[i] = files[first + i].Fd_;
+        buffers[i] = data.data() + offsets[first + i];
+        sizes[i] = static_cast<unsigned>(files[first + i].size());
+      }
+
+      if (!ring) {
+        std::fill(result, result + count, -EIO);
+      } else if (!ring->read(fds, buffers, sizes, result, count)) {
+        // Closing ring doesn't wait for reads in flight, they may still write to buffers of this
+        // batch. Failed ring stays open and its target memory is abandoned, both are leaked once
+        // per thread; data of completed batches is moved to fresh storage, thread continues with pread
+        gThreadIoUring.release();
+        ring = nullptr;
+        std::vector<uint8_t> *abandoned = new std::vector<uint8_t>;
+        abandoned->swap(data);
+        data.resize(totalSize);
+        if (offsets[first])
+          memcpy(data.data(), abandoned->data(), offsets[first]);
+        for (unsigned i = 0; i < count; i++) {
+          buffers[i] = data.data() + offsets[first + i];
+          result[i] = -EIO;
+        }
+      }
+      for (unsigned i = 0; i < count; i++) {
+        InputFile &file = files[first + i];
+        if (result[i] >= 0 && static_cast<uint64_t>(result[i]) == file.size()) {
+          success[first + i] = true;
+        } else if (result[i] >= 0) {
+          // short read, read the rest synchronously
+          success[first + i] = file.readAt(buffers[i] + result[i], sizes[i] - result[i], result[i]);
+        } else {
+          success[first + i] = file.readAt(buffers[i], sizes[i], 0);
+        }
+      }
+    }
+
+    return;
+  }
+#endif
+
+  for (size_t i = 0, ie = files.size(); i != ie; ++i)
+    success[i] = files[i].readAt(data.data() + offsets[i], files[i].size(), 0);
+}
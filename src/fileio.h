@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+// Read-only file opened for hashing or copying
+class InputFile {
+public:
+  InputFile() {}
+  InputFile(InputFile &&file);
+  InputFile(const InputFile&) = delete;
+  InputFile &operator=(const InputFile&) = delete;
+  ~InputFile();
+
+  bool open(const std::filesystem::path &path);
+  void close();
+  uint64_t size() const { return Size_; }
+
+  // Passes whole file to consumer sequentially: large files are mapped at once with
+  // MADV_SEQUENTIAL, small ones are read with pread to reusable per-thread buffer
+  bool readAll(const std::function<void(const uint8_t*, size_t)> &consumer);
+  // Reads exactly size bytes from offset
+  bool readAt(void *data, size_t size, uint64_t offset);
+
+private:
+  friend void readFilesBatch(std::vector<InputFile>&, std::vector<uint8_t>&, std::vector<size_t>&, std::vector<bool>&);
+#ifdef WIN32
+  FILE *File_ = nullptr;
+#else
+  int Fd_ = -1;
+#endif
+  uint64_t Size_ = 0;
+};
+
+// Reads whole contents of many small files into one buffer with as few syscalls as possible:
+// one io_uring submission for whole batch on Linux if kernel allows it, pread per file otherwise.
+// Contents of files[i] is data[offsets[i]..offsets[i+1]), success[i] is false if file can't be read
+void readFilesBatch(std::vector<InputFile> &files, std::vector<uint8_t> &data, std::vector<size_t> &offsets, std::vector<bool> &success);
@@ -0,0 +1,46 @@
+#include "hash.h"
+#include "blake3.h"
+#include "sha3.h"
+
+EHashAlgorithm hashAlgorithmFromString(const std::string &name)
+{
+  if (name == "sha3")
+    return EHashAlgorithm::SHA3;
+  else if (name == "blake3")
+    return EHashAlgorithm::BLAKE3;
+  else
+    return EHashAlgorithm::Unknown;
+}
+
+const char *hashAlgorithmName(EHashAlgorithm algorithm)
+{
+  switch (algorithm) {
+    case EHashAlgorithm::SHA3 : return "sha3";
+    case EHashAlgorithm::BLAKE3 : return "blake3";
+    default : return "unknown";
+  }
+}
+
+std::string fileHash(EHashAlgorithm algorithm, const std::filesystem::path &path)
+{
+  switch (algorithm) {
+    case EHashAlgorithm::SHA3 : return sha3FileHash(path);
+    case EHashAlgorithm::BLAKE3 : return blake3FileHash(path);
+    default : return std::string();
+  }
+}
+
+void filesHash(EHashAlgorithm algorithm, const std::vector<std::filesystem::path> &paths, std::vector<std::string> &hashes)
+{
+  switch (algorithm) {
+    case EHashAlgorithm::SHA3 :
+      sha3FilesHash(paths, hashes);
+      break;
+    case EHashAlgorithm::BLAKE3 :
+      blake3FilesHash(paths, hashes);
+      break;
+    default :
+      hashes.assign(paths.size(), std::string());
+      break;
+  }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Hash functions available for manifests; archives are always checked with SHA3
+enum class EHashAlgorithm : unsigned {
+  Unknown = 0,
+  SHA3,
+  BLAKE3
+};
+
+EHashAlgorithm hashAlgorithmFromString(const std::string &name);
+const char *hashAlgorithmName(EHashAlgorithm algorithm);
+
+std::string fileHash(EHashAlgorithm algorithm, const std::filesystem::path &path);
+void filesHash(EHashAlgorithm algorithm, const std::vector<std::filesystem::path> &paths, std::vector<std::string> &hashes);
@@ -0,0 +1,349 @@
+#include "hashCache.h"
+#include "fileio.h"
+#include "sha3.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+
+#ifdef __linux__
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#endif
+
+// File modified in the same clock tick after hashing keeps its mtime,
+// so hashes of files modified less than second ago are not stored
+static constexpr uint64_t racyIntervalNs = 1000000000ull;
+
+static bool gHashCacheEnabled = false;
+static std::filesystem::path gSidecarDirectory;
+
+static bool fileStamp(const std::filesystem::path &path, CFileStamp &stamp)
+{
+#ifdef __linux__
+  struct stat s;
+  if (stat(path.c_str(), &s) == -1 || !S_ISREG(s.st_mode))
+    return false;
+  stamp.Size = s.st_size;
+  stamp.MTimeNs = s.st_mtim.tv_sec*1000000000ull + s.st_mtim.tv_nsec;
+  stamp.CTimeNs = s.st_ctim.tv_sec*1000000000ull + s.st_ctim.tv_nsec;
+  return true;
+#else
+  std::error_code ec;
+  auto size = std::filesystem::file_size(path, ec);
+  if (ec)
+    return false;
+  auto mtime = std::filesystem::last_write_time(path, ec);
+  if (ec)
+    return false;
+  stamp.Size = size;
+  stamp.MTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+  stamp.CTimeNs = 0;
+  return true;
+#endif
+}
+
+// Format: "<hash> <size> <mtime_ns> <ctime_ns>"
+static std::string formatEntry(const CFileStamp &stamp, const std::string &hash)
+{
+  char buffer[96];
+  snprintf(buffer, sizeof(buffer), " %llu %llu %llu",
+           static_cast<unsigned long long>(stamp.Size),
+           static_cast<unsigned long long>(stamp.MTimeNs),
+           static_cast<unsigned long long>(stamp.CTimeNs));
+  return hash + buffer;
+}
+
+static bool parseEntry(const std::string &data, CFileStamp &stamp, std::string &hash)
+{
+  size_t pos = data.find(' ');
+  if (pos == std::string::npos || pos == 0)
+    return false;
+
+  const char *p = data.c_str() + pos;
+  char *end;
+  uint64_t values[3];
+  for (unsigned i = 0; i < 3; i++) {
+    errno = 0;
+    values[i] = strtoull(p, &end, 10);
+    if (end == p || errno != 0)
+      return false;
+    p = end;
+  }
+
+  hash = data.substr(0, pos);
+  stamp.Size = values[0];
+  stamp.MTimeNs = values[1];
+  stamp.CTimeNs = values[2];
+  return true;
+}
+
+static std::string absolutePath(const std::filesystem::path &path)
+{
+  std::error_code ec;
+  std::filesystem::path absolutePath = std::filesystem::absolute(path, ec);
+  return (ec ? path : absolutePath).u8string();
+}
+
+static std::filesystem::path sidecarPath(const std::filesystem::path &path, const char *algorithm)
+{
+  std::string key = absolutePath(path);
+  key.push_back('!');
+  key.append(algorithm);
+  return gSidecarDirectory / sha3StringHash(key);
+}
+
+// Sidecar format: entry line, then absolute path of file for pruning
+static bool readSidecarFile(const std::filesystem::path &sidecar, CFileStamp &stamp, std::string &hash, std::string *filePath)
+{
+  std::ifstream in(sidecar, std::ios::binary);
+  if (!in)
+    return false;
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  size_t newline = data.find('\n');
+  if (filePath)
+    *filePath = newline == data.npos ? std::string() : data.substr(newline + 1);
+  return parseEntry(data.substr(0, newline), stamp, hash);
+}
+
+// Temporary file is renamed to sidecar, killed process doesn't leave truncated one
+static void writeFileAtomic(const std::filesystem::path &path, const std::string &data)
+{
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+
+  FILE *hFile = fopen(tmp.string().c_str(), "wb");
+  if (!hFile)
+    return;
+  bool success = fwrite(data.data(), 1, data.size(), hFile) == data.size();
+  success &= fclose(hFile) == 0;
+
+  std::error_code ec;
+  if (success)
+    std::filesystem::rename(tmp, path, ec);
+  if (!success || ec)
+    std::filesystem::remove(tmp, ec);
+}
+
+static void writeSidecar(const std::filesystem::path &path, const char *algorithm, const std::string &entry)
+{
+  writeFileAtomic(sidecarPath(path, algorithm), entry + "\n" + absolutePath(path));
+}
+
+static bool stampEqual(const CFileStamp &lhs, const CFileStamp &rhs)
+{
+  return lhs.Size == rhs.Size && lhs.MTimeNs == rhs.MTimeNs && lhs.CTimeNs == rhs.CTimeNs;
+}
+
+void hashCacheEnable(const std::filesystem::path &sidecarDirectory)
+{
+  std::error_code ec;
+  std::filesystem::create_directories(sidecarDirectory, ec);
+  gSidecarDirectory = sidecarDirectory;
+  gHashCacheEnabled = true;
+}
+
+bool hashCacheEnabled()
+{
+  return gHashCacheEnabled;
+}
+
+bool hashCacheLookup(const std::filesystem::path &path, const char *algorithm, CFileStamp &stamp, std::string &hash)
+{
+  stamp = CFileStamp();
+  if (!gHashCacheEnabled || !fileStamp(path, stamp))
+    return false;
+
+  CFileStamp cached;
+  std::filesystem::path sidecar = sidecarPath(path, algorithm);
+  bool found = readSidecarFile(sidecar, cached, hash, nullptr);
+#ifdef __linux__
+  // Attribute holds hash with size and mtime, sidecar holds ctime after attribute write
+  // (see hashCacheStore); file replaced by another one has no attribute
+  std::string attributeName = std::string("user.cxxpm.") + algorithm;
+  char buffer[256];
+  ssize_t size = getxattr(path.c_str(), attributeName.c_str(), buffer, sizeof(buffer));
+  CFileStamp attributeStamp;
+  std::string attributeHash;
+  if (size > 0 &&
+      (!parseEntry(std::string(buffer, size), attributeStamp, attributeHash) ||
+       attributeHash != hash ||
+       attributeStamp.Size != stamp.Size ||
+       attributeStamp.MTimeNs != stamp.MTimeNs))
+    found = false;
+#endif
+  if (found && stampEqual(cached, stamp))
+    return true;
+
+  // Entry of changed file is useless, it is written again if file is hashed now
+  std::error_code ec;
+  std::filesystem::remove(sidecar, ec);
+  hash.clear();
+  return false;
+}
+
+void hashCacheStore(const std::filesystem::path &path, const char *algorithm, const CFileStamp &stamp, const std::string &hash)
+{
+  if (!gHashCacheEnabled || hash.empty() || stamp.MTimeNs == 0)
+    return;
+
+  uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  if (stamp.MTimeNs + racyIntervalNs > now)
+    return;
+
+  CFileStamp current;
+  if (!fileStamp(path, current) || !stampEqual(current, stamp))
+    return;
+
+#ifdef __linux__
+  // Writing attribute changes ctime (with fine grained value after stat on recent kernels), so
+  // attribute can't contain ctime to compare with. It is recorded in sidecar after attribute
+  // write and lookup requires exact match: in-place rewrite with restored mtime is not trusted
+  std::string attributeName = std::string("user.cxxpm.") + algorithm;
+  std::string entry = formatEntry(stamp, hash);
+  if (setxattr(path.c_str(), attributeName.c_str(), entry.data(), entry.size(), 0) == 0) {
+    if (!fileStamp(path, current) || current.Size != stamp.Size || current.MTimeNs != stamp.MTimeNs) {
+      removexattr(path.c_str(), attributeName.c_str());
+      return;
+    }
+  }
+#endif
+
+  writeSidecar(path, algorithm, formatEntry(current, hash));
+}
+
+void hashFilesBatched(const std::vector<std::filesystem::path> &paths,
+                      const char *algorithm,
+                      const FileHashFunction &fileHash,
+                      const MultiHashFunction &multiHash,
+                      std::vector<std::string> &hashes)
+{
+  // Batch is limited by 8 MiB and 256 files
+  static constexpr uint64_t smallFileLimit = 1u << 16;
+  static constexpr size_t batchSizeLimit = 1u << 23;
+  static constexpr size_t batchCountLimit = 256;
+
+  // Buffers are reused between calls
+  static thread_local std::vector<uint8_t> batchData;
+  std::vector<InputFile> batch;
+  std::vector<size_t> batchIndex;
+  std::vector<CFileStamp> stamps(paths.size());
+  std::vector<size_t> batchOffset;
+  std::vector<bool> batchSuccess;
+  std::vector<std::string_view> batchMessages;
+  std::vector<std::string> batchHashes;
+  size_t batchSize = 0;
+
+  auto flush = [&]() {
+    readFilesBatch(batch, batchData, batchOffset, batchSuccess);
+    batchMessages.clear();
+    for (size_t i = 0, ie = batch.size(); i != ie; ++i)
+      batchMessages.emplace_back(reinterpret_cast<const char*>(batchData.data()) + batchOffset[i], batchOffset[i+1] - batchOffset[i]);
+    batchHashes.resize(batchMessages.size());
+    multiHash(batchMessages.data(), batchMessages.size(), batchHashes.data());
+    for (size_t i = 0, ie = batch.size(); i != ie; ++i) {
+      if (batchSuccess[i]) {
+        hashes[batchIndex[i]] = std::move(batchHashes[i]);
+        hashCacheStore(paths[batchIndex[i]], algorithm, stamps[batchIndex[i]], hashes[batchIndex[i]]);
+      }
+    }
+
+    batch.clear();
+    batchIndex.clear();
+    batchSize = 0;
+  };
+
+  hashes.assign(paths.size(), std::string());
+  for (size_t i = 0, ie = paths.size(); i != ie; ++i) {
+    if (hashCacheLookup(paths[i], algorithm, stamps[i], hashes[i]))
+      continue;
+
+    InputFile file;
+    if (!file.open(paths[i]))
+      continue;
+
+    if (file.size() > smallFileLimit) {
+      hashes[i] = fileHash(file);
+      if (!hashes[i].empty())
+        hashCacheStore(paths[i], algorithm, stamps[i], hashes[i]);
+      continue;
+    }
+
+    batchSize += file.size();
+    batch.emplace_back(std::move(file));
+    batchIndex.push_back(i);
+    if (batchSize >= batchSizeLimit || batch.size() >= batchCountLimit)
+      flush();
+  }
+
+  if (!batch.empty())
+    flush();
+}
+
+size_t hashCachePrune(const std::filesystem::path &sidecarDirectory)
+{
+  size_t removed = 0;
+  std::error_code ec;
+  for (const auto &element: std::filesystem::directory_iterator(sidecarDirectory, ec)) {
+    // Temporary files could belong to concurrent process
+    std::error_code fileEc;
+    if (!element.is_regular_file(fileEc) || element.path().extension() == ".tmp")
+      continue;
+
+    CFileStamp cached;
+    CFileStamp stamp;
+    std::string hash;
+    std::string filePath;
+    if (readSidecarFile(element.path(), cached, hash, &filePath) &&
+        !filePath.empty() &&
+        fileStamp(std::filesystem::u8path(filePath), stamp) &&
+        stampEqual(cached, stamp))
+      continue;
+
+    if (std::filesystem::remove(element.path(), fileEc))
+      removed++;
+  }
+  return removed;
+}
+
+static std::filesystem::path validatedSidecarPath(const std::filesystem::path &path, const char *algorithm)
+{
+  std::filesystem::path sidecar = path;
+  sidecar += ".";
+  sidecar += algorithm;
+  return sidecar;
+}
+
+bool hashSidecarCheck(const std::filesystem::path &path, const char *algorithm, const std::string &expectedHash)
+{
+  FILE *hFile = fopen(validatedSidecarPath(path, algorithm).string().c_str(), "rb");
+  if (!hFile)
+    return false;
+
+  char buffer[256];
+  size_t size = fread(buffer, 1, sizeof(buffer), hFile);
+  fclose(hFile);
+
+  CFileStamp stamp;
+  CFileStamp recorded;
+  std::string hash;
+  return parseEntry(std::string(buffer, size), recorded, hash) &&
+         fileStamp(path, stamp) &&
+         hash == expectedHash &&
+         recorded.Size == stamp.Size &&
+         recorded.MTimeNs == stamp.MTimeNs &&
+         recorded.CTimeNs == stamp.CTimeNs;
+}
+
+void hashSidecarWrite(const std::filesystem::path &path, const char *algorithm, const std::string &hash)
+{
+  CFileStamp stamp;
+  if (!fileStamp(path, stamp))
+    return;
+
+  writeFileAtomic(validatedSidecarPath(path, algorithm), formatEntry(stamp, hash));
+}
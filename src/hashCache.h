@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class InputFile;
+
+// File metadata which must stay unchanged for cached hash to be valid
+struct CFileStamp {
+  uint64_t Size = 0;
+  uint64_t MTimeNs = 0;
+  uint64_t CTimeNs = 0;
+};
+
+// Opt-in cache of file hashes. Hash is stored with file metadata in "user.cxxpm.<algorithm>"
+// extended attribute on Linux and in sidecar file under sidecarDirectory. Sidecar records
+// exact ctime (for attribute, ctime after its write), size, mtime and ctime must all match
+void hashCacheEnable(const std::filesystem::path &sidecarDirectory);
+bool hashCacheEnabled();
+
+// Returns true and cached hash if file not changed since hash was stored.
+// On miss stamp receives current file metadata, pass it to hashCacheStore after hashing
+bool hashCacheLookup(const std::filesystem::path &path, const char *algorithm, CFileStamp &stamp, std::string &hash);
+void hashCacheStore(const std::filesystem::path &path, const char *algorithm, const CFileStamp &stamp, const std::string &hash);
+
+// Hash of whole file, empty string if file can't be read
+typedef std::function<std::string(InputFile&)> FileHashFunction;
+// hashes[i] receives hash of messages[i]
+typedef std::function<void(const std::string_view*, size_t, std::string*)> MultiHashFunction;
+
+// Hashes list of files through cache with given algorithm name: files up to 64 KiB are read
+// together in batches and go to multiHash, larger ones go to fileHash one by one. Hash of
+// unreadable file is empty string
+void hashFilesBatched(const std::vector<std::filesystem::path> &paths,
+                      const char *algorithm,
+                      const FileHashFunction &fileHash,
+                      const MultiHashFunction &multiHash,
+                      std::vector<std::string> &hashes);
+
+// Removes sidecar files of deleted and changed files, returns their number
+size_t hashCachePrune(const std::filesystem::path &sidecarDirectory);
+
+// Validated hash recorded next to file as "<path>.<algorithm>" (archives in DistrDir),
+// it is written regardless of cache setting. Check returns true if file metadata not
+// changed since record and recorded hash equals expectedHash
+bool hashSidecarCheck(const std::filesystem::path &path, const char *algorithm, const std::string &expectedHash);
+void hashSidecarWrite(const std::filesystem::path &path, const char *algorithm, const std::string &hash);
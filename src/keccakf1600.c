@@ -0,0 +1,490 @@
+/* 
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+// keccakf1600.c
+// Unrolled Keccak-f[1600] permutations and runtime selection of the fastest
+// one supported by current CPU. sha3_keccakf_ref from tiny_sha3.c stays as
+// reference and as fallback for big-endian targets.
+//
+// Lane names follow the Keccak team notation: rows b, g, k, m, s (y = 0..4)
+// and columns a, e, i, o, u (x = 0..4), lane "ki" is st[2 + 5*2].
+
+#include "keccakf1600.h"
+#include "tiny_sha3.h"
+
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define KECCAKF1600_X86 1
+#include <immintrin.h>
+#endif
+
+static const uint64_t keccakf1600_rndc[24] = {
+    0x0000000000000001, 0x0000000000008082, 0x800000000000808a,
+    0x8000000080008000, 0x000000000000808b, 0x0000000080000001,
+    0x8000000080008081, 0x8000000000008009, 0x000000000000008a,
+    0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
+    0x000000008000808b, 0x800000000000008b, 0x8000000000008089,
+    0x8000000000008003, 0x8000000000008002, 0x8000000000000080,
+    0x000000000000800a, 0x800000008000000a, 0x8000000080008081,
+    0x8000000000008080, 0x0000000080000001, 0x8000000080008008
+};
+
+#define KECCAK_DECLARE(T, P) \
+    T P##ba, P##be, P##bi, P##bo, P##bu; \
+    T P##ga, P##ge, P##gi, P##go, P##gu; \
+    T P##ka, P##ke, P##ki, P##ko, P##ku; \
+    T P##ma, P##me, P##mi, P##mo, P##mu; \
+    T P##sa, P##se, P##si, P##so, P##su
+
+#define KECCAK_LOAD(A, st) \
+    A##ba = st[0]; A##be = st[1]; A##bi = st[2]; A##bo = st[3]; A##bu = st[4]; \
+    A##ga = st[5]; A##ge = st[6]; A##gi = st[7]; A##go = st[8]; A##gu = st[9]; \
+    A##ka = st[10]; A##ke = st[11]; A##ki = st[12]; A##ko = st[13]; A##ku = st[14]; \
+    A##ma = st[15]; A##me = st[16]; A##mi = st[17]; A##mo = st[18]; A##mu = st[19]; \
+    A##sa = st[20]; A##se = st[21]; A##si = st[22]; A##so = st[23]; A##su = st[24]
+
+#define KECCAK_STORE(A, st) \
+    st[0] = A##ba; st[1] = A##be; st[2] = A##bi; st[3] = A##bo; st[4] = A##bu; \
+    st[5] = A##ga; st[6] = A##ge; st[7] = A##gi; st[8] = A##go; st[9] = A##gu; \
+    st[10] = A##ka; st[11] = A##ke; st[12] = A##ki; st[13] = A##ko; st[14] = A##ku; \
+    st[15] = A##ma; st[16] = A##me; st[17] = A##mi; st[18] = A##mo; st[19] = A##mu; \
+    st[20] = A##sa; st[21] = A##se; st[22] = A##si; st[23] = A##so; st[24] = A##su
+
+// Interleaved states of SIMD kernels, lane i of instance j is st[i*N + j]
+#define KECCAK_LOAD_V(A, st) \
+    A##ba = KV_LOAD(st, 0); A##be = KV_LOAD(st, 1); A##bi = KV_LOAD(st, 2); A##bo = KV_LOAD(st, 3); A##bu = KV_LOAD(st, 4); \
+    A##ga = KV_LOAD(st, 5); A##ge = KV_LOAD(st, 6); A##gi = KV_LOAD(st, 7); A##go = KV_LOAD(st, 8); A##gu = KV_LOAD(st, 9); \
+    A##ka = KV_LOAD(st, 10); A##ke = KV_LOAD(st, 11); A##ki = KV_LOAD(st, 12); A##ko = KV_LOAD(st, 13); A##ku = KV_LOAD(st, 14); \
+    A##ma = KV_LOAD(st, 15); A##me = KV_LOAD(st, 16); A##mi = KV_LOAD(st, 17); A##mo = KV_LOAD(st, 18); A##mu = KV_LOAD(st, 19); \
+    A##sa = KV_LOAD(st, 20); A##se = KV_LOAD(st, 21); A##si = KV_LOAD(st, 22); A##so = KV_LOAD(st, 23); A##su = KV_LOAD(st, 24)
+
+#define KECCAK_STORE_V(A, st) \
+    KV_STORE(st, 0, A##ba); KV_STORE(st, 1, A##be); KV_STORE(st, 2, A##bi); KV_STORE(st, 3, A##bo); KV_STORE(st, 4, A##bu); \
+    KV_STORE(st, 5, A##ga); KV_STORE(st, 6, A##ge); KV_STORE(st, 7, A##gi); KV_STORE(st, 8, A##go); KV_STORE(st, 9, A##gu); \
+    KV_STORE(st, 10, A##ka); KV_STORE(st, 11, A##ke); KV_STORE(st, 12, A##ki); KV_STORE(st, 13, A##ko); KV_STORE(st, 14, A##ku); \
+    KV_STORE(st, 15, A##ma); KV_STORE(st, 16, A##me); KV_STORE(st, 17, A##mi); KV_STORE(st, 18, A##mo); KV_STORE(st, 19, A##mu); \
+    KV_STORE(st, 20, A##sa); KV_STORE(st, 21, A##se); KV_STORE(st, 22, A##si); KV_STORE(st, 23, A##so); KV_STORE(st, 24, A##su)
+
+// theta, rho, pi, chi and iota from state A to state E, complemented lanes
+#define KECCAK_ROUND_LC(A, E, rc) \
+    Ca = A##ba ^ A##ga ^ A##ka ^ A##ma ^ A##sa; \
+    Ce = A##be ^ A##ge ^ A##ke ^ A##me ^ A##se; \
+    Ci = A##bi ^ A##gi ^ A##ki ^ A##mi ^ A##si; \
+    Co = A##bo ^ A##go ^ A##ko ^ A##mo ^ A##so; \
+    Cu = A##bu ^ A##gu ^ A##ku ^ A##mu ^ A##su; \
+    Da = Cu ^ ROTL64(Ce, 1); \
+    De = Ca ^ ROTL64(Ci, 1); \
+    Di = Ce ^ ROTL64(Co, 1); \
+    Do = Ci ^ ROTL64(Cu, 1); \
+    Du = Co ^ ROTL64(Ca, 1); \
+    Bba = A##ba ^ Da; \
+    Bbe = ROTL64(A##ge ^ De, 44); \
+    Bbi = ROTL64(A##ki ^ Di, 43); \
+    Bbo = ROTL64(A##mo ^ Do, 21); \
+    Bbu = ROTL64(A##su ^ Du, 14); \
+    E##ba = Bba ^ (Bbe | Bbi); \
+    E##be = Bbe ^ (~Bbi | Bbo); \
+    E##bi = Bbi ^ (Bbo & Bbu); \
+    E##bo = Bbo ^ (Bbu | Bba); \
+    E##bu = Bbu ^ (Bba & Bbe); \
+    E##ba ^= rc; \
+    Bga = ROTL64(A##bo ^ Do, 28); \
+    Bge = ROTL64(A##gu ^ Du, 20); \
+    Bgi = ROTL64(A##ka ^ Da, 3); \
+    Bgo = ROTL64(A##me ^ De, 45); \
+    Bgu = ROTL64(A##si ^ Di, 61); \
+    E##ga = Bga ^ (Bge | Bgi); \
+    E##ge = Bge ^ (Bgi & Bgo); \
+    E##gi = Bgi ^ (Bgo | ~Bgu); \
+    E##go = Bgo ^ (Bgu | Bga); \
+    E##gu = Bgu ^ (Bga & Bge); \
+    Bka = ROTL64(A##be ^ De, 1); \
+    Bke = ROTL64(A##gi ^ Di, 6); \
+    Bki = ROTL64(A##ko ^ Do, 25); \
+    Bko = ROTL64(A##mu ^ Du, 8); \
+    Bku = ROTL64(A##sa ^ Da, 18); \
+    E##ka = Bka ^ (Bke | Bki); \
+    E##ke = Bke ^ (Bki & Bko); \
+    E##ki = Bki ^ (~Bko & Bku); \
+    E##ko = ~Bko ^ (Bku | Bka); \
+    E##ku = Bku ^ (Bka & Bke); \
+    Bma = ROTL64(A##bu ^ Du, 27); \
+    Bme = ROTL64(A##ga ^ Da, 36); \
+    Bmi = ROTL64(A##ke ^ De, 10); \
+    Bmo = ROTL64(A##mi ^ Di, 15); \
+    Bmu = ROTL64(A##so ^ Do, 56); \
+    E##ma = Bma ^ (Bme & Bmi); \
+    E##me = Bme ^ (Bmi | Bmo); \
+    E##mi = Bmi ^ (~Bmo | Bmu); \
+    E##mo = ~Bmo ^ (Bmu & Bma); \
+    E##mu = Bmu ^ (Bma | Bme); \
+    Bsa = ROTL64(A##bi ^ Di, 62); \
+    Bse = ROTL64(A##go ^ Do, 55); \
+    Bsi = ROTL64(A##ku ^ Du, 39); \
+    Bso = ROTL64(A##ma ^ Da, 41); \
+    Bsu = ROTL64(A##se ^ De, 2); \
+    E##sa = Bsa ^ (~Bse & Bsi); \
+    E##se = ~Bse ^ (Bsi | Bso); \
+    E##si = Bsi ^ (Bso & Bsu); \
+    E##so = Bso ^ (Bsu | Bsa); \
+    E##su = Bsu ^ (Bsa & Bse);
+
+// theta, rho, pi, chi and iota from state A to state E, plain chi maps to ANDN
+#define KECCAK_ROUND(A, E, rc) \
+    Ca = A##ba ^ A##ga ^ A##ka ^ A##ma ^ A##sa; \
+    Ce = A##be ^ A##ge ^ A##ke ^ A##me ^ A##se; \
+    Ci = A##bi ^ A##gi ^ A##ki ^ A##mi ^ A##si; \
+    Co = A##bo ^ A##go ^ A##ko ^ A##mo ^ A##so; \
+    Cu = A##bu ^ A##gu ^ A##ku ^ A##mu ^ A##su; \
+    Da = Cu ^ ROTL64(Ce, 1); \
+    De = Ca ^ ROTL64(Ci, 1); \
+    Di = Ce ^ ROTL64(Co, 1); \
+    Do = Ci ^ ROTL64(Cu, 1); \
+    Du = Co ^ ROTL64(Ca, 1); \
+    Bba = A##ba ^ Da; \
+    Bbe = ROTL64(A##ge ^ De, 44); \
+    Bbi = ROTL64(A##ki ^ Di, 43); \
+    Bbo = ROTL64(A##mo ^ Do, 21); \
+    Bbu = ROTL64(A##su ^ Du, 14); \
+    E##ba = Bba ^ (~Bbe & Bbi); \
+    E##be = Bbe ^ (~Bbi & Bbo); \
+    E##bi = Bbi ^ (~Bbo & Bbu); \
+    E##bo = Bbo ^ (~Bbu & Bba); \
+    E##bu = Bbu ^ (~Bba & Bbe); \
+    E##ba ^= rc; \
+    Bga = ROTL64(A##bo ^ Do, 28); \
+    Bge = ROTL64(A##gu ^ Du, 20); \
+    Bgi = ROTL64(A##ka ^ Da, 3); \
+    Bgo = ROTL64(A##me ^ De, 45); \
+    Bgu = ROTL64(A##si ^ Di, 61); \
+    E##ga = Bga ^ (~Bge & Bgi); \
+    E##ge = Bge ^ (~Bgi & Bgo); \
+    E##gi = Bgi ^ (~Bgo & Bgu); \
+    E##go = Bgo ^ (~Bgu & Bga); \
+    E##gu = Bgu ^ (~Bga & Bge); \
+    Bka = ROTL64(A##be ^ De, 1); \
+    Bke = ROTL64(A##gi ^ Di, 6); \
+    Bki = ROTL64(A##ko ^ Do, 25); \
+    Bko = ROTL64(A##mu ^ Du, 8); \
+    Bku = ROTL64(A##sa ^ Da, 18); \
+    E##ka = Bka ^ (~Bke & Bki); \
+    E##ke = Bke ^ (~Bki & Bko); \
+    E##ki = Bki ^ (~Bko & Bku); \
+    E##ko = Bko ^ (~Bku & Bka); \
+    E##ku = Bku ^ (~Bka & Bke); \
+    Bma = ROTL64(A##bu ^ Du, 27); \
+    Bme = ROTL64(A##ga ^ Da, 36); \
+    Bmi = ROTL64(A##ke ^ De, 10); \
+    Bmo = ROTL64(A##mi ^ Di, 15); \
+    Bmu = ROTL64(A##so ^ Do, 56); \
+    E##ma = Bma ^ (~Bme & Bmi); \
+    E##me = Bme ^ (~Bmi & Bmo); \
+    E##mi = Bmi ^ (~Bmo & Bmu); \
+    E##mo = Bmo ^ (~Bmu & Bma); \
+    E##mu = Bmu ^ (~Bma & Bme); \
+    Bsa = ROTL64(A##bi ^ Di, 62); \
+    Bse = ROTL64(A##go ^ Do, 55); \
+    Bsi = ROTL64(A##ku ^ Du, 39); \
+    Bso = ROTL64(A##ma ^ Da, 41); \
+    Bsu = ROTL64(A##se ^ De, 2); \
+    E##sa = Bsa ^ (~Bse & Bsi); \
+    E##se = Bse ^ (~Bsi & Bso); \
+    E##si = Bsi ^ (~Bso & Bsu); \
+    E##so = Bso ^ (~Bsu & Bsa); \
+    E##su = Bsu ^ (~Bsa & Bse);
+
+// Same round over KV_TYPE vectors of lanes, KV_* operations are defined
+// before each SIMD kernel
+#define KECCAK_ROUND_V(A, E, rc) \
+    Ca = KV_XOR5(A##ba, A##ga, A##ka, A##ma, A##sa); \
+    Ce = KV_XOR5(A##be, A##ge, A##ke, A##me, A##se); \
+    Ci = KV_XOR5(A##bi, A##gi, A##ki, A##mi, A##si); \
+    Co = KV_XOR5(A##bo, A##go, A##ko, A##mo, A##so); \
+    Cu = KV_XOR5(A##bu, A##gu, A##ku, A##mu, A##su); \
+    Da = KV_XOR(Cu, KV_ROL(Ce, 1)); \
+    De = KV_XOR(Ca, KV_ROL(Ci, 1)); \
+    Di = KV_XOR(Ce, KV_ROL(Co, 1)); \
+    Do = KV_XOR(Ci, KV_ROL(Cu, 1)); \
+    Du = KV_XOR(Co, KV_ROL(Ca, 1)); \
+    Bba = KV_XOR(A##ba, Da); \
+    Bbe = KV_ROL(KV_XOR(A##ge, De), 44); \
+    Bbi = KV_ROL(KV_XOR(A##ki, Di), 43); \
+    Bbo = KV_ROL(KV_XOR(A##mo, Do), 21); \
+    Bbu = KV_ROL(KV_XOR(A##su, Du), 14); \
+    E##ba = KV_CHI(Bba, Bbe, Bbi); \
+    E##be = KV_CHI(Bbe, Bbi, Bbo); \
+    E##bi = KV_CHI(Bbi, Bbo, Bbu); \
+    E##bo = KV_CHI(Bbo, Bbu, Bba); \
+    E##bu = KV_CHI(Bbu, Bba, Bbe); \
+    E##ba = KV_XOR(E##ba, KV_SET1(rc)); \
+    Bga = KV_ROL(KV_XOR(A##bo, Do), 28); \
+    Bge = KV_ROL(KV_XOR(A##gu, Du), 20); \
+    Bgi = KV_ROL(KV_XOR(A##ka, Da), 3); \
+    Bgo = KV_ROL(KV_XOR(A##me, De), 45); \
+    Bgu = KV_ROL(KV_XOR(A##si, Di), 61); \
+    E##ga = KV_CHI(Bga, Bge, Bgi); \
+    E##ge = KV_CHI(Bge, Bgi, Bgo); \
+    E##gi = KV_CHI(Bgi, Bgo, Bgu); \
+    E##go = KV_CHI(Bgo, Bgu, Bga); \
+    E##gu = KV_CHI(Bgu, Bga, Bge); \
+    Bka = KV_ROL(KV_XOR(A##be, De), 1); \
+    Bke = KV_ROL(KV_XOR(A##gi, Di), 6); \
+    Bki = KV_ROL(KV_XOR(A##ko, Do), 25); \
+    Bko = KV_ROL(KV_XOR(A##mu, Du), 8); \
+    Bku = KV_ROL(KV_XOR(A##sa, Da), 18); \
+    E##ka = KV_CHI(Bka, Bke, Bki); \
+    E##ke = KV_CHI(Bke, Bki, Bko); \
+    E##ki = KV_CHI(Bki, Bko, Bku); \
+    E##ko = KV_CHI(Bko, Bku, Bka); \
+    E##ku = KV_CHI(Bku, Bka, Bke); \
+    Bma = KV_ROL(KV_XOR(A##bu, Du), 27); \
+    Bme = KV_ROL(KV_XOR(A##ga, Da), 36); \
+    Bmi = KV_ROL(KV_XOR(A##ke, De), 10); \
+    Bmo = KV_ROL(KV_XOR(A##mi, Di), 15); \
+    Bmu = KV_ROL(KV_XOR(A##so, Do), 56); \
+    E##ma = KV_CHI(Bma, Bme, Bmi); \
+    E##me = KV_CHI(Bme, Bmi, Bmo); \
+    E##mi = KV_CHI(Bmi, Bmo, Bmu); \
+    E##mo = KV_CHI(Bmo, Bmu, Bma); \
+    E##mu = KV_CHI(Bmu, Bma, Bme); \
+    Bsa = KV_ROL(KV_XOR(A##bi, Di), 62); \
+    Bse = KV_ROL(KV_XOR(A##go, Do), 55); \
+    Bsi = KV_ROL(KV_XOR(A##ku, Du), 39); \
+    Bso = KV_ROL(KV_XOR(A##ma, Da), 41); \
+    Bsu = KV_ROL(KV_XOR(A##se, De), 2); \
+    E##sa = KV_CHI(Bsa, Bse, Bsi); \
+    E##se = KV_CHI(Bse, Bsi, Bso); \
+    E##si = KV_CHI(Bsi, Bso, Bsu); \
+    E##so = KV_CHI(Bso, Bsu, Bsa); \
+    E##su = KV_CHI(Bsu, Bsa, Bse);
+
+#define KECCAK_PERMUTE(T, ROUND, LOAD, STORE, st) \
+    T Ca, Ce, Ci, Co, Cu; \
+    T Da, De, Di, Do, Du; \
+    T Bba, Bbe, Bbi, Bbo, Bbu; \
+    T Bga, Bge, Bgi, Bgo, Bgu; \
+    T Bka, Bke, Bki, Bko, Bku; \
+    T Bma, Bme, Bmi, Bmo, Bmu; \
+    T Bsa, Bse, Bsi, Bso, Bsu; \
+    KECCAK_DECLARE(T, A); \
+    KECCAK_DECLARE(T, E); \
+    int r; \
+    LOAD(A, st); \
+    for (r = 0; r < KECCAKF_ROUNDS; r += 2) { \
+        ROUND(A, E, keccakf1600_rndc[r]); \
+        ROUND(E, A, keccakf1600_rndc[r + 1]); \
+    } \
+    STORE(A, st)
+
+// Lane complementing: lanes be, bi, go, ki, mi, sa are kept inverted during
+// permutation, so chi needs only 6 NOT operations per round instead of 25.
+static inline void keccakf1600_complement(uint64_t st[25])
+{
+    st[1] = ~st[1];
+    st[2] = ~st[2];
+    st[8] = ~st[8];
+    st[12] = ~st[12];
+    st[17] = ~st[17];
+    st[20] = ~st[20];
+}
+
+static void keccakf1600_lc(uint64_t st[25])
+{
+    keccakf1600_complement(st);
+    {
+        KECCAK_PERMUTE(uint64_t, KECCAK_ROUND_LC, KECCAK_LOAD, KECCAK_STORE, st);
+    }
+    keccakf1600_complement(st);
+}
+
+#ifdef KECCAKF1600_X86
+// Same code as above without lane complementing, compiler emits ANDN for chi
+// and RORX for rotations
+__attribute__((target("bmi,bmi2")))
+static void keccakf1600_bmi2(uint64_t st[25])
+{
+    KECCAK_PERMUTE(uint64_t, KECCAK_ROUND, KECCAK_LOAD, KECCAK_STORE, st);
+}
+#endif
+
+#ifdef KECCAKF1600_X86
+#define KV_LOAD(st, i) _mm256_loadu_si256((const __m256i*) ((st) + (i)*4))
+#define KV_STORE(st, i, v) _mm256_storeu_si256((__m256i*) ((st) + (i)*4), v)
+#define KV_XOR(a, b) _mm256_xor_si256(a, b)
+#define KV_XOR5(a, b, c, d, e) KV_XOR(KV_XOR(KV_XOR(a, b), KV_XOR(c, d)), e)
+#define KV_ROL(a, n) _mm256_or_si256(_mm256_slli_epi64(a, n), _mm256_srli_epi64(a, 64 - (n)))
+#define KV_CHI(a, b, c) _mm256_xor_si256(a, _mm256_andnot_si256(b, c))
+#define KV_SET1(x) _mm256_set1_epi64x((long long) (x))
+
+__attribute__((target("avx2")))
+static void keccakf1600x4_avx2(uint64_t *st)
+{
+    KECCAK_PERMUTE(__m256i, KECCAK_ROUND_V, KECCAK_LOAD_V, KECCAK_STORE_V, st);
+}
+
+#undef KV_LOAD
+#undef KV_STORE
+#undef KV_XOR
+#undef KV_XOR5
+#undef KV_ROL
+#undef KV_CHI
+#undef KV_SET1
+
+// AVX-512 has native rotation and three-input logic (0x96 is a^b^c,
+// 0xD2 is a^(~b&c))
+#define KV_LOAD(st, i) _mm512_loadu_si512((const void*) ((st) + (i)*8))
+#define KV_STORE(st, i, v) _mm512_storeu_si512((void*) ((st) + (i)*8), v)
+#define KV_XOR(a, b) _mm512_xor_si512(a, b)
+#define KV_XOR5(a, b, c, d, e) _mm512_ternarylogic_epi64(_mm512_ternarylogic_epi64(a, b, c, 0x96), d, e, 0x96)
+#define KV_ROL(a, n) _mm512_rol_epi64(a, n)
+#define KV_CHI(a, b, c) _mm512_ternarylogic_epi64(a, b, c, 0xD2)
+#define KV_SET1(x) _mm512_set1_epi64((long long) (x))
+
+__attribute__((target("avx512f")))
+static void keccakf1600x8_avx512(uint64_t *st)
+{
+    KECCAK_PERMUTE(__m512i, KECCAK_ROUND_V, KECCAK_LOAD_V, KECCAK_STORE_V, st);
+}
+#endif
+
+// Known answer test against reference implementation
+static int keccakf1600_selftest(keccakf1600_fn *fn)
+{
+    uint64_t st[25];
+    uint64_t ref[25];
+    int i;
+
+    // Keccak-f[1600] of zero state
+    memset(st, 0, sizeof(st));
+    fn(st);
+    if (st[0] != 0xF1258F7940E1DDE7 || st[24] != 0xEAF1FF7B5CECA249)
+        return 0;
+
+    // Arbitrary state, compare with reference
+    for (i = 0; i < 25; i++)
+        st[i] = ref[i] = (uint64_t) (i + 1) * 0x9E3779B97F4A7C15;
+    fn(st);
+    sha3_keccakf_ref(ref);
+    return memcmp(st, ref, sizeof(st)) == 0;
+}
+
+#ifdef KECCAKF1600_X86
+// Every instance of multi-buffer permutation must match reference
+static int keccakf1600xn_selftest(keccakf1600xn_fn *fn, unsigned n)
+{
+    uint64_t st[25*8];
+    uint64_t ref[25];
+    unsigned i, j;
+
+    for (i = 0; i < 25; i++) {
+        for (j = 0; j < n; j++)
+            st[i*n + j] = (uint64_t) (i + 1) * 0x9E3779B97F4A7C15 + j;
+    }
+    fn(st);
+
+    for (j = 0; j < n; j++) {
+        for (i = 0; i < 25; i++)
+            ref[i] = (uint64_t) (i + 1) * 0x9E3779B97F4A7C15 + j;
+        sha3_keccakf_ref(ref);
+        for (i = 0; i < 25; i++) {
+            if (st[i*n + j] != ref[i])
+                return 0;
+        }
+    }
+
+    return 1;
+}
+#endif
+
+keccakf1600_fn *keccakf1600_select(void)
+{
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    return sha3_keccakf_ref;
+#else
+#ifdef KECCAKF1600_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("bmi2") && keccakf1600_selftest(keccakf1600_bmi2))
+        return keccakf1600_bmi2;
+#endif
+    if (keccakf1600_selftest(keccakf1600_lc))
+        return keccakf1600_lc;
+    return sha3_keccakf_ref;
+#endif
+}
+
+keccakf1600xn_fn *keccakf1600xn_select(unsigned *n)
+{
+#ifdef KECCAKF1600_X86
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && keccakf1600xn_selftest(keccakf1600x8_avx512, 8)) {
+        *n = 8;
+        return keccakf1600x8_avx512;
+    }
+    if (__builtin_cpu_supports("avx2") && keccakf1600xn_selftest(keccakf1600x4_avx2, 4)) {
+        *n = 4;
+        return keccakf1600x4_avx2;
+    }
+#endif
+#endif
+    *n = 1;
+    return 0;
+}
+
+unsigned keccakf1600_kernels(keccakf1600_kernel *kernels, unsigned max)
+{
+    keccakf1600_kernel all[5];
+    unsigned count = 0;
+    unsigned i;
+
+    all[count].name = "ref"; all[count].fn = sha3_keccakf_ref; all[count++].n = 1;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    all[count].name = "lc"; all[count].fn = keccakf1600_lc; all[count++].n = 1;
+#ifdef KECCAKF1600_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("bmi2")) {
+        all[count].name = "bmi2"; all[count].fn = keccakf1600_bmi2; all[count++].n = 1;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        all[count].name = "avx2x4"; all[count].fn = keccakf1600x4_avx2; all[count++].n = 4;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        all[count].name = "avx512x8"; all[count].fn = keccakf1600x8_avx512; all[count++].n = 8;
+    }
+#endif
+#endif
+
+    for (i = 0; i < count && i < max; i++)
+        kernels[i] = all[i];
+    return i;
+}
+
+// Permutation is selected on first call; concurrent first calls store
+// the same pointer, relaxed atomic access is enough
+
+static void keccakf1600_resolve(uint64_t st[25]);
+static keccakf1600_fn *keccakf1600_impl = keccakf1600_resolve;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define KECCAKF1600_IMPL_LOAD() __atomic_load_n(&keccakf1600_impl, __ATOMIC_RELAXED)
+#define KECCAKF1600_IMPL_STORE(fn) __atomic_store_n(&keccakf1600_impl, fn, __ATOMIC_RELAXED)
+#else
+// Aligned pointer sized volatile access is atomic with MSVC
+#define KECCAKF1600_IMPL_LOAD() (*(keccakf1600_fn * volatile *) &keccakf1600_impl)
+#define KECCAKF1600_IMPL_STORE(fn) (*(keccakf1600_fn * volatile *) &keccakf1600_impl = (fn))
+#endif
+
+static void keccakf1600_resolve(uint64_t st[25])
+{
+    keccakf1600_fn *fn = keccakf1600_select();
+    KECCAKF1600_IMPL_STORE(fn);
+    fn(st);
+}
+
+void sha3_keccakf(uint64_t st[25])
+{
+    KECCAKF1600_IMPL_LOAD()(st);
+}
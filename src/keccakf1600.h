@@ -0,0 +1,40 @@
+/* 
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+// keccakf1600.h
+// Keccak-f[1600] implementations with runtime CPU dispatch
+
+#ifndef KECCAKF1600_H
+#define KECCAKF1600_H
+
+#include <stdint.h>
+
+typedef void keccakf1600_fn(uint64_t st[25]);
+
+// Returns fastest permutation passed known answer test on current CPU,
+// sha3_keccakf dispatches to it
+keccakf1600_fn *keccakf1600_select(void);
+
+// Multi-buffer permutation of N independent states stored interleaved:
+// lane i of state j is st[i*N + j]
+typedef void keccakf1600xn_fn(uint64_t *st);
+
+// Returns widest multi-buffer permutation (N = 8 for AVX-512, 4 for AVX2)
+// and writes N to *n; returns NULL and N = 1 if there is no SIMD support
+keccakf1600xn_fn *keccakf1600xn_select(unsigned *n);
+
+// Permutation usable on current CPU: reference, unrolled and SIMD ones.
+// Single state permutation has n = 1
+typedef struct {
+    const char *name;
+    keccakf1600xn_fn *fn;
+    unsigned n;
+} keccakf1600_kernel;
+
+// Writes up to max kernels supported by current CPU, returns their number;
+// known answer tests run SHA3 through each of them
+unsigned keccakf1600_kernels(keccakf1600_kernel *kernels, unsigned max);
+
+#endif
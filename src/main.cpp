@@ -4,29 +4,43 @@ extern "C" {
 }
 
 #include "cxx-pm.h"
+#include "buildLog.h"
+#include "distrCache.h"
+#include "downloader.h"
 #include "exec.h"
+#include "extract.h"
+#include "hashCache.h"
+#include "manifestIndex.h"
 #include "strExtras.h"
 #include "compilers/common.h"
 #include "bs/cmake.h"
 #include "os.h"
 #include "package.h"
 #include "sha3.h"
+#include "sourceCache.h"
+#include "json/json11.hpp"
 
 #ifdef WIN32
 #include <Windows.h>
 #endif
 
+#include <errno.h>
 #include <getopt.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <array>
+#include <condition_variable>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <map>
+#include <mutex>
 #include <optional>
 #include <set>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -53,6 +67,16 @@ enum CmdLineOptsTy {
   clOptPackageRoot,
   clOptPackageExtraDirectory,
   clOptFile,
+  clOptHashCache,
+  clOptPathCache,
+  clOptManifestHash,
+  clOptDownloadTimeout,
+  clOptExtractTimeout,
+  clOptBuildTimeout,
+  clOptQuiet,
+  clOptFetchOnly,
+  clOptDistrGc,
+  clOptDistrQuota,
   clOptVerbose,
   clOptVersion
 };
@@ -61,7 +85,8 @@ enum EModeTy {
   ENoMode = 0,
   EPackageList,
   ESearchPath,
-  EInstall
+  EInstall,
+  EDistrGc
 };
 
 static option cmdLineOpts[] = {
@@ -83,6 +108,7 @@ static option cmdLineOpts[] = {
   {"search-path-type", required_argument, nullptr, clOptSearchPathType},
   {"install", required_argument, nullptr, clOptInstall},
   {"export-cmake", required_argument, nullptr, clOptExportCMake},
+  {"distr-gc", no_argument, nullptr, clOptDistrGc},
   {"version", no_argument, nullptr, clOptVersion},
   // extra parameters
   {"package-root", required_argument, nullptr, clOptPackageRoot},
@@ -90,22 +116,47 @@ static option cmdLineOpts[] = {
   // arguments
   {"file", required_argument, nullptr, clOptFile},
   // other
+  {"hash-cache", no_argument, nullptr, clOptHashCache},
+  {"path-cache", no_argument, nullptr, clOptPathCache},
+  {"manifest-hash", required_argument, nullptr, clOptManifestHash},
+  {"download-timeout", required_argument, nullptr, clOptDownloadTimeout},
+  {"extract-timeout", required_argument, nullptr, clOptExtractTimeout},
+  {"build-timeout", required_argument, nullptr, clOptBuildTimeout},
+  {"quiet", no_argument, nullptr, clOptQuiet},
+  {"fetch-only", no_argument, nullptr, clOptFetchOnly},
+  {"distr-quota", required_argument, nullptr, clOptDistrQuota},
   {"verbose", no_argument, nullptr, clOptVerbose},
   {nullptr, 0, nullptr, 0}
 };
 
+class SourcePrefetcher;
+
 struct CContext {
   CxxPmSettings GlobalSettings;
   CSystemInfo SystemInfo;
   CompilersArray Compilers;
   ToolsArray Tools;
+  // Background fetch of sources of all installing packages, optional
+  SourcePrefetcher *Prefetcher = nullptr;
+};
+
+// Resources used by child processes on each installation phase
+struct CPackageBuildStats {
+  CProcessStats Download;
+  CProcessStats Extract;
+  CProcessStats Build;
 };
 
+// Archive downloads of all packages reuse connections
+static Downloader gDownloader;
+// Sources fetched concurrently in background
+static constexpr unsigned prefetchThreads = 4;
+// Installed prefix lists DistrDir items it was built from, see distrCache.h
+static const char distrReferencesName[] = "distr-items.txt";
+
 bool loadVariables(const std::filesystem::path &path, const std::vector<std::string> &names, std::vector<std::string> &variables)
 {
-  std::string capturedOut;
   std::string capturedErr;
-  std::filesystem::path fullPath;
   std::string args;
 
   args = "set -e; source ";
@@ -117,18 +168,19 @@ bool loadVariables(const std::filesystem::path &path, const std::vector<std::str
     args.append("@; ");
   }
 
-  if (!run(path.parent_path(), "bash", {"-c", args}, {}, fullPath, capturedOut, capturedErr, true)) {
-    if (!fullPath.empty())
-      fprintf(stderr, "%s\n", capturedErr.c_str());
-    return false;
-  }
+  bool result = runStreamLines(path.parent_path(), "bash", {"-c", args}, {}, [&](EOutputStream stream, std::string_view line) {
+    if (stream == EOutputStream::StdErr) {
+      capturedErr.append(line);
+      capturedErr.push_back('\n');
+    } else if (!line.empty() && line.back() == '@') {
+      variables.emplace_back(line.begin(), line.end()-1);
+    }
+    return true;
+  }, true, true);
 
-  StringSplitter splitter(capturedOut, "\r\n");
-  while (splitter.next()) {
-    auto v = splitter.get();
-    if (v.back() != '@')
-      continue;
-    variables.emplace_back(v.begin(), v.end()-1);
+  if (!result) {
+    fputs(capturedErr.c_str(), stderr);
+    return false;
   }
 
   return names.size() == variables.size();
@@ -136,9 +188,7 @@ bool loadVariables(const std::filesystem::path &path, const std::vector<std::str
 
 bool loadSingleVariable(const std::filesystem::path &path, const std::string &name, std::string &variable)
 {
-  std::string capturedOut;
   std::string capturedErr;
-  std::filesystem::path fullPath;
   std::string args;
 
   args = "set -e; source ";
@@ -147,33 +197,23 @@ bool loadSingleVariable(const std::filesystem::path &path, const std::string &na
   args.append(name);
   args.append(";");
 
-  if (!run(path.parent_path(), "bash", {"-c", args}, {}, fullPath, capturedOut, capturedErr, true)) {
-    if (!fullPath.empty())
-      fprintf(stderr, "%s\n", capturedErr.c_str());
-    return false;
-  }
-
-  unsigned counter = 0;
-  StringSplitter splitter(capturedOut, "\r\n");
-  if (splitter.next())
-    variable = std::string(splitter.get());
-  return !splitter.next();
-}
+  unsigned linesNum = 0;
+  bool result = runStreamLines(path.parent_path(), "bash", {"-c", args}, {}, [&](EOutputStream stream, std::string_view line) {
+    if (stream == EOutputStream::StdErr) {
+      capturedErr.append(line);
+      capturedErr.push_back('\n');
+    } else if (!line.empty() && linesNum++ == 0) {
+      variable = std::string(line);
+    }
+    return true;
+  }, true, true);
 
-bool packageQueryVersion(CPackage &package, const std::string &requestedVersion, bool verbose)
-{
-  // Load default version from meta build
-  std::string version = requestedVersion;
-  if (!loadSingleVariable(package.Path / "meta.build", "DEFAULT_VERSION", version)) {
-    fprintf(stderr, "ERROR: can't load DEFAULT_VERSION from %s\n", (package.Path / "meta.build").string().c_str());
+  if (!result) {
+    fputs(capturedErr.c_str(), stderr);
     return false;
-  } else {
-    if (verbose)
-      printf("Default version for %s is %s\n", package.Name.c_str(), version.c_str());
   }
 
-  package.Version = version;
-  return true;
+  return linesNum <= 1;
 }
 
 bool locatePackageBuildFile(CPackage &package)
@@ -193,28 +233,53 @@ bool locatePackageBuildFile(CPackage &package)
   return false;
 }
 
-bool inspectPackage(const CContext &context, CPackage &package, const std::string &requestedVersion, bool verbose)
-{
-  if (!packageQueryVersion(package, requestedVersion, verbose))
-    return false;
+// Bash probe printing variables of build file, each as "<value>@" line. Probes of several
+// packages run concurrently in executor, output is collected by its event loop thread
+struct CVariablesProbe {
+  std::string StdOut;
+  std::string StdErr;
+  std::future<CProcessResult> Result;
+};
 
-  if (!locatePackageBuildFile(package)) {
-    fprintf(stderr, "ERROR: package %s doen not contains build file for version %s\n", package.Name.c_str(), package.Version.c_str());
-    return false;
+static void launchVariablesProbe(ProcessExecutor &executor,
+                                 const std::filesystem::path &path,
+                                 const std::vector<std::string> &names,
+                                 CVariablesProbe &probe)
+{
+  std::string args = "set -e; source ";
+  args.append(pathConvert(path, EPathType::Posix).string());
+  args.append("; ");
+  for (const auto &v: names) {
+    args.append("echo $");
+    args.append(v);
+    args.append("@; ");
   }
 
-  // Query package compilers
-  std::vector<std::string> variables;
-  std::string packageTypeVariable;
-  std::string compilersVariable;
-  if (!loadVariables(package.BuildFile, { "PACKAGE_TYPE", "LANGS" }, variables)) {
-    fprintf(stderr, "ERROR: can't load PACKAGE_TYPE, LANGS variables from %s\n", package.BuildFile.string().c_str());
+  probe.Result = executor.launch(path.parent_path(), "bash", {"-c", args}, {}, [&probe](EOutputStream stream, const char *data, size_t size) {
+    (stream == EOutputStream::StdErr ? probe.StdErr : probe.StdOut).append(data, size);
+    return true;
+  }, true, true);
+}
+
+static bool finishVariablesProbe(CVariablesProbe &probe, size_t count, std::vector<std::string> &variables)
+{
+  if (!probe.Result.get().Success) {
+    fputs(probe.StdErr.c_str(), stderr);
     return false;
   }
 
-  packageTypeVariable = variables[0];
-  compilersVariable = variables[1];
+  variables.clear();
+  StringSplitter splitter(probe.StdOut, "\r\n");
+  while (splitter.next()) {
+    std::string_view line = splitter.get();
+    if (!line.empty() && line.back() == '@')
+      variables.emplace_back(line.begin(), line.end()-1);
+  }
+  return variables.size() == count;
+}
 
+static bool applyPackageType(CPackage &package, const std::string &packageTypeVariable, const std::string &compilersVariable)
+{
   // Check package type
   if (packageTypeVariable.empty()) {
     fprintf(stderr, "ERROR: package type not specified in %s\n", package.BuildFile.string().c_str());
@@ -250,191 +315,643 @@ bool inspectPackage(const CContext &context, CPackage &package, const std::strin
   }
 }
 
+// Default versions of all packages are queried at once, then types and languages from their
+// build files
+bool inspectPackages(const CContext &context, const std::vector<CPackage*> &packages, const std::string &requestedVersion, bool verbose)
+{
+  ProcessExecutor executor;
+  std::vector<CVariablesProbe> probes(packages.size());
+  std::vector<std::string> variables;
+  for (size_t i = 0; i < packages.size(); i++)
+    launchVariablesProbe(executor, packages[i]->Path / "meta.build", {"DEFAULT_VERSION"}, probes[i]);
+
+  bool success = true;
+  for (size_t i = 0; i < packages.size(); i++) {
+    CPackage &package = *packages[i];
+    if (!finishVariablesProbe(probes[i], 1, variables)) {
+      fprintf(stderr, "ERROR: can't load DEFAULT_VERSION from %s\n", (package.Path / "meta.build").string().c_str());
+      success = false;
+      continue;
+    }
+
+    package.Version = variables[0].empty() ? requestedVersion : variables[0];
+    if (verbose && !variables[0].empty())
+      printf("Default version for %s is %s\n", package.Name.c_str(), package.Version.c_str());
+    if (!locatePackageBuildFile(package)) {
+      fprintf(stderr, "ERROR: package %s doen not contains build file for version %s\n", package.Name.c_str(), package.Version.c_str());
+      success = false;
+    }
+  }
+  if (!success)
+    return false;
+
+  // Query package compilers
+  probes = std::vector<CVariablesProbe>(packages.size());
+  for (size_t i = 0; i < packages.size(); i++)
+    launchVariablesProbe(executor, packages[i]->BuildFile, {"PACKAGE_TYPE", "LANGS"}, probes[i]);
+
+  for (size_t i = 0; i < packages.size(); i++) {
+    CPackage &package = *packages[i];
+    if (!finishVariablesProbe(probes[i], 2, variables)) {
+      fprintf(stderr, "ERROR: can't load PACKAGE_TYPE, LANGS variables from %s\n", package.BuildFile.string().c_str());
+      success = false;
+      continue;
+    }
+    success &= applyPackageType(package, variables[0], variables[1]);
+  }
+  return success;
+}
+
+bool inspectPackage(const CContext &context, CPackage &package, const std::string &requestedVersion, bool verbose)
+{
+  return inspectPackages(context, {&package}, requestedVersion, verbose);
+}
+
 void updatePackagePrefix(const CContext &context, CPackage &package, const std::string &buildType, bool verbose)
 {
   package.Prefix = packagePrefix(context.GlobalSettings.HomeDir, package, context.Compilers, context.SystemInfo, buildType, verbose);
 }
 
-void createManifestForDirectory(FILE *hLog, const std::filesystem::path &directory, const std::filesystem::path &relativePath)
+static void listDirectoryFiles(const std::filesystem::path &directory, const std::filesystem::path &relativePath, std::vector<std::filesystem::path> &files, std::vector<std::filesystem::path> &relativePaths)
 {
   for(const auto &element: std::filesystem::directory_iterator{directory}) {
     if (element.is_directory()) {
-      createManifestForDirectory(hLog, element, relativePath / element.path().filename());
+      listDirectoryFiles(element, relativePath / element.path().filename(), files, relativePaths);
     } else {
-      std::string hash = sha3FileHash(element);
-      fprintf(hLog, "%s!%s\n", (relativePath / element.path().filename()).string().c_str(), hash.c_str());
+      files.push_back(element);
+      relativePaths.push_back(relativePath / element.path().filename());
     }
   }
 }
 
-bool downloadPackageFiles(const CContext& context,
-                          const CPackage& package,
-                          const std::filesystem::path &sourceDir,
-                          const std::filesystem::path &binaryInstallDir)
+void createManifestForDirectory(FILE *hLog, const std::filesystem::path &directory, const std::filesystem::path &relativePath, EHashAlgorithm algorithm)
 {
-  std::string type;
-  std::string url;
-  std::string sha3;
-  std::string tag;
-  std::string commit;
-  std::filesystem::path destination;
-  if (!package.IsBinary) {
-    std::vector<std::string> variables;
-    if (!loadVariables(package.BuildFile, { "TYPE", "URL", "SHA3", "TAG", "COMMIT" }, variables)) {
-      fprintf(stderr, "ERROR, can't load TYPE, URL, SHA3, TAG, COMMIT from %s\n", package.BuildFile.string().c_str());
-      return false;
-    }
+  // Collect all files first, small ones are hashed together
+  std::vector<std::filesystem::path> files;
+  std::vector<std::filesystem::path> relativePaths;
+  std::vector<std::string> hashes;
+  listDirectoryFiles(directory, relativePath, files, relativePaths);
+  filesHash(algorithm, files, hashes);
+  // Manifests without header are SHA3 ones
+  if (algorithm != EHashAlgorithm::SHA3)
+    fprintf(hLog, "!hash=%s\n", hashAlgorithmName(algorithm));
+  for (size_t i = 0, ie = files.size(); i != ie; ++i)
+    fprintf(hLog, "%s!%s\n", relativePaths[i].string().c_str(), hashes[i].c_str());
+}
 
-    type = std::move(variables[0]);
-    url = std::move(variables[1]);
-    sha3 = std::move(variables[2]);
-    tag = std::move(variables[3]);
-    commit = std::move(variables[4]);
-    destination = sourceDir;
-  } else {
-    std::vector<std::string> variableNames;
-    std::vector<std::string> variables;
-    std::string namePrefix = context.SystemInfo.HostSystemName + "_" + context.SystemInfo.HostSystemProcessor + "_";
-    for (const auto &name : { "TYPE", "URL", "SHA3", "TAG", "COMMIT" })
-      variableNames.emplace_back(namePrefix + name);
+// Reads optional "!hash=<algorithm>" first line of manifest
+static EHashAlgorithm readManifestHeader(std::istream &hManifest)
+{
+  if (hManifest.peek() != '!')
+    return EHashAlgorithm::SHA3;
+
+  std::string line;
+  std::getline(hManifest, line);
+  if (!startsWith(line, "!hash="))
+    return EHashAlgorithm::Unknown;
+  return hashAlgorithmFromString(line.substr(6));
+}
 
-    if (!loadVariables(package.BuildFile, variableNames, variables)) {
-      fprintf(stderr, "ERROR, can't load TYPE, URL, SHA3, TAG, COMMIT from %s\n", package.BuildFile.string().c_str());
-      return false;
-    }
+// Source of package from its build file
+struct CPackageSource {
+  std::string Type;
+  std::string Url;
+  std::string Sha3;
+  std::string Tag;
+  std::string Commit;
+  // Patches from package directory applied to extracted archive in PatchDir, extracted and
+  // patched tree is cached by CacheKey
+  std::string PatchDir;
+  std::vector<std::filesystem::path> Patches;
+  std::string CacheKey;
+  // Directories of git repository needed by build, other files are not fetched
+  std::vector<std::string> SparseCheckout;
+};
 
-    type = std::move(variables[0]);
-    url = std::move(variables[1]);
-    sha3 = std::move(variables[2]);
-    destination = binaryInstallDir;
+static bool loadPackageSource(const CContext &context, const CPackage &package, CPackageSource &source)
+{
+  std::vector<std::string> variableNames;
+  std::vector<std::string> variables;
+  // Binary packages have source for each host
+  std::string namePrefix = package.IsBinary ? context.SystemInfo.HostSystemName + "_" + context.SystemInfo.HostSystemProcessor + "_" : "";
+  for (const auto &name : { "TYPE", "URL", "SHA3", "TAG", "COMMIT", "PATCH_DIR", "PATCHES", "SPARSE_CHECKOUT" })
+    variableNames.emplace_back(namePrefix + name);
+
+  if (!loadVariables(package.BuildFile, variableNames, variables)) {
+    fprintf(stderr, "ERROR, can't load TYPE, URL, SHA3, TAG, COMMIT, PATCH_DIR, PATCHES, SPARSE_CHECKOUT from %s\n", package.BuildFile.string().c_str());
+    return false;
   }
 
-  printf("Downloading package %s:%s\n", package.Name.c_str(), package.Version.c_str());
-  if (type == "archive") {
-    if (url.empty()) {
-      fprintf(stderr, "ERROR: URL must be specified for 'archive'\n");
-      return false;
-    }
-    if (sha3.size() != 64) {
-      fprintf(stderr, "ERROR: SHA3 256 bit hash must be specified for 'archive'\n");
-      return false;
-    }
+  source.Type = std::move(variables[0]);
+  source.Url = std::move(variables[1]);
+  source.Sha3 = std::move(variables[2]);
+  if (!package.IsBinary) {
+    source.Tag = std::move(variables[3]);
+    source.Commit = std::move(variables[4]);
+    source.PatchDir = std::move(variables[5]);
+    StringSplitter splitter(variables[6], " \t");
+    while (splitter.next())
+      source.Patches.push_back(package.BuildFile.parent_path() / std::string(splitter.get()));
+    if (source.Type == "archive" && source.Sha3.size() == 64)
+      source.CacheKey = sourceCacheKey(source.Sha3, source.PatchDir, source.Patches);
+    StringSplitter sparseSplitter(variables[7], " \t");
+    while (sparseSplitter.next())
+      source.SparseCheckout.emplace_back(sparseSplitter.get());
+  }
+  return true;
+}
 
-    // get file name from url
-    size_t pos = 0;
-    size_t nextPos;
-    while ((nextPos = url.find('/', pos)) != url.npos)
-      pos = nextPos + 1;
-    if (url.size() - pos < 2) {
-      fprintf(stderr, "ERROR: invalid url: %s\n", url.c_str());
-      return false;
-    }
-    std::filesystem::path archiveFilePath = context.GlobalSettings.DistrDir / (url.data() + pos);
+// Archive is stored in DistrDir with file name from url
+static bool archivePath(const CxxPmSettings &settings, const CPackageSource &source, std::filesystem::path &path)
+{
+  if (source.Url.empty()) {
+    fprintf(stderr, "ERROR: URL must be specified for 'archive'\n");
+    return false;
+  }
+  if (source.Sha3.size() != 64) {
+    fprintf(stderr, "ERROR: SHA3 256 bit hash must be specified for 'archive'\n");
+    return false;
+  }
+
+  // get file name from url
+  size_t pos = 0;
+  size_t nextPos;
+  while ((nextPos = source.Url.find('/', pos)) != source.Url.npos)
+    pos = nextPos + 1;
+  if (source.Url.size() - pos < 2) {
+    fprintf(stderr, "ERROR: invalid url: %s\n", source.Url.c_str());
+    return false;
+  }
 
-    // Check presence & hash
-    bool fileExists = false;
-    if (std::filesystem::exists(archiveFilePath)) {
+  path = settings.DistrDir / (source.Url.data() + pos);
+  return true;
+}
+
+// Bare mirror of git repository in DistrDir, clones take objects from it
+static std::filesystem::path gitMirrorPath(const CxxPmSettings &settings, const std::string &url)
+{
+  std::string name = url;
+  while (!name.empty() && name.back() == '/')
+    name.pop_back();
+  name = name.substr(name.find_last_of("/:") + 1);
+  if (endsWith(name, ".git"))
+    name.resize(name.size() - 4);
+  return settings.DistrDir / "git" / (name + "-" + sha3StringHash(url).substr(0, 16) + ".git");
+}
+
+// Extracted and patched archives, see sourceCache.h
+static std::filesystem::path sourceCacheDir(const CxxPmSettings &settings)
+{
+  return settings.DistrDir / "src";
+}
+
+// Archive with valid hash recorded in sidecar is ready without hashing
+static bool archiveReady(const std::filesystem::path &path, const std::string &sha3)
+{
+  std::error_code ec;
+  return std::filesystem::exists(path, ec) && hashSidecarCheck(path, "sha3", sha3);
+}
+
+// Puts archive with valid hash to archiveFilePath: checks existing file or downloads it.
+// With unverified existing archive without recorded hash is not hashed here and unverified
+// is set, caller must check its hash (extraction calculates it)
+static bool fetchArchive(const CxxPmSettings &settings,
+                         Downloader &downloader,
+                         const CPackageSource &source,
+                         const std::filesystem::path &archiveFilePath,
+                         CProcessStats *stats,
+                         bool *unverified = nullptr)
+{
+  // Check presence & hash
+  // Archive hash validated earlier is recorded in sidecar file with archive size and mtime
+  if (unverified)
+    *unverified = false;
+  if (std::filesystem::exists(archiveFilePath)) {
+    if (hashSidecarCheck(archiveFilePath, "sha3", source.Sha3)) {
+      printf("Archive %s already exists\n", archiveFilePath.string().c_str());
+      return true;
+    } else if (unverified) {
+      printf("Archive %s already exists\n", archiveFilePath.string().c_str());
+      *unverified = true;
+      return true;
+    } else {
       std::string existingHash = sha3FileHash(archiveFilePath);
       if (existingHash.empty()) {
         fprintf(stderr, "ERROR: can't calculate SHA3 hash of %s\n", archiveFilePath.string().c_str());
         return false;
       }
 
-      if (existingHash == sha3) {
+      if (existingHash == source.Sha3) {
         printf("Archive %s already exists\n", archiveFilePath.string().c_str());
-        fileExists = true;
+        hashSidecarWrite(archiveFilePath, "sha3", source.Sha3);
+        return true;
       }
       else {
-        fprintf(stderr, "SHA3 mismatch: sha3(%s)=%s, required %s\n", archiveFilePath.string().c_str(), existingHash.c_str(), sha3.c_str());
+        fprintf(stderr, "SHA3 mismatch: sha3(%s)=%s, required %s\n", archiveFilePath.string().c_str(), existingHash.c_str(), source.Sha3.c_str());
         if (!std::filesystem::remove(archiveFilePath)) {
           fprintf(stderr, "ERROR: can't delete file %s\n", archiveFilePath.string().c_str());
           return false;
         }
       }
     }
+  }
 
-    if (!fileExists) {
-      // Downloading file
-      if (!runNoCapture(".", "wget", { url, "-O", archiveFilePath.string() }, {}, true)) {
-        fprintf(stderr, "Can't download file %s\n", url.c_str());
-        return false;
-      }
+  // Downloading file to temporary .part file, interrupted download is resumed by next run
+  std::filesystem::path partFilePath = archiveFilePath;
+  partFilePath += ".part";
+  std::string downloadedHash;
+  if (!downloader.download(source.Url, partFilePath, downloadedHash, settings.DownloadTimeout, stats)) {
+    if (!downloader.cancelled())
+      fprintf(stderr, "Can't download file %s\n", source.Url.c_str());
+    return false;
+  }
+
+  if (downloadedHash != source.Sha3) {
+    fprintf(stderr, "SHA3 mismatch: sha3(%s)=%s, required %s\n", archiveFilePath.string().c_str(), downloadedHash.c_str(), source.Sha3.c_str());
+    Downloader::discard(partFilePath);
+    return false;
+  }
 
-      std::string downloadedHash = sha3FileHash(archiveFilePath);
-      if (downloadedHash != sha3) {
-        fprintf(stderr, "SHA3 mismatch: sha3(%s)=%s, required %s\n", archiveFilePath.string().c_str(), downloadedHash.c_str(), sha3.c_str());
+  std::error_code ec;
+  std::filesystem::rename(partFilePath, archiveFilePath, ec);
+  if (ec) {
+    fprintf(stderr, "ERROR: can't rename %s to %s\n", partFilePath.string().c_str(), archiveFilePath.string().c_str());
+    return false;
+  }
+
+  hashSidecarWrite(archiveFilePath, "sha3", source.Sha3);
+  return true;
+}
+
+// Mirror created for pinned sources has only commits fetched with depth 1, without history
+static const char shallowMirrorMarker[] = "cxxpm-shallow";
+
+// git run with inherited stdio. Interactive git may ask for credentials in terminal; background
+// one fails instead, its source is fetched again by interactive foreground install
+static bool runGit(const std::filesystem::path &workingDirectory,
+                   const std::vector<std::string> &arguments,
+                   bool interactive,
+                   CProcessStats *stats = nullptr,
+                   unsigned timeout = 0)
+{
+  static const ProcessEnvironment inheritedEnvironment;
+  static const ProcessEnvironment noPromptEnvironment({ "GIT_TERMINAL_PROMPT=0" });
+  const ProcessEnvironment &environment = interactive ? inheritedEnvironment : noPromptEnvironment;
+  return runNoCapture(workingDirectory, "git", arguments, environment, true, stats, timeout, interactive);
+}
+
+// Full mirror is bare clone of branches and tags, later fetches update them in place (other
+// refs like pull requests are not mirrored). Shallow mirror is created empty. Partial mirror
+// doesn't fetch blobs, checkout fetches blobs of files it needs. Mirror appears under
+// mirrorPath only when complete
+static bool createGitMirror(const CxxPmSettings &settings,
+                            const std::string &url,
+                            const std::filesystem::path &mirrorPath,
+                            bool shallow,
+                            bool partial,
+                            bool interactive,
+                            CProcessStats *stats)
+{
+  std::error_code ec;
+  std::filesystem::path tmpPath = mirrorPath;
+  tmpPath += ".tmp";
+  std::filesystem::remove_all(tmpPath, ec);
+  std::filesystem::create_directories(mirrorPath.parent_path(), ec);
+
+  std::string tmpPathPosix = pathConvert(tmpPath, EPathType::Posix).string();
+  bool success;
+  if (shallow) {
+    success = runGit(".", { "init", "--bare", "--quiet", tmpPathPosix }, interactive) &&
+              runGit(tmpPath, { "remote", "add", "origin", url }, interactive) &&
+              std::ofstream(tmpPath / shallowMirrorMarker).good();
+  } else {
+    std::vector<std::string> args = { "clone", "--bare", "--quiet" };
+    if (partial)
+      args.emplace_back("--filter=blob:none");
+    args.insert(args.end(), { url, tmpPathPosix });
+    success = runGit(".", args, interactive, stats, settings.DownloadTimeout) &&
+              runGit(tmpPath, { "config", "remote.origin.fetch", "+refs/heads/*:refs/heads/*" }, interactive) &&
+              runGit(tmpPath, { "config", "--add", "remote.origin.fetch", "+refs/tags/*:refs/tags/*" }, interactive);
+  }
+
+  if (!success) {
+    fprintf(stderr, "git clone error url: %s\n", url.c_str());
+    std::filesystem::remove_all(tmpPath, ec);
+    return false;
+  }
+
+  std::filesystem::rename(tmpPath, mirrorPath, ec);
+  if (ec) {
+    fprintf(stderr, "ERROR: can't rename %s to %s\n", tmpPath.string().c_str(), mirrorPath.string().c_str());
+    std::filesystem::remove_all(tmpPath, ec);
+    return false;
+  }
+  return true;
+}
+
+// Fetches objects missing in full mirror, shallow mirror becomes full
+static bool updateGitMirror(const CxxPmSettings &settings, const std::string &url, const std::filesystem::path &mirrorPath, bool interactive, CProcessStats *stats)
+{
+  printf("Updating git mirror %s\n", mirrorPath.string().c_str());
+  std::error_code ec;
+  std::vector<std::string> args = { "fetch", "--quiet", "--prune" };
+  if (std::filesystem::exists(mirrorPath / shallowMirrorMarker, ec)) {
+    if (!runGit(mirrorPath, { "config", "remote.origin.fetch", "+refs/heads/*:refs/heads/*" }, interactive) ||
+        !runGit(mirrorPath, { "config", "--add", "remote.origin.fetch", "+refs/tags/*:refs/tags/*" }, interactive))
+      return false;
+    if (std::filesystem::exists(mirrorPath / "shallow", ec))
+      args.emplace_back("--unshallow");
+  }
+
+  args.emplace_back("origin");
+  if (!runGit(mirrorPath, args, interactive, stats, settings.DownloadTimeout)) {
+    fprintf(stderr, "git fetch error url: %s\n", url.c_str());
+    return false;
+  }
+  std::filesystem::remove(mirrorPath / shallowMirrorMarker, ec);
+  return true;
+}
+
+// Commit hash of revision in mirror, false if mirror has no such revision
+static bool resolveGitRevision(const std::filesystem::path &mirrorPath, const std::string &revision, std::string &commit)
+{
+  std::filesystem::path fullPath;
+  std::string stdOut;
+  std::string stdErr;
+  if (!run(mirrorPath, "git", { "rev-parse", "--verify", "--quiet", revision + "^{commit}" }, {}, fullPath, stdOut, stdErr, true))
+    return false;
+  while (!stdOut.empty() && (stdOut.back() == '\n' || stdOut.back() == '\r'))
+    stdOut.pop_back();
+  commit = std::move(stdOut);
+  return commit.size() >= 40;
+}
+
+// Fetches pinned commit or tag to shallow mirror with depth 1, sources with sparse checkout
+// without blobs. Tag name may refer to branch as with "git clone --branch"
+static bool fetchGitShallow(const CxxPmSettings &settings, const CPackageSource &source, const std::filesystem::path &mirrorPath, bool interactive, CProcessStats *stats)
+{
+  std::vector<std::string> refspecs;
+  if (!source.Commit.empty())
+    refspecs.emplace_back("+" + source.Commit + ":refs/commits/" + source.Commit);
+  else
+    refspecs = { "+refs/tags/" + source.Tag + ":refs/tags/" + source.Tag, "+refs/heads/" + source.Tag + ":refs/heads/" + source.Tag };
+  // Branch fetched before is updated without failed attempt to fetch tag
+  std::string commitHash;
+  if (refspecs.size() == 2 && resolveGitRevision(mirrorPath, "refs/heads/" + source.Tag, commitHash))
+    std::swap(refspecs[0], refspecs[1]);
+
+  // Interactive git may ask for credentials, it runs without output capture
+  for (const auto &refspec: refspecs) {
+    std::vector<std::string> args = { "fetch", "--quiet", "--no-tags", "--depth", "1" };
+    if (!source.SparseCheckout.empty())
+      args.emplace_back("--filter=blob:none");
+    args.insert(args.end(), { "origin", refspec });
+    if (runGit(mirrorPath, args, interactive, stats, settings.DownloadTimeout))
+      return true;
+  }
+  return false;
+}
+
+// Puts revision of git source to its mirror and resolves it to commit hash. Sources pinned by
+// TAG or full COMMIT hash get shallow mirror; tags and commits already in mirror need no
+// network access, branches and HEAD are updated. Background prefetch is not interactive,
+// repository requiring credentials is fetched by foreground install then
+static bool fetchGitSource(const CxxPmSettings &settings,
+                           const CPackageSource &source,
+                           const std::filesystem::path &mirrorPath,
+                           std::string &commitHash,
+                           bool interactive,
+                           CProcessStats *stats)
+{
+  const std::string &tag = source.Tag;
+  const std::string &commit = source.Commit;
+  std::string revision = !commit.empty() ? commit : !tag.empty() ? tag : "HEAD";
+  bool shallow = commit.size() == 40 || (commit.empty() && !tag.empty());
+  bool mirrorFetched = false;
+  std::error_code ec;
+  if (!std::filesystem::exists(mirrorPath, ec)) {
+    if (!createGitMirror(settings, source.Url, mirrorPath, shallow, !source.SparseCheckout.empty(), interactive, stats))
+      return false;
+    mirrorFetched = !shallow;
+  }
+
+  bool pinned = !commit.empty() || (!tag.empty() && resolveGitRevision(mirrorPath, "refs/tags/" + tag, commitHash));
+  if (pinned && resolveGitRevision(mirrorPath, revision, commitHash))
+    return true;
+
+  // Server may refuse commit not at tip of ref by hash (uploadpack.allowReachableSHA1InWant
+  // is off), full fetch finds it then
+  if (shallow && std::filesystem::exists(mirrorPath / shallowMirrorMarker, ec)) {
+    if (!fetchGitShallow(settings, source, mirrorPath, interactive, stats)) {
+      fprintf(stderr, "WARNING: shallow fetch failed, fetching full history of %s\n", source.Url.c_str());
+      if (!updateGitMirror(settings, source.Url, mirrorPath, interactive, stats))
         return false;
-      }
     }
+  } else if (!mirrorFetched && !updateGitMirror(settings, source.Url, mirrorPath, interactive, stats)) {
+    return false;
+  }
+  if (resolveGitRevision(mirrorPath, revision, commitHash))
+    return true;
 
-    // Unpacking file
-    // Detect archive type
-    auto archiveFilePathPosix = pathConvert(archiveFilePath, EPathType::Posix);
-    auto destinationPosix = pathConvert(destination, EPathType::Posix);
+  // Commit not reachable from branches and tags is requested by hash
+  if (!commit.empty() &&
+      runGit(mirrorPath, { "fetch", "--quiet", "origin", commit }, interactive, stats, settings.DownloadTimeout) &&
+      resolveGitRevision(mirrorPath, revision, commitHash))
+    return true;
 
-    if (endsWith(archiveFilePathPosix.string(), ".zip")) {
-      if (!runNoCapture(".", "unzip", { archiveFilePathPosix.string(), "-d", destinationPosix.string()}, {}, true)) {
-        fprintf(stderr, "Unpacking error\n");
-        return false;
-      }
-    } else if (endsWith(archiveFilePathPosix.string(), ".tar.gz")) {
-      if (!runNoCapture(".", "tar", { "-xzf", archiveFilePathPosix.string(), "-C", destinationPosix.string() }, {}, true)) {
-        fprintf(stderr, "Unpacking error\n");
-        return false;
-      }
-    } else if (endsWith(archiveFilePathPosix.string(), ".tar.bz2")) {
-      if (!runNoCapture(".", "tar", { "-xjf", archiveFilePathPosix.string(), "-C", destinationPosix.string() }, {}, true)) {
-        fprintf(stderr, "Unpacking error\n");
-        return false;
-      }
-    } else if (endsWith(archiveFilePathPosix.string(), ".tar.lz") || endsWith(archiveFilePathPosix.string(), ".tar.lzma")) {
-        if (!runNoCapture(".", "tar", { "--lzip", "-xvf", archiveFilePathPosix.string(), "-C", destinationPosix.string() }, {}, true)) {
-          fprintf(stderr, "Unpacking error\n");
-          return false;
-        }
-    } else if (endsWith(archiveFilePathPosix.string(), ".tar.zst")) {
-      std::string tmpFileName = archiveFilePathPosix.filename().string();
-      std::filesystem::path tmpFilePath = context.GlobalSettings.DistrDir / ("tmp-" + tmpFileName.substr(0, tmpFileName.size() - 4));
-      std::filesystem::path tmpFilePathPosix = pathConvert(tmpFilePath, EPathType::Posix);
-      bool success = true;
-      if (!runNoCapture(".", "unzstd", { archiveFilePathPosix.string(), "-o", tmpFilePathPosix.string() }, {}, true) ||
-          !runNoCapture(".", "tar", { "-xf", tmpFilePathPosix.string(), "-C", destinationPosix.string() }, {}, true))
-        success = false;
+  fprintf(stderr, "ERROR: revision %s not found in %s\n", revision.c_str(), source.Url.c_str());
+  return false;
+}
+
+// Fetches sources of packages in background threads while other packages are built: archives
+// are downloaded and verified, git repositories are cloned to mirrors. Sources are queued by
+// install when package is found not installed, installation of package waits only for its own
+// source
+class SourcePrefetcher {
+public:
+  SourcePrefetcher(const CxxPmSettings &settings, unsigned threadsNum) : Settings_(settings), ThreadsLimit_(threadsNum) {}
+  ~SourcePrefetcher() {
+    // Interrupted downloads are resumed by foreground fetch or next run
+    {
+      std::lock_guard lock(Mutex_);
+      Cancelled_ = true;
+      for (Downloader *downloader: Downloaders_)
+        downloader->cancel();
+    }
+    JobAdded_.notify_all();
+    for (auto &thread: Threads_)
+      thread.join();
+  }
+
+  // Queues source if it is not in DistrDir yet, new thread is started while queued jobs outnumber
+  // idle threads. Archive without recorded hash is verified by built-in extractor if it supports
+  // the archive
+  void add(const CPackageSource &source) {
+    CJob job;
+    job.Source = source;
+    if (source.Type == "archive") {
+      if (source.Url.empty() || source.Sha3.size() != 64 || !archivePath(Settings_, source, job.Path) || archiveReady(job.Path, source.Sha3))
+        return;
+      // Archive isn't needed while its extracted sources are cached
+      if (!source.CacheKey.empty() && sourceCacheReady(sourceCacheEntry(sourceCacheDir(Settings_), source.CacheKey)))
+        return;
       std::error_code ec;
-      std::filesystem::remove(tmpFilePath, ec);
-      if (!success) {
-        fprintf(stderr, "Unpacking error\n");
-        return false;
-      }
+      if (archiveExtractSupported(job.Path) && std::filesystem::exists(job.Path, ec))
+        return;
+    } else if (source.Type == "git" && !source.Url.empty()) {
+      job.Path = gitMirrorPath(Settings_, source.Url);
+      std::error_code ec;
+      if (std::filesystem::exists(job.Path, ec))
+        return;
     } else {
-      fprintf(stderr, "Unknown archive file: %s\n", archiveFilePath.string().c_str());
-      return false;
+      return;
+    }
 
+    std::lock_guard lock(Mutex_);
+    for (const auto &queued: Jobs_) {
+      if (queued->Path == job.Path)
+        return;
     }
-  } else if (type == "git") {
-    std::vector<std::string> gitArgs = {"clone", url, "."};
-    if (!tag.empty()) {
-      gitArgs.emplace_back("-b");
-      gitArgs.emplace_back(tag);
+    job.Result = job.Promise.get_future().share();
+    Jobs_.emplace_back(new CJob(std::move(job)));
+    if (Jobs_.size() - Next_ > Idle_ && Threads_.size() < ThreadsLimit_)
+      Threads_.emplace_back([this]() { worker(); });
+    else
+      JobAdded_.notify_one();
+  }
+
+  size_t size() {
+    std::lock_guard lock(Mutex_);
+    return Jobs_.size();
+  }
+
+  // Waits for fetch of archive or git mirror at path, stats receive resources used by it.
+  // Returns false if fetch failed; path not queued is not waited for
+  bool wait(const std::filesystem::path &path, CProcessStats *stats) {
+    CJob *found = nullptr;
+    {
+      std::lock_guard lock(Mutex_);
+      for (const auto &job: Jobs_) {
+        if (job->Path == path)
+          found = job.get();
+      }
     }
+    if (!found)
+      return true;
 
-    if (!runNoCapture(destination, "git", gitArgs, {}, true)) {
-      fprintf(stderr, "git clone error url: %s tag: %s\n", url.c_str(), tag.c_str());
-      return false;
+    bool result = found->Result.get();
+    if (stats)
+      stats->add(found->Stats);
+    return result;
+  }
+
+  bool waitAll() {
+    std::vector<std::shared_future<bool>> results;
+    {
+      std::lock_guard lock(Mutex_);
+      for (const auto &job: Jobs_)
+        results.push_back(job->Result);
     }
+    bool success = true;
+    for (const auto &result: results)
+      success &= result.get();
+    return success;
+  }
 
-    if (!commit.empty()) {
-      if (!runNoCapture(destination, "git", {"reset", "--hard", commit}, {}, true)) {
-        fprintf(stderr, "git reset hard error commit: %s\n", commit.c_str());
+private:
+  struct CJob {
+    CPackageSource Source;
+    std::filesystem::path Path;
+    CProcessStats Stats;
+    std::promise<bool> Promise;
+    std::shared_future<bool> Result;
+  };
+
+  void worker() {
+    // Progress of concurrent downloads is not shown, it would mix with build output
+    Downloader downloader(false);
+    std::unique_lock lock(Mutex_);
+    Downloaders_.push_back(&downloader);
+    if (Cancelled_)
+      downloader.cancel();
+
+    for (;;) {
+      if (Next_ == Jobs_.size()) {
+        if (Cancelled_)
+          break;
+        Idle_++;
+        JobAdded_.wait(lock, [this]() { return Cancelled_ || Next_ < Jobs_.size(); });
+        Idle_--;
+        continue;
       }
+
+      // Jobs are allocated separately, reference stays valid while queue grows
+      CJob &job = *Jobs_[Next_++];
+      bool cancelled = Cancelled_;
+      lock.unlock();
+      bool result = false;
+      if (!cancelled) {
+        std::string commitHash;
+        result = job.Source.Type == "archive" ?
+          fetchArchive(Settings_, downloader, job.Source, job.Path, &job.Stats) :
+          fetchGitSource(Settings_, job.Source, job.Path, commitHash, false, &job.Stats);
+        if (result)
+          distrCacheTouch(Settings_.DistrDir, job.Path);
+      }
+      job.Promise.set_value(result);
+      lock.lock();
     }
 
+    Downloaders_.erase(std::find(Downloaders_.begin(), Downloaders_.end(), &downloader));
+  }
+
+  CxxPmSettings Settings_;
+  unsigned ThreadsLimit_;
+  std::mutex Mutex_;
+  std::condition_variable JobAdded_;
+  std::vector<std::unique_ptr<CJob>> Jobs_;
+  size_t Next_ = 0;
+  unsigned Idle_ = 0;
+  bool Cancelled_ = false;
+  std::vector<Downloader*> Downloaders_;
+  std::vector<std::thread> Threads_;
+};
+
+// Sources of package and all its dependencies, dependencies go first
+static bool collectPackageSources(const CContext &context,
+                                  const std::map<std::string, CPackage> &allPackages,
+                                  const CPackage &package,
+                                  std::set<std::string> &visited,
+                                  std::vector<CPackageSource> &sources,
+                                  bool verbose)
+{
+  if (!visited.insert(package.Name).second)
     return true;
-  } else {
-    fprintf(stderr, "ERROR: unsupported type: %s\n", type.c_str());
-    return false;
+
+  std::string dependsVariable;
+  if (loadSingleVariable(package.BuildFile, "DEPENDS", dependsVariable) && !dependsVariable.empty()) {
+    StringSplitter splitter(dependsVariable, "\r\n ");
+    while (splitter.next()) {
+      std::string d(splitter.get());
+      auto It = allPackages.find(d);
+      if (It == allPackages.end()) {
+        fprintf(stderr, "ERROR: %s depends on non-existent package %s\n", package.Name.c_str(), d.c_str());
+        return false;
+      }
+
+      // Dependency is inspected again by install, work with copy
+      CPackage dependPackage = It->second;
+      if (!inspectPackage(context, dependPackage, std::string(), verbose))
+        return false;
+      if (!collectPackageSources(context, allPackages, dependPackage, visited, sources, verbose))
+        return false;
+    }
   }
 
+  CPackageSource source;
+  if (!loadPackageSource(context, package, source))
+    return false;
+  sources.push_back(std::move(source));
   return true;
 }
 
@@ -458,6 +975,359 @@ static bool removeDirectory(const std::filesystem::path &path)
   return true;
 }
 
+// Extracts archive to destination by built-in extractor or external tools, downloads it if needed
+static bool extractArchiveFiles(const CContext &context,
+                                const CPackageSource &source,
+                                const std::filesystem::path &archiveFilePath,
+                                const std::filesystem::path &destination,
+                                CPackageBuildStats &stats)
+{
+  // Failed prefetch is retried here, download resumes from received data
+  if (context.Prefetcher)
+    context.Prefetcher->wait(archiveFilePath, &stats.Download);
+
+  // Built-in extractor verifies archive hash in the same read, archive found damaged is
+  // downloaded again
+  bool useTools = !archiveExtractSupported(archiveFilePath);
+  bool extracted = false;
+  for (unsigned attempt = 0; attempt < 2 && !extracted && !useTools; attempt++) {
+    bool unverified = false;
+    if (!fetchArchive(context.GlobalSettings, gDownloader, source, archiveFilePath, &stats.Download, attempt == 0 ? &unverified : nullptr))
+      return false;
+
+    std::string archiveHash;
+    EExtractResult result = archiveExtract(archiveFilePath, destination, archiveHash, context.GlobalSettings.ExtractTimeout, &stats.Extract);
+    if (result == EExtractResult::Unsupported) {
+      // External tools need verified archive
+      useTools = true;
+      if (unverified && !fetchArchive(context.GlobalSettings, gDownloader, source, archiveFilePath, &stats.Download))
+        return false;
+    } else if (result == EExtractResult::Success && archiveHash == source.Sha3) {
+      if (unverified)
+        hashSidecarWrite(archiveFilePath, "sha3", source.Sha3);
+      extracted = true;
+    } else if (result == EExtractResult::Success || unverified) {
+      if (result == EExtractResult::Success)
+        fprintf(stderr, "SHA3 mismatch: sha3(%s)=%s, required %s\n", archiveFilePath.string().c_str(), archiveHash.c_str(), source.Sha3.c_str());
+      fprintf(stderr, "Archive %s is damaged, downloading it again\n", archiveFilePath.string().c_str());
+      std::error_code ec;
+      std::filesystem::remove(archiveFilePath, ec);
+      // Files of damaged archive are written before its hash is known
+      clearDirectory(destination);
+    } else {
+      fprintf(stderr, "Unpacking error\n");
+      return false;
+    }
+  }
+
+  if (extracted)
+    return true;
+  if (!useTools) {
+    fprintf(stderr, "Unpacking error\n");
+    return false;
+  }
+  if (!fetchArchive(context.GlobalSettings, gDownloader, source, archiveFilePath, &stats.Download))
+    return false;
+
+  // Unpacking file by external tools
+  // Detect archive type
+  auto archiveFilePathPosix = pathConvert(archiveFilePath, EPathType::Posix);
+  auto destinationPosix = pathConvert(destination, EPathType::Posix);
+
+  if (endsWith(archiveFilePathPosix.string(), ".zip")) {
+    if (!runNoCapture(".", "unzip", { "-o", archiveFilePathPosix.string(), "-d", destinationPosix.string()}, {}, true, &stats.Extract, context.GlobalSettings.ExtractTimeout)) {
+      fprintf(stderr, "Unpacking error\n");
+      return false;
+    }
+  } else if (endsWith(archiveFilePathPosix.string(), ".tar.gz")) {
+    if (!runNoCapture(".", "tar", { "-xzf", archiveFilePathPosix.string(), "-C", destinationPosix.string() }, {}, true, &stats.Extract, context.GlobalSettings.ExtractTimeout)) {
+      fprintf(stderr, "Unpacking error\n");
+      return false;
+    }
+  } else if (endsWith(archiveFilePathPosix.string(), ".tar.bz2")) {
+    if (!runNoCapture(".", "tar", { "-xjf", archiveFilePathPosix.string(), "-C", destinationPosix.string() }, {}, true, &stats.Extract, context.GlobalSettings.ExtractTimeout)) {
+      fprintf(stderr, "Unpacking error\n");
+      return false;
+    }
+  } else if (endsWith(archiveFilePathPosix.string(), ".tar.lz") || endsWith(archiveFilePathPosix.string(), ".tar.lzma")) {
+      if (!runNoCapture(".", "tar", { "--lzip", "-xvf", archiveFilePathPosix.string(), "-C", destinationPosix.string() }, {}, true, &stats.Extract, context.GlobalSettings.ExtractTimeout)) {
+        fprintf(stderr, "Unpacking error\n");
+        return false;
+      }
+  } else if (endsWith(archiveFilePathPosix.string(), ".tar.zst")) {
+    std::string tmpFileName = archiveFilePathPosix.filename().string();
+    std::filesystem::path tmpFilePath = context.GlobalSettings.DistrDir / ("tmp-" + tmpFileName.substr(0, tmpFileName.size() - 4));
+    std::filesystem::path tmpFilePathPosix = pathConvert(tmpFilePath, EPathType::Posix);
+    bool success = true;
+    if (!runNoCapture(".", "unzstd", { archiveFilePathPosix.string(), "-o", tmpFilePathPosix.string() }, {}, true, &stats.Extract, context.GlobalSettings.ExtractTimeout) ||
+        !runNoCapture(".", "tar", { "-xf", tmpFilePathPosix.string(), "-C", destinationPosix.string() }, {}, true, &stats.Extract, context.GlobalSettings.ExtractTimeout))
+      success = false;
+    std::error_code ec;
+    std::filesystem::remove(tmpFilePath, ec);
+    if (!success) {
+      fprintf(stderr, "Unpacking error\n");
+      return false;
+    }
+  } else {
+    fprintf(stderr, "Unknown archive file: %s\n", archiveFilePath.string().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+// Destination is left empty if archive can't be extracted or its hash doesn't match
+static bool extractArchive(const CContext &context,
+                           const CPackageSource &source,
+                           const std::filesystem::path &archiveFilePath,
+                           const std::filesystem::path &destination,
+                           CPackageBuildStats &stats)
+{
+  if (extractArchiveFiles(context, source, archiveFilePath, destination, stats))
+    return true;
+  clearDirectory(destination);
+  return false;
+}
+
+// Moves content of source directory into destination, merging directories existing in both
+static bool moveDirectoryContent(const std::filesystem::path &source, const std::filesystem::path &destination)
+{
+  std::error_code ec;
+  for (const auto &element: std::filesystem::directory_iterator(source, ec)) {
+    std::filesystem::path target = destination / element.path().filename();
+    std::error_code typeEc;
+    if (element.is_directory(typeEc) && !element.is_symlink(typeEc) && std::filesystem::is_directory(std::filesystem::symlink_status(target, typeEc))) {
+      if (!moveDirectoryContent(element.path(), target))
+        return false;
+      continue;
+    }
+    std::filesystem::rename(element.path(), target, ec);
+    if (ec) {
+      fprintf(stderr, "ERROR: can't rename %s to %s\n", element.path().string().c_str(), target.string().c_str());
+      return false;
+    }
+  }
+  return !ec;
+}
+
+// Binary package is extracted to staging directory first, install directory may be shared with
+// dependent package and receives only files of verified archive
+static bool extractBinaryArchive(const CContext &context,
+                                 const CPackageSource &source,
+                                 const std::filesystem::path &archiveFilePath,
+                                 const std::filesystem::path &destination,
+                                 CPackageBuildStats &stats)
+{
+  std::filesystem::path staging = destination;
+  staging += ".tmp";
+  if (!removeDirectory(staging))
+    return false;
+  std::error_code ec;
+  if (!std::filesystem::create_directories(staging, ec) || (!std::filesystem::create_directories(destination, ec) && ec)) {
+    fprintf(stderr, "ERROR: can't create directory at %s\n", staging.string().c_str());
+    return false;
+  }
+
+  bool success = extractArchive(context, source, archiveFilePath, staging, stats) &&
+                 moveDirectoryContent(staging, destination);
+  clearDirectory(staging);
+  std::filesystem::remove_all(staging, ec);
+  return success;
+}
+
+static bool applyPatches(const CContext &context, const CPackageSource &source, const std::filesystem::path &sourceDir, CProcessStats *stats)
+{
+  std::filesystem::path patchDir = sourceDir / source.PatchDir;
+  for (const auto &patch: source.Patches) {
+    printf("Applying patch %s\n", patch.filename().string().c_str());
+    if (!runNoCapture(patchDir, "patch", { "-p1", "-i", pathConvert(patch, EPathType::Posix).string() }, {}, true, stats, context.GlobalSettings.ExtractTimeout)) {
+      fprintf(stderr, "ERROR: can't apply patch %s\n", patch.string().c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool materializeSources(const std::filesystem::path &cacheEntry, const std::filesystem::path &destination, CProcessStats *stats)
+{
+  static const char *modeNames[] = { "reflinks", "copies" };
+  auto beginPt = std::chrono::steady_clock::now();
+  size_t filesNum = 0;
+  ESourceLinkMode mode;
+  if (!sourceCacheMaterialize(cacheEntry, destination, filesNum, mode))
+    return false;
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginPt).count();
+  stats->WallTime += seconds;
+  printf("Sources taken from cache %s: %zu files (%s) in %u milliseconds\n",
+         cacheEntry.string().c_str(),
+         filesNum,
+         modeNames[static_cast<unsigned>(mode)],
+         static_cast<unsigned>(seconds * 1000));
+  return true;
+}
+
+bool downloadPackageFiles(const CContext& context,
+                          const CPackage& package,
+                          const std::filesystem::path &sourceDir,
+                          const std::filesystem::path &binaryInstallDir,
+                          CPackageBuildStats &stats,
+                          std::vector<std::filesystem::path> &distrItems)
+{
+  CPackageSource source;
+  if (!loadPackageSource(context, package, source))
+    return false;
+  const std::string &type = source.Type;
+  const std::string &url = source.Url;
+  std::filesystem::path destination = package.IsBinary ? binaryInstallDir : sourceDir;
+
+  printf("Downloading package %s:%s\n", package.Name.c_str(), package.Version.c_str());
+  if (type == "archive") {
+    std::filesystem::path archiveFilePath;
+    if (!archivePath(context.GlobalSettings, source, archiveFilePath))
+      return false;
+    distrItems.push_back(archiveFilePath);
+
+    if (package.IsBinary) {
+      if (!extractBinaryArchive(context, source, archiveFilePath, destination, stats))
+        return false;
+      distrCacheTouch(context.GlobalSettings.DistrDir, archiveFilePath);
+      return true;
+    }
+
+    // Sources are extracted and patched once to cache, workspace is filled from cache entry
+    std::filesystem::path cacheEntry = sourceCacheEntry(sourceCacheDir(context.GlobalSettings), source.CacheKey);
+    distrItems.push_back(cacheEntry);
+    if (sourceCacheReady(cacheEntry)) {
+      if (materializeSources(cacheEntry, destination, &stats.Extract)) {
+        distrCacheTouch(context.GlobalSettings.DistrDir, cacheEntry);
+        return true;
+      }
+      fprintf(stderr, "Cached sources %s were changed, extracting archive again\n", cacheEntry.string().c_str());
+    }
+
+    std::filesystem::path staging;
+    if (!sourceCacheStaging(cacheEntry, staging) ||
+        !extractArchive(context, source, archiveFilePath, staging, stats) ||
+        !applyPatches(context, source, staging, &stats.Extract) ||
+        !sourceCacheCommit(cacheEntry))
+      return false;
+    distrCacheTouch(context.GlobalSettings.DistrDir, archiveFilePath);
+    distrCacheTouch(context.GlobalSettings.DistrDir, cacheEntry);
+    if (!materializeSources(cacheEntry, destination, &stats.Extract)) {
+      fprintf(stderr, "ERROR: can't fill %s from cached sources %s\n", destination.string().c_str(), cacheEntry.string().c_str());
+      return false;
+    }
+    return true;
+  } else if (type == "git") {
+    // Repository is kept as mirror in DistrDir, workspace is its worktree sharing mirror objects.
+    // Blobs missing in partial mirror are fetched to mirror by checkout and reused later
+    std::filesystem::path mirrorPath = gitMirrorPath(context.GlobalSettings, url);
+    if (context.Prefetcher)
+      context.Prefetcher->wait(mirrorPath, &stats.Download);
+    std::string commitHash;
+    if (!fetchGitSource(context.GlobalSettings, source, mirrorPath, commitHash, true, &stats.Download))
+      return false;
+    distrItems.push_back(mirrorPath);
+    distrCacheTouch(context.GlobalSettings.DistrDir, mirrorPath);
+
+    // Worktrees of deleted workspaces are forgotten before new one added
+    bool success =
+      runNoCapture(mirrorPath, "git", { "worktree", "prune" }, {}, true) &&
+      runNoCapture(mirrorPath, "git", { "worktree", "add", "--quiet", "--no-checkout", "--detach", pathConvert(destination, EPathType::Posix).string(), commitHash }, {}, true);
+    if (success && !source.SparseCheckout.empty()) {
+      std::vector<std::string> args = { "sparse-checkout", "set" };
+      args.insert(args.end(), source.SparseCheckout.begin(), source.SparseCheckout.end());
+      success = runNoCapture(destination, "git", { "sparse-checkout", "init", "--cone" }, {}, true) &&
+                runNoCapture(destination, "git", args, {}, true);
+    }
+    success = success && runNoCapture(destination, "git", { "reset", "--hard", "--quiet" }, {}, true, &stats.Download, context.GlobalSettings.DownloadTimeout);
+    if (!success) {
+      fprintf(stderr, "git checkout error url: %s revision: %s\n", url.c_str(), commitHash.c_str());
+      return false;
+    }
+
+    printf("Checked out %s at %s\n", url.c_str(), commitHash.c_str());
+    return true;
+  } else {
+    fprintf(stderr, "ERROR: unsupported type: %s\n", type.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+static json11::Json processStatsToJson(const CProcessStats &stats)
+{
+  return json11::Json::object {
+    {"processes", static_cast<int>(stats.Processes)},
+    {"wall_time", stats.WallTime},
+    {"user_time", stats.UserTime},
+    {"system_time", stats.SystemTime},
+    {"max_rss", static_cast<double>(stats.MaxRss)},
+    {"voluntary_context_switches", static_cast<double>(stats.VoluntaryContextSwitches)},
+    {"involuntary_context_switches", static_cast<double>(stats.InvoluntaryContextSwitches)},
+    {"read_bytes", static_cast<double>(stats.ReadBytes)},
+    {"write_bytes", static_cast<double>(stats.WriteBytes)},
+    {"storage_read_bytes", static_cast<double>(stats.StorageReadBytes)},
+    {"storage_write_bytes", static_cast<double>(stats.StorageWriteBytes)}
+  };
+}
+
+static std::string formatProcessStats(const char *phase, const CProcessStats &stats)
+{
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer), "  %-8s %u processes, wall %.2fs, user %.2fs, sys %.2fs, max rss %.1f MiB, ctx switches %llu/%llu, read %.1f MiB, written %.1f MiB\n",
+           phase,
+           stats.Processes,
+           stats.WallTime,
+           stats.UserTime,
+           stats.SystemTime,
+           stats.MaxRss / 1048576.0,
+           static_cast<unsigned long long>(stats.VoluntaryContextSwitches),
+           static_cast<unsigned long long>(stats.InvoluntaryContextSwitches),
+           stats.ReadBytes / 1048576.0,
+           stats.WriteBytes / 1048576.0);
+  return buffer;
+}
+
+// Per phase resource usage is written to build-stats.json in package prefix
+static void writeBuildStats(const CPackage &package, const CPackageBuildStats &stats, BuildLog *log, bool verbose)
+{
+  CProcessStats total;
+  total.add(stats.Download);
+  total.add(stats.Extract);
+  total.add(stats.Build);
+
+  json11::Json json = json11::Json::object {
+    {"download", processStatsToJson(stats.Download)},
+    {"extract", processStatsToJson(stats.Extract)},
+    {"build", processStatsToJson(stats.Build)},
+    {"total", processStatsToJson(total)}
+  };
+
+  std::filesystem::path statsPath = package.Prefix / "build-stats.json";
+  FILE *hStats = fopen(statsPath.string().c_str(), "w");
+  if (hStats) {
+    std::string data = json.dump();
+    fwrite(data.data(), 1, data.size(), hStats);
+    fputc('\n', hStats);
+    fclose(hStats);
+  } else {
+    fprintf(stderr, "WARNING: can't write %s\n", statsPath.string().c_str());
+  }
+
+  std::string report = "Resources used by " + package.Name + ":\n";
+  report.append(formatProcessStats("download", stats.Download));
+  report.append(formatProcessStats("extract", stats.Extract));
+  report.append(formatProcessStats("build", stats.Build));
+  report.append(formatProcessStats("total", total));
+  if (log)
+    log->print("%s", report.c_str());
+  if (verbose)
+    fputs(report.c_str(), stdout);
+}
+
 bool install(CContext &context, std::map<std::string, CPackage> &allPackages, CPackage &package, const std::string &buildType, bool verbose, const std::filesystem::path &externalPrefix="")
 {
   printf("Installing package %s (%s) to %s\n", package.Name.c_str(), buildType.c_str(), package.Prefix.string().c_str());
@@ -497,34 +1367,62 @@ bool install(CContext &context, std::map<std::string, CPackage> &allPackages, CP
       uint64_t ms = 0;
       bool packageInstalled = true;
       bool allFilesChecked = true;
+      bool manifestEnd = false;
       std::string line;
-      while (std::getline(hManifest, line)) {
-        size_t pos = line.find('!');
-        if (pos == std::string::npos || pos == 0 || line.size()-pos < 64) {
-          fprintf(stderr, "WARNING: broken manifest %s\n", (package.Prefix / "manifest.txt").string().c_str());
-          packageInstalled = false;
-          break;
-        }
+      // Files are verified in batches, small ones are hashed together
+      static constexpr size_t batchSize = 64;
+      std::vector<std::string> expectedHashes;
+      std::vector<std::filesystem::path> files;
+      std::vector<std::string> hashes;
+      EHashAlgorithm algorithm = readManifestHeader(hManifest);
+      if (algorithm == EHashAlgorithm::Unknown) {
+        fprintf(stderr, "WARNING: unknown hash algorithm in manifest %s\n", (package.Prefix / "manifest.txt").string().c_str());
+        packageInstalled = false;
+      }
 
-        // get next file hash
-        std::string relativePath = line.substr(0, pos);
-        std::string expectedHash = line.substr(pos+1, 64);
-        std::string hash = sha3FileHash(installDir / relativePath);
-        if (hash.empty()) {
-          fprintf(stderr, "WARNING: can't read package file %s\n", (installDir / relativePath).string().c_str());
-          packageInstalled = false;
-          break;
+      while (!manifestEnd && packageInstalled) {
+        expectedHashes.clear();
+        files.clear();
+        while (files.size() < batchSize) {
+          if (!std::getline(hManifest, line)) {
+            manifestEnd = true;
+            break;
+          }
+
+          size_t pos = line.find('!');
+          if (pos == std::string::npos || pos == 0 || line.size()-pos < 64) {
+            fprintf(stderr, "WARNING: broken manifest %s\n", (package.Prefix / "manifest.txt").string().c_str());
+            packageInstalled = false;
+            break;
+          }
+
+          files.push_back(installDir / line.substr(0, pos));
+          expectedHashes.push_back(line.substr(pos+1, 64));
         }
 
-        if (hash != expectedHash) {
-          fprintf(stderr, "WARNING: file %s corrupted, need reinstall\n", (installDir / relativePath).string().c_str());
-          packageInstalled = false;
+        if (!packageInstalled)
           break;
+
+        // get next files hash
+        filesHash(algorithm, files, hashes);
+        for (size_t i = 0, ie = files.size(); i != ie; ++i) {
+          if (hashes[i].empty()) {
+            fprintf(stderr, "WARNING: can't read package file %s\n", files[i].string().c_str());
+            packageInstalled = false;
+            break;
+          }
+
+          if (hashes[i] != expectedHashes[i]) {
+            fprintf(stderr, "WARNING: file %s corrupted, need reinstall\n", files[i].string().c_str());
+            packageInstalled = false;
+            break;
+          }
+
+          count++;
         }
 
-        count++;
         ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - beginPt).count();
-        if (ms >= 125) {
+        if (packageInstalled && !manifestEnd && ms >= 125) {
           allFilesChecked = false;
           break;
         }
@@ -538,35 +1436,35 @@ bool install(CContext &context, std::map<std::string, CPackage> &allPackages, CP
     }
   }
 
+  // Source is fetched in background while dependencies are installed
+  if (context.Prefetcher) {
+    CPackageSource source;
+    if (loadPackageSource(context, package, source))
+      context.Prefetcher->add(source);
+  }
+
   if (!removeDirectory(package.Prefix))
     return false;
 
-  if (!package.IsBinary) {
-    if (!removeDirectory(sourceDir))
-      return false;
-    if (!std::filesystem::create_directories(sourceDir)) {
-      fprintf(stderr, "ERROR: can't create directory at %s\n", sourceDir.string().c_str());
-      return false;
-    }
-
-    if (!removeDirectory(buildDir))
-      return false;
-    if (!std::filesystem::create_directories(buildDir)) {
-      fprintf(stderr, "ERROR: can't create directory at %s\n", buildDir.string().c_str());
-      return false;
-    }
-  }
-
   if (installDirNeedCreate && !std::filesystem::create_directories(installDir)) {
     fprintf(stderr, "ERROR: can't create directory at %s\n", installDir.string().c_str());
     return false;
   }
 
+  // Dependency installed to prefix of dependent package keeps build log in own prefix
+  if (!installDirNeedCreate && !package.IsBinary) {
+    std::error_code ec;
+    if (!std::filesystem::create_directories(package.Prefix, ec) && ec) {
+      fprintf(stderr, "ERROR: can't create directory at %s\n", package.Prefix.string().c_str());
+      return false;
+    }
+  }
+
   // Install depends
   {
     std::string dependsVariable;
     if (loadSingleVariable(package.BuildFile, "DEPENDS", dependsVariable) && !dependsVariable.empty()) {
-      std::vector<std::string> depends;
+      std::vector<CPackage*> depends;
       // TEMPORARY!
       // TODO: correctly parse depends
       StringSplitter splitter(dependsVariable, "\r\n ");
@@ -578,11 +1476,14 @@ bool install(CContext &context, std::map<std::string, CPackage> &allPackages, CP
           fprintf(stderr, "ERROR: %s depends on non-existent package %s\n", package.Name.c_str(), d.c_str());
           return false;
         }
+        depends.push_back(&It->second);
+      }
 
-        auto &dependPackage = It->second;
-        // TODO: get version from DEPENDS
-        if (!inspectPackage(context, dependPackage, std::string(), verbose))
-          return false;
+      // TODO: get version from DEPENDS
+      if (!inspectPackages(context, depends, std::string(), verbose))
+        return false;
+      for (CPackage *dependPackagePtr: depends) {
+        auto &dependPackage = *dependPackagePtr;
         if (!searchCompilers(dependPackage.Languages, context.Compilers, context.Tools, context.SystemInfo, verbose))
           return false;
         updatePackagePrefix(context, dependPackage, buildType, verbose);
@@ -593,20 +1494,42 @@ bool install(CContext &context, std::map<std::string, CPackage> &allPackages, CP
     }
   }
 
-  if (!downloadPackageFiles(context, package, sourceDir, installDir))
+  // Source and build directories are shared by all packages, prepare them after dependencies installed
+  if (!package.IsBinary) {
+    if (!removeDirectory(sourceDir))
+      return false;
+    if (!std::filesystem::create_directories(sourceDir)) {
+      fprintf(stderr, "ERROR: can't create directory at %s\n", sourceDir.string().c_str());
+      return false;
+    }
+
+    if (!removeDirectory(buildDir))
+      return false;
+    if (!std::filesystem::create_directories(buildDir)) {
+      fprintf(stderr, "ERROR: can't create directory at %s\n", buildDir.string().c_str());
+      return false;
+    }
+  }
+
+  CPackageBuildStats buildStats;
+  std::vector<std::filesystem::path> distrItems;
+  if (!downloadPackageFiles(context, package, sourceDir, installDir, buildStats, distrItems))
     return false;
+  // Dependencies installed to prefix of dependent package are recorded in its list
+  distrCacheAddReferences((externalPrefix.empty() ? package.Prefix : externalPrefix) / distrReferencesName, context.GlobalSettings.DistrDir, distrItems);
 
   if (!package.IsBinary) {
     // Build
     // Prepare environment
-    std::vector<std::string> env;
-    prepareBuildEnvironment(env, package, context.GlobalSettings, context.SystemInfo, context.Compilers, context.Tools, buildType, verbose);
+    ProcessEnvironment env;
+    preparePackageEnvironment(env, package, context.GlobalSettings, context.SystemInfo, context.Compilers, context.Tools, verbose);
+    prepareBuildEnvironment(env, package, context.SystemInfo, context.Compilers, context.Tools, buildType, verbose);
 
     // Run building
     printf("Build %s\n", package.Name.c_str());
-    FILE* hLog = fopen((package.Prefix / "build.log").string().c_str(), "w+");
-    if (!hLog) {
-      fprintf(stderr, "Can't open log file %s\n", (package.Prefix / "build.log").string().c_str());
+    BuildLog log;
+    if (!log.open(package.Prefix / "build.log")) {
+      fprintf(stderr, "Can't open log file %s\n", log.path().string().c_str());
       return false;
     }
 
@@ -614,14 +1537,31 @@ bool install(CContext &context, std::map<std::string, CPackage> &allPackages, CP
     args = "set -x; set -e; source ";
     args.append(pathConvert(package.BuildFile, EPathType::Posix).string());
     args.append("; build;");
-    if (!runCaptureLog(package.BuildFile.parent_path(), "bash", { "-c", args }, env, hLog, true)) {
-      fprintf(hLog, "Build command for %s failed\n", package.Name.c_str());
+    // Plain log file is filled by runCaptureLog directly, compressed log needs its data
+    bool echo = !context.GlobalSettings.QuietBuild;
+    bool built = echo && log.file() ?
+      runCaptureLog(package.BuildFile.parent_path(), "bash", { "-c", args }, env, log.file(), true, &buildStats.Build, context.GlobalSettings.BuildTimeout) :
+      runCaptureOutput(package.BuildFile.parent_path(), "bash", { "-c", args }, env, [&log](EOutputStream, const char *data, size_t size) {
+        log.write(data, size);
+        return true;
+      }, echo, true, &buildStats.Build, context.GlobalSettings.BuildTimeout);
+    if (!built) {
+      log.print("Build command for %s failed\n", package.Name.c_str());
       fprintf(stderr, "Build command for %s failed\n", package.Name.c_str());
-      fclose(hLog);
+      if (!echo) {
+        std::string tail = log.tail();
+        fprintf(stderr, "Last lines of %s:\n", log.path().string().c_str());
+        fwrite(tail.data(), 1, tail.size(), stderr);
+      }
+      writeBuildStats(package, buildStats, &log, verbose);
       return false;
     }
 
-    fclose(hLog);
+    writeBuildStats(package, buildStats, &log, verbose);
+    if (!log.close())
+      fprintf(stderr, "WARNING: can't write log file %s\n", log.path().string().c_str());
+  } else {
+    writeBuildStats(package, buildStats, nullptr, verbose);
   }
 
   if (externalPrefix.empty()) {
@@ -633,8 +1573,10 @@ bool install(CContext &context, std::map<std::string, CPackage> &allPackages, CP
     }
 
     printf("Create manifest...\n");
-    createManifestForDirectory(hManifest, installDir, "");
+    createManifestForDirectory(hManifest, installDir, "", context.GlobalSettings.ManifestHash);
     fclose(hManifest);
+    if (!manifestIndexBuild(package.Prefix))
+      fprintf(stderr, "WARNING: can't create manifest index %s\n", (package.Prefix / "manifest.idx").string().c_str());
   }
 
   // Cleanup
@@ -647,37 +1589,32 @@ bool install(CContext &context, std::map<std::string, CPackage> &allPackages, CP
   return true;
 }
 
-std::filesystem::path searchPath(const std::filesystem::path& prefix, const std::filesystem::path &name)
+// Finds package files by path suffix, paths[i] is empty if there is no file ending with names[i]
+bool searchPath(const std::filesystem::path& prefix, const std::vector<std::filesystem::path> &names, std::vector<std::filesystem::path> &paths)
 {
-  std::filesystem::path result;
-  std::ifstream hManifest(prefix / "manifest.txt");
-  if (hManifest) {
-    size_t length = 0;
-    std::string line;
-    while (std::getline(hManifest, line)) {
-      size_t pos = line.find('!');
-      if (pos == std::string::npos || pos == 0 || line.size() - pos < 64) {
-        fprintf(stderr, "WARNING: broken manifest %s\n", (prefix / "manifest.txt").string().c_str());
-        return std::filesystem::path();
-      }
+  if (!std::filesystem::exists(prefix / "manifest.txt")) {
+    fprintf(stderr, "ERROR: manifest not found, package not installed\n");
+    return false;
+  }
 
-      // get next file hash
-      std::string relativePath = line.substr(0, pos);
-      if (endsWith(relativePath, name.string())) {
-        if (!result.empty()) {
-          fprintf(stderr, "ERROR: more than one file in package\n");
-          return std::filesystem::path();
-        }
+  ManifestIndex index;
+  if (!index.load(prefix))
+    return false;
 
-        result = prefix / "install" / relativePath;
-      }
+  std::vector<std::string> found;
+  paths.clear();
+  for (const auto &name: names) {
+    found.clear();
+    index.findSuffix(name.string(), found);
+    if (found.size() > 1) {
+      fprintf(stderr, "ERROR: more than one file in package\n");
+      return false;
     }
-  } else {
-    fprintf(stderr, "ERROR: manifest not found, package not installed\n");
-    return std::filesystem::path();
+
+    paths.push_back(found.empty() ? std::filesystem::path() : prefix / "install" / found[0]);
   }
 
-  return result;
+  return true;
 }
 
 
@@ -688,8 +1625,75 @@ BOOL WINAPI ctrlHandler(DWORD dwCtrlType)
   terminateAllChildProcess();
   return FALSE;
 }
+#else
+// Children run in own process groups and don't receive terminal signals, kill them
+// with all descendants and terminate with same signal
+static void terminationHandler(int signalNumber)
+{
+  terminateAllChildProcess();
+  signal(signalNumber, SIG_DFL);
+  raise(signalNumber);
+}
 #endif
 
+static bool parseTimeout(const char *s, unsigned &timeout)
+{
+  char *end;
+  errno = 0;
+  unsigned long value = strtoul(s, &end, 10);
+  if (end == s || *end != 0 || errno != 0 || value > 7*24*3600)
+    return false;
+  timeout = static_cast<unsigned>(value);
+  return true;
+}
+
+// Size in bytes with optional K, M, G or T suffix (powers of 1024)
+static bool parseSize(const char *s, uint64_t &size)
+{
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(s, &end, 10);
+  if (end == s || errno != 0)
+    return false;
+
+  unsigned shift = 0;
+  switch (*end) {
+    case 'K' : shift = 10; end++; break;
+    case 'M' : shift = 20; end++; break;
+    case 'G' : shift = 30; end++; break;
+    case 'T' : shift = 40; end++; break;
+    default : break;
+  }
+  if (*end != 0 || value > (UINT64_MAX >> shift))
+    return false;
+  size = static_cast<uint64_t>(value) << shift;
+  return true;
+}
+
+// Evicts DistrDir items down to quota, items referenced by installed prefixes
+// (<HomeDir>/<prefix hash>/<package>/<version>) go last
+static bool collectDistrGarbage(const CxxPmSettings &settings, uint64_t quota)
+{
+  std::set<std::string> referencedItems;
+  std::error_code ec;
+  for (const auto &prefixes: std::filesystem::directory_iterator(settings.HomeDir, ec)) {
+    for (const auto &package: std::filesystem::directory_iterator(prefixes.path(), ec)) {
+      for (const auto &prefix: std::filesystem::directory_iterator(package.path(), ec))
+        distrCacheLoadReferences(prefix.path() / distrReferencesName, referencedItems);
+    }
+  }
+
+  CDistrCacheStats stats;
+  bool success = distrCacheCollect(settings.DistrDir, quota, referencedItems, stats);
+  printf("Distr cache %s: %zu items, %.1f MB, evicted %zu items, %.1f MB\n",
+         settings.DistrDir.string().c_str(),
+         stats.ItemsNum - stats.EvictedNum,
+         stats.Size / 1048576.0,
+         stats.EvictedNum,
+         stats.EvictedSize / 1048576.0);
+  return success;
+}
+
 int main(int argc, char **argv)
 {
   {
@@ -708,15 +1712,29 @@ int main(int argc, char **argv)
   std::string toolchainSystemProcessor;
   std::string buildType = "Release";
   std::string buildTypeMapping = "Debug:Debug;*:Release";
-  std::string fileArgument;
+  std::vector<std::string> fileArguments;
   std::filesystem::path outputPath;
   bool exportCmake = false;
   bool verbose = false;
+  bool hashCache = false;
+  bool pathCache = false;
+  bool fetchOnly = false;
+  // DistrDir size limit, checked after installation; 0 is no limit
+  uint64_t distrQuota = 0;
   EPathType pathType = EPathType::Native;
   CContext context;
 
 #ifdef WIN32
   SetConsoleCtrlHandler(ctrlHandler, TRUE);
+#else
+  {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = terminationHandler;
+    sigemptyset(&action.sa_mask);
+    for (int signalNumber: {SIGINT, SIGTERM, SIGHUP})
+      sigaction(signalNumber, &action, nullptr);
+  }
 #endif
 
   int res;
@@ -793,6 +1811,14 @@ int main(int argc, char **argv)
         packageName = optarg;
         break;
       }
+      case clOptDistrGc : {
+        if (mode != ENoMode) {
+          fprintf(stderr, "ERROR: mode already specified\n");
+          exit(1);
+        }
+        mode = EDistrGc;
+        break;
+      }
       case clOptExportCMake : {
         exportCmake = true;
         outputPath = optarg;
@@ -805,7 +1831,49 @@ int main(int argc, char **argv)
         extraPackageDirs.push_back(optarg);
         break;
       case clOptFile :
-        fileArgument = optarg;
+        fileArguments.push_back(optarg);
+        break;
+      case clOptHashCache :
+        hashCache = true;
+        break;
+      case clOptPathCache :
+        pathCache = true;
+        break;
+      case clOptManifestHash : {
+        context.GlobalSettings.ManifestHash = hashAlgorithmFromString(optarg);
+        if (context.GlobalSettings.ManifestHash == EHashAlgorithm::Unknown) {
+          fprintf(stderr, "ERROR: unknown hash algorithm: %s\n", optarg);
+          return 1;
+        }
+        break;
+      }
+      case clOptDownloadTimeout :
+      case clOptExtractTimeout :
+      case clOptBuildTimeout : {
+        unsigned timeout;
+        if (!parseTimeout(optarg, timeout)) {
+          fprintf(stderr, "ERROR: invalid timeout: %s\n", optarg);
+          return 1;
+        }
+        if (res == clOptDownloadTimeout)
+          context.GlobalSettings.DownloadTimeout = timeout;
+        else if (res == clOptExtractTimeout)
+          context.GlobalSettings.ExtractTimeout = timeout;
+        else
+          context.GlobalSettings.BuildTimeout = timeout;
+        break;
+      }
+      case clOptQuiet :
+        context.GlobalSettings.QuietBuild = true;
+        break;
+      case clOptFetchOnly :
+        fetchOnly = true;
+        break;
+      case clOptDistrQuota :
+        if (!parseSize(optarg, distrQuota) || distrQuota == 0) {
+          fprintf(stderr, "ERROR: invalid size: %s\n", optarg);
+          return 1;
+        }
         break;
       case clOptVerbose :
         verbose = true;
@@ -820,6 +1888,11 @@ int main(int argc, char **argv)
     }
   }
 
+  if (fetchOnly && mode != EInstall) {
+    fprintf(stderr, "ERROR: --fetch-only can be used only with --install\n");
+    return 1;
+  }
+
   context.SystemInfo.Self = whereami(argv[0]);
   if (context.SystemInfo.Self.empty()) {
     fprintf(stderr, "ERROR: can't find self cxx-pm executable\n");
@@ -882,6 +1955,10 @@ int main(int argc, char **argv)
 
   std::filesystem::create_directories(context.GlobalSettings.HomeDir);
   std::filesystem::create_directories(context.GlobalSettings.DistrDir);
+  if (hashCache)
+    hashCacheEnable(context.GlobalSettings.HomeDir / "hash-cache");
+  if (pathCache)
+    pathCacheEnable(context.GlobalSettings.HomeDir / "path-cache");
 
   // Load all packages
   std::map<std::string, CPackage> packages;
@@ -941,14 +2018,27 @@ int main(int argc, char **argv)
         return 1;
       updatePackagePrefix(context, package, buildType, verbose);
 
-      if (!fileArgument.empty()) {
-        auto path = searchPath(package.Prefix, std::filesystem::path(fileArgument).make_preferred());
-        if (!path.empty()) {
-          printf("%s\n", pathConvert(path, pathType).string().c_str());
-        } else {
-          fprintf(stderr, "ERROR: no file %s in package %s\n", fileArgument.c_str(), packageName.c_str());
+      if (!fileArguments.empty()) {
+        // Several --file arguments are resolved with one index load, paths are printed in the same order
+        std::vector<std::filesystem::path> names;
+        std::vector<std::filesystem::path> paths;
+        for (const auto &fileArgument: fileArguments)
+          names.push_back(std::filesystem::path(fileArgument).make_preferred());
+        if (!searchPath(package.Prefix, names, paths))
           exit(1);
+
+        bool allFound = true;
+        for (size_t i = 0, ie = paths.size(); i != ie; ++i) {
+          if (paths[i].empty()) {
+            fprintf(stderr, "ERROR: no file %s in package %s\n", fileArguments[i].c_str(), packageName.c_str());
+            allFound = false;
+          }
         }
+        if (!allFound)
+          exit(1);
+
+        for (const auto &path: paths)
+          printf("%s\n", pathConvert(path, pathType).string().c_str());
       } else {
         printf("%s\n", pathConvert(package.Prefix, pathType).string().c_str());
       }
@@ -964,6 +2054,22 @@ int main(int argc, char **argv)
       CPackage &package = It->second;
       if (!inspectPackage(context, package, packageVersion, verbose))
         return 1;
+      // Installation queues sources of packages not installed yet, they are fetched while
+      // dependencies are built
+      SourcePrefetcher prefetcher(context.GlobalSettings, prefetchThreads);
+      if (fetchOnly) {
+        std::vector<CPackageSource> sources;
+        std::set<std::string> visited;
+        if (!collectPackageSources(context, packages, package, visited, sources, verbose))
+          return 1;
+        for (const auto &source: sources)
+          prefetcher.add(source);
+        if (prefetcher.size())
+          printf("Fetching %zu sources\n", prefetcher.size());
+        return prefetcher.waitAll() ? 0 : 1;
+      }
+      context.Prefetcher = &prefetcher;
+
       if (!searchCompilers(package.Languages, context.Compilers, context.Tools, context.SystemInfo, verbose))
         return 1;
 
@@ -981,6 +2087,19 @@ int main(int argc, char **argv)
         if (!cmakeExport(package, context.GlobalSettings, context.Compilers, context.Tools, context.SystemInfo, outputPath, verbose))
           return 1;
       }
+
+      // Sources of this installation are the most recently used and referenced, evicted last
+      if (distrQuota && !collectDistrGarbage(context.GlobalSettings, distrQuota))
+        fprintf(stderr, "WARNING: can't shrink distr cache to quota\n");
+      break;
+    }
+    case EDistrGc : {
+      // Without quota all items not referenced by installed prefixes are evicted
+      if (!collectDistrGarbage(context.GlobalSettings, distrQuota))
+        return 1;
+      size_t pruned = hashCachePrune(context.GlobalSettings.HomeDir / "hash-cache");
+      if (pruned)
+        printf("Removed %zu outdated hash cache entries\n", pruned);
       break;
     }
   }
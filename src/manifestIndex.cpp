@@ -0,0 +1,193 @@
+#include "manifestIndex.h"
+#include "fileio.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+struct CIndexHeader {
+  char Magic[8];
+  uint64_t ManifestSize;
+  uint64_t ManifestMTime;
+  uint64_t Count;
+};
+
+static const char indexMagic[8] = {'C', 'X', 'X', 'P', 'M', 'I', 'X', '1'};
+
+static bool manifestStamp(const std::filesystem::path &manifestPath, uint64_t &size, uint64_t &mtime)
+{
+  std::error_code ec;
+  size = std::filesystem::file_size(manifestPath, ec);
+  if (ec)
+    return false;
+  auto time = std::filesystem::last_write_time(manifestPath, ec);
+  if (ec)
+    return false;
+  mtime = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+  return true;
+}
+
+static bool buildIndexData(const std::filesystem::path &manifestPath, uint64_t manifestSize, uint64_t manifestMTime, std::vector<uint8_t> &data)
+{
+  std::ifstream hManifest(manifestPath);
+  if (!hManifest)
+    return false;
+
+  std::vector<std::string> paths;
+  std::string line;
+  bool firstLine = true;
+  while (std::getline(hManifest, line)) {
+    // skip "!hash=" header
+    if (firstLine && !line.empty() && line[0] == '!') {
+      firstLine = false;
+      continue;
+    }
+
+    firstLine = false;
+    size_t pos = line.find('!');
+    if (pos == std::string::npos || pos == 0 || line.size() - pos < 64) {
+      fprintf(stderr, "WARNING: broken manifest %s\n", manifestPath.string().c_str());
+      return false;
+    }
+
+    paths.emplace_back(line.rend() - pos, line.rend());
+  }
+
+  std::sort(paths.begin(), paths.end());
+
+  size_t poolSize = 0;
+  for (const auto &path: paths)
+    poolSize += path.size() + 1;
+
+  CIndexHeader header;
+  memcpy(header.Magic, indexMagic, sizeof(indexMagic));
+  header.ManifestSize = manifestSize;
+  header.ManifestMTime = manifestMTime;
+  header.Count = paths.size();
+
+  data.resize(sizeof(CIndexHeader) + paths.size()*sizeof(uint64_t) + poolSize);
+  memcpy(data.data(), &header, sizeof(header));
+  uint64_t *offsets = reinterpret_cast<uint64_t*>(data.data() + sizeof(CIndexHeader));
+  uint8_t *pool = data.data() + sizeof(CIndexHeader) + paths.size()*sizeof(uint64_t);
+  uint64_t offset = 0;
+  for (size_t i = 0, ie = paths.size(); i != ie; ++i) {
+    offsets[i] = offset;
+    memcpy(pool + offset, paths[i].c_str(), paths[i].size() + 1);
+    offset += paths[i].size() + 1;
+  }
+
+  return true;
+}
+
+static bool writeIndex(const std::filesystem::path &indexPath, const std::vector<uint8_t> &data)
+{
+  std::filesystem::path tmpPath = indexPath;
+  tmpPath += ".tmp";
+  FILE *hIndex = fopen(tmpPath.string().c_str(), "wb");
+  if (!hIndex)
+    return false;
+
+  bool success = fwrite(data.data(), 1, data.size(), hIndex) == data.size();
+  success &= fclose(hIndex) == 0;
+
+  std::error_code ec;
+  if (success)
+    std::filesystem::rename(tmpPath, indexPath, ec);
+  if (!success || ec) {
+    std::filesystem::remove(tmpPath, ec);
+    return false;
+  }
+
+  return true;
+}
+
+bool manifestIndexBuild(const std::filesystem::path &prefix)
+{
+  uint64_t manifestSize;
+  uint64_t manifestMTime;
+  std::vector<uint8_t> data;
+  if (!manifestStamp(prefix / "manifest.txt", manifestSize, manifestMTime) ||
+      !buildIndexData(prefix / "manifest.txt", manifestSize, manifestMTime, data))
+    return false;
+  return writeIndex(prefix / "manifest.idx", data);
+}
+
+bool ManifestIndex::parse(uint64_t manifestSize, uint64_t manifestMTime)
+{
+  if (Data_.size() < sizeof(CIndexHeader))
+    return false;
+
+  CIndexHeader header;
+  memcpy(&header, Data_.data(), sizeof(header));
+  if (memcmp(header.Magic, indexMagic, sizeof(indexMagic)) != 0 ||
+      header.ManifestSize != manifestSize ||
+      header.ManifestMTime != manifestMTime ||
+      header.Count > (Data_.size() - sizeof(CIndexHeader)) / sizeof(uint64_t))
+    return false;
+
+  Offsets_ = reinterpret_cast<const uint64_t*>(Data_.data() + sizeof(CIndexHeader));
+  Count_ = header.Count;
+
+  // Pool must be terminated and offsets must point inside it
+  size_t poolSize = Data_.size() - sizeof(CIndexHeader) - Count_*sizeof(uint64_t);
+  if (Count_ && (poolSize == 0 || Data_.back() != 0))
+    return false;
+  for (uint64_t i = 0; i < Count_; i++) {
+    if (Offsets_[i] >= poolSize)
+      return false;
+  }
+
+  return true;
+}
+
+std::string_view ManifestIndex::entry(uint64_t index) const
+{
+  const char *pool = reinterpret_cast<const char*>(Offsets_ + Count_);
+  return std::string_view(pool + Offsets_[index]);
+}
+
+bool ManifestIndex::load(const std::filesystem::path &prefix)
+{
+  uint64_t manifestSize;
+  uint64_t manifestMTime;
+  if (!manifestStamp(prefix / "manifest.txt", manifestSize, manifestMTime))
+    return false;
+
+  InputFile file;
+  if (file.open(prefix / "manifest.idx")) {
+    Data_.resize(file.size());
+    if (file.readAt(Data_.data(), Data_.size(), 0) && parse(manifestSize, manifestMTime))
+      return true;
+  }
+
+  // Index not exists or outdated; if it can't be written (read-only prefix), use it from memory
+  if (!buildIndexData(prefix / "manifest.txt", manifestSize, manifestMTime, Data_))
+    return false;
+  writeIndex(prefix / "manifest.idx", Data_);
+  return parse(manifestSize, manifestMTime);
+}
+
+void ManifestIndex::findSuffix(std::string_view suffix, std::vector<std::string> &paths) const
+{
+  std::string reversed(suffix.rbegin(), suffix.rend());
+  uint64_t first = 0;
+  uint64_t count = Count_;
+  while (count > 0) {
+    uint64_t step = count / 2;
+    if (entry(first + step) < reversed) {
+      first += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+
+  for (uint64_t i = first; i < Count_; i++) {
+    std::string_view path = entry(i);
+    if (path.compare(0, reversed.size(), reversed) != 0)
+      break;
+    paths.emplace_back(path.rbegin(), path.rend());
+  }
+}
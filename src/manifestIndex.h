@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Lookup index of installed package files stored next to manifest.txt as manifest.idx:
+// reversed relative paths sorted, so path suffix query is binary search for prefix.
+// Index remembers size and modification time of manifest and is rebuilt when they change
+class ManifestIndex {
+public:
+  // Loads index of prefix/manifest.txt, (re)creates index file if it missing or outdated
+  bool load(const std::filesystem::path &prefix);
+  // Relative paths of all files which paths ends with suffix
+  void findSuffix(std::string_view suffix, std::vector<std::string> &paths) const;
+
+private:
+  std::vector<uint8_t> Data_;
+  const uint64_t *Offsets_ = nullptr;
+  uint64_t Count_ = 0;
+
+  std::string_view entry(uint64_t index) const;
+  bool parse(uint64_t manifestSize, uint64_t manifestMTime);
+};
+
+// Creates manifest.idx for prefix/manifest.txt
+bool manifestIndexBuild(const std::filesystem::path &prefix);
@@ -1,5 +1,6 @@
 #include "package.h"
 #include "cxx-pm.h"
+#include "exec.h"
 #include "os.h"
 #include "sha3.h"
 #include "strExtras.h"
@@ -87,6 +88,15 @@ static void addEnv(std::vector<std::string> &env, const std::string &name, const
   env.back().append(value);
 }
 
+static void setEnvironment(ProcessEnvironment &environment, const std::vector<std::string> &env, bool verbose)
+{
+  environment.set(env);
+  if (verbose) {
+    for (const auto &e: env)
+      printf("%s\n", e.c_str());
+  }
+}
+
 bool CArtifact::loadFromJson(const json11::Json &json)
 {
   if (!json.is_object() ||
@@ -256,15 +266,16 @@ bool CArtifact::merge(const CArtifact &artifact)
   return true;
 }
 
-void prepareBuildEnvironment(std::vector<std::string> &env,
-                        const CPackage &package,
-                        const CxxPmSettings &globalSettings,
-                        const CSystemInfo &systemInfo,
-                        const CompilersArray &compilers,
-                        const ToolsArray &tools,
-                        const std::string &buildType,
-                        bool verbose)
+void preparePackageEnvironment(ProcessEnvironment &environment,
+                               const CPackage &package,
+                               const CxxPmSettings &globalSettings,
+                               const CSystemInfo &systemInfo,
+                               const CompilersArray &compilers,
+                               const ToolsArray &tools,
+                               bool verbose)
 {
+  std::vector<std::string> env;
+
   // Global settings
   std::string args = "--package-root=";
     args.append(globalSettings.PackageRoot.string());
@@ -276,7 +287,6 @@ void prepareBuildEnvironment(std::vector<std::string> &env,
   addEnv(env, "CXXPM_EXECUTABLE", pathConvert(systemInfo.Self, EPathType::Posix).string());
   addEnv(env, "CXXPM_SYSTEM_NAME", systemInfo.TargetSystemName);
   addEnv(env, "CXXPM_SYSTEM_PROCESSOR", systemInfo.TargetSystemProcessor);
-  addEnv(env, "CXXPM_BUILD_TYPE", buildType);
   addEnv(env, "CXXPM_SYSTEM_SUBTYPE", systemInfo.TargetSystemSubType);
   addEnv(env, "CXXPM_MSVC_TOOLSET", systemInfo.VSToolSetVersion);
 
@@ -309,14 +319,6 @@ void prepareBuildEnvironment(std::vector<std::string> &env,
     addEnv(env, toolEnvName(static_cast<EToolType>(i), "COMMAND"), pathConvert(info.Command, EPathType::Posix).string());
   }
 
-  // Build systems
-  // cmake
-  std::string cmakeConfigureArgs = cmakeGetConfigureArgs(package, compilers, tools, systemInfo, buildType);
-  std::string cmakeBuildArgs = cmakeGetBuildArgs(package, compilers, tools, systemInfo, buildType);
-  addEnv(env, "CXXPM_CMAKE_CONFIGURE_ARGS", cmakeConfigureArgs);
-  addEnv(env, "CXXPM_CMAKE_BUILD_ARGS", cmakeBuildArgs);
-  // autotools
-  addAutotoolsEnv(env, package, compilers, tools, systemInfo, buildType);
 #ifdef WIN32
   addEnv(env, "CXXPM_MSVC_ARCH", getVsArch(systemInfo.TargetSystemProcessor));
 #endif
@@ -365,8 +367,28 @@ void prepareBuildEnvironment(std::vector<std::string> &env,
   addEnv(env, "CXXPM_SHARED_LIBRARY_SUFFIX", sharedLibrarySuffix);
   addEnv(env, "CXXPM_EXECUTABLE_SUFFIX", executableSuffix);
 
-  if (verbose) {
-    for (const auto &e: env)
-      printf("%s\n", e.c_str());
-  }
+  setEnvironment(environment, env, verbose);
+}
+
+void prepareBuildEnvironment(ProcessEnvironment &environment,
+                             const CPackage &package,
+                             const CSystemInfo &systemInfo,
+                             const CompilersArray &compilers,
+                             const ToolsArray &tools,
+                             const std::string &buildType,
+                             bool verbose)
+{
+  std::vector<std::string> env;
+  addEnv(env, "CXXPM_BUILD_TYPE", buildType);
+
+  // Build systems
+  // cmake
+  std::string cmakeConfigureArgs = cmakeGetConfigureArgs(package, compilers, tools, systemInfo, buildType);
+  std::string cmakeBuildArgs = cmakeGetBuildArgs(package, compilers, tools, systemInfo, buildType);
+  addEnv(env, "CXXPM_CMAKE_CONFIGURE_ARGS", cmakeConfigureArgs);
+  addEnv(env, "CXXPM_CMAKE_BUILD_ARGS", cmakeBuildArgs);
+  // autotools
+  addAutotoolsEnv(env, package, compilers, tools, systemInfo, buildType);
+
+  setEnvironment(environment, env, verbose);
 }
@@ -7,6 +7,7 @@ class Json;
 }
 
 struct CxxPmSettings;
+class ProcessEnvironment;
 
 struct CPackage {
   std::string Name;
@@ -51,9 +52,18 @@ struct CArtifact {
 std::filesystem::path packagePrefix(const std::filesystem::path &cxxPmHome, const CPackage &package, const CompilersArray &compilers, const CSystemInfo &systemInfo, const std::string &buildType, bool verbose);
 
 
-void prepareBuildEnvironment(std::vector<std::string> &env,
+// Build environment variables which not depend on build type, prepared once for package
+void preparePackageEnvironment(ProcessEnvironment &env,
+                               const CPackage &package,
+                               const CxxPmSettings &globalSettings,
+                               const CSystemInfo &systemInfo,
+                               const CompilersArray &compilers,
+                               const ToolsArray &tools,
+                               bool verbose);
+
+// Build type specific variables, added to copy of package environment
+void prepareBuildEnvironment(ProcessEnvironment &env,
                              const CPackage &package,
-                             const CxxPmSettings &globalSettings,
                              const CSystemInfo &systemInfo,
                              const CompilersArray &compilers,
                              const ToolsArray &tools,
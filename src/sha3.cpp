@@ -1,35 +1,34 @@
 #include "sha3.h"
 extern "C" {
+#include "keccakf1600.h"
 #include "tiny_sha3.h"
 }
+#include "fileio.h"
+#include "hashCache.h"
 #include "strExtras.h"
+#include <string.h>
 
 std::string sha3FileHash(const std::filesystem::path &path)
 {
+  CFileStamp stamp;
+  std::string cachedHash;
+  if (hashCacheLookup(path, "sha3", stamp, cachedHash))
+    return cachedHash;
+
   sha3_ctx_t ctx;
   sha3_init(&ctx, 32);
 
-  static constexpr unsigned bufferSize = 1u << 22;
-  std::unique_ptr<uint8_t[]> buffer(new uint8_t[bufferSize]);
-  FILE *hFile = fopen(path.string().c_str(), "rb");
-  bool success = false;
-  if (hFile) {
-    size_t bytesRead = 0;
-    while ( (bytesRead = fread(buffer.get(), 1, bufferSize, hFile)) )
-      sha3_update(&ctx, buffer.get(), bytesRead);
-    fclose(hFile);
-    success = true;
-  }
-
-  if (success) {
-    uint8_t hash[32];
-    char hex[72] = {0};
-    sha3_final(hash, &ctx, 0);
-    bin2hexLowerCase(hash, hex, 32);
-    return hex;
-  } else {
+  InputFile file;
+  if (!file.open(path) ||
+      !file.readAll([&ctx](const uint8_t *data, size_t size) { sha3_update(&ctx, data, size); }))
     return std::string();
-  }
+
+  uint8_t hash[32];
+  char hex[72] = {0};
+  sha3_final(hash, &ctx, 0);
+  bin2hexLowerCase(hash, hex, 32);
+  hashCacheStore(path, "sha3", stamp, hex);
+  return hex;
 }
 
 std::string sha3StringHash(const std::string &s)
@@ -43,3 +42,121 @@ std::string sha3StringHash(const std::string &s)
   bin2hexLowerCase(hash, hex, 32);
   return hex;
 }
+
+static std::string sha3Hex(const uint8_t *hash)
+{
+  char hex[72] = {0};
+  bin2hexLowerCase(hash, hex, 32);
+  return hex;
+}
+
+namespace {
+struct CMultiBufferKeccak {
+  keccakf1600xn_fn *Permute;
+  unsigned N;
+  CMultiBufferKeccak() { Permute = keccakf1600xn_select(&N); }
+};
+}
+
+void sha3MultiHash(const std::string_view *messages, size_t count, std::string *hashes)
+{
+  static const CMultiBufferKeccak keccak;
+  if (!keccak.Permute || count < 2) {
+    for (size_t i = 0; i < count; i++) {
+      uint8_t hash[32];
+      sha3(messages[i].data(), messages[i].size(), hash, 32);
+      hashes[i] = sha3Hex(hash);
+    }
+    return;
+  }
+
+  sha3MultiHashKernel(keccak.Permute, keccak.N, messages, count, hashes);
+}
+
+void sha3MultiHashKernel(keccakf1600xn_fn *permute, unsigned n, const std::string_view *messages, size_t count, std::string *hashes)
+{
+  // SHA3-256 rate is 136 bytes (17 lanes)
+  static constexpr size_t rate = 136;
+  static constexpr size_t npos = static_cast<size_t>(-1);
+  alignas(64) uint64_t st[25*8];
+  size_t message[8];
+  size_t offset[8];
+  bool final[8];
+  size_t next = 0;
+  unsigned active = 0;
+
+  // Each lane takes next message as soon as previous one is finished,
+  // so messages of different sizes don't wait for the longest one
+  auto assign = [&](unsigned j) {
+    for (unsigned i = 0; i < 25; i++)
+      st[i*n + j] = 0;
+    final[j] = false;
+    offset[j] = 0;
+    if (next < count) {
+      message[j] = next++;
+      active++;
+    } else {
+      message[j] = npos;
+    }
+  };
+
+  for (unsigned j = 0; j < n; j++)
+    assign(j);
+
+  while (active) {
+    for (unsigned j = 0; j < n; j++) {
+      if (message[j] == npos)
+        continue;
+
+      const std::string_view &m = messages[message[j]];
+      const uint8_t *block = reinterpret_cast<const uint8_t*>(m.data()) + offset[j];
+      uint8_t padded[rate];
+      size_t remaining = m.size() - offset[j];
+      if (remaining >= rate) {
+        offset[j] += rate;
+      } else {
+        memset(padded, 0, rate);
+        memcpy(padded, block, remaining);
+        padded[remaining] ^= 0x06;
+        padded[rate - 1] ^= 0x80;
+        block = padded;
+        final[j] = true;
+      }
+
+      for (unsigned i = 0; i < rate/8; i++) {
+        uint64_t lane;
+        memcpy(&lane, block + i*8, 8);
+        st[i*n + j] ^= lane;
+      }
+    }
+
+    permute(st);
+
+    for (unsigned j = 0; j < n; j++) {
+      if (message[j] == npos || !final[j])
+        continue;
+
+      uint8_t hash[32];
+      for (unsigned i = 0; i < 4; i++)
+        memcpy(hash + i*8, &st[i*n + j], 8);
+      hashes[message[j]] = sha3Hex(hash);
+      active--;
+      assign(j);
+    }
+  }
+}
+
+void sha3FilesHash(const std::vector<std::filesystem::path> &paths, std::vector<std::string> &hashes)
+{
+  auto fileHash = [](InputFile &file) -> std::string {
+    sha3_ctx_t ctx;
+    sha3_init(&ctx, 32);
+    if (!file.readAll([&ctx](const uint8_t *data, size_t size) { sha3_update(&ctx, data, size); }))
+      return std::string();
+    uint8_t hash[32];
+    sha3_final(hash, &ctx, 0);
+    return sha3Hex(hash);
+  };
+
+  hashFilesBatched(paths, "sha3", fileHash, sha3MultiHash, hashes);
+}
@@ -1,6 +1,21 @@
 #pragma once
 
 #include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+extern "C" {
+#include "keccakf1600.h"
+}
 
 std::string sha3FileHash(const std::filesystem::path &path);
 std::string sha3StringHash(const std::string &s);
+
+// Hashes independent messages in parallel SIMD lanes (4 with AVX2, 8 with AVX-512),
+// hashes[i] receives hex SHA3-256 of messages[i]
+void sha3MultiHash(const std::string_view *messages, size_t count, std::string *hashes);
+// The same with given permutation of n interleaved states, n = 1 for single state one
+void sha3MultiHashKernel(keccakf1600xn_fn *permute, unsigned n, const std::string_view *messages, size_t count, std::string *hashes);
+// Hashes list of files, small files are read in batches and go through sha3MultiHash;
+// hash of unreadable file is empty string
+void sha3FilesHash(const std::vector<std::filesystem::path> &paths, std::vector<std::string> &hashes);
@@ -0,0 +1,269 @@
+#include "sourceCache.h"
+#include "sha3.h"
+#include "strExtras.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <utility>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#endif
+
+static const char indexHeader[] = "!cxxpm-source-cache 1";
+
+static std::filesystem::path indexPath(const std::filesystem::path &entry)
+{
+  std::filesystem::path path = entry;
+  path += ".files";
+  return path;
+}
+
+static uint64_t mtimeNs(const std::filesystem::path &path, std::error_code &ec)
+{
+  auto mtime = std::filesystem::last_write_time(path, ec);
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+}
+
+static unsigned permissionsOf(const std::filesystem::file_status &status)
+{
+  return static_cast<unsigned>(status.permissions() & std::filesystem::perms::mask);
+}
+
+// Splits tab separated line, last field takes rest of line
+static bool splitFields(const std::string &line, std::string *fields, size_t count)
+{
+  size_t pos = 0;
+  for (size_t i = 0; i + 1 < count; i++) {
+    size_t next = line.find('\t', pos);
+    if (next == line.npos)
+      return false;
+    fields[i] = line.substr(pos, next - pos);
+    pos = next + 1;
+  }
+  fields[count - 1] = line.substr(pos);
+  return true;
+}
+
+// Reflink is tried for each file, file system may refuse it for some files only (other mount
+// under source tree, unaligned tail on some file systems)
+static bool linkFile(const std::filesystem::path &source, const std::filesystem::path &target, ESourceLinkMode &mode)
+{
+#ifdef __linux__
+  int input = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (input == -1)
+    return false;
+  struct stat s;
+  int output = fstat(input, &s) == 0 ? open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, s.st_mode & 07777) : -1;
+  if (output == -1) {
+    close(input);
+    return false;
+  }
+
+  bool cloned = ioctl(output, FICLONE, input) == 0;
+  int error = errno;
+  if (cloned) {
+    // Clone is new inode, attributes are copied as tar sets them
+    struct timespec times[2] = {s.st_atim, s.st_mtim};
+    cloned = futimens(output, times) == 0 && fchmod(output, s.st_mode & 07777) == 0;
+  }
+  close(input);
+  close(output);
+  if (cloned) {
+    mode = ESourceLinkMode::Reflink;
+    return true;
+  }
+
+  unlink(target.c_str());
+  if (error != EOPNOTSUPP && error != EXDEV && error != EINVAL && error != ENOTTY && error != EPERM)
+    return false;
+#endif
+
+  std::error_code ec;
+  mode = ESourceLinkMode::Copy;
+  if (!std::filesystem::copy_file(source, target, ec))
+    return false;
+  std::filesystem::last_write_time(target, std::filesystem::last_write_time(source, ec), ec);
+  return !ec;
+}
+
+void clearDirectory(const std::filesystem::path &path)
+{
+  std::error_code ec;
+  for (const auto &element: std::filesystem::directory_iterator(path, ec)) {
+    // Read-only directories from archive can't be cleaned otherwise
+    std::error_code removeEc;
+    if (element.is_directory(removeEc) && !element.is_symlink(removeEc))
+      std::filesystem::permissions(element.path(), std::filesystem::perms::owner_all, std::filesystem::perm_options::add, removeEc);
+    std::filesystem::remove_all(element.path(), removeEc);
+  }
+}
+
+std::string sourceCacheKey(const std::string &archiveSha3,
+                           const std::string &patchDirectory,
+                           const std::vector<std::filesystem::path> &patches)
+{
+  std::string data = archiveSha3;
+  data.push_back('\n');
+  data.append(patchDirectory);
+  data.push_back('\n');
+  for (const auto &patch: patches) {
+    data.append(patch.filename().string());
+    data.push_back(' ');
+    data.append(sha3FileHash(patch));
+    data.push_back('\n');
+  }
+  return sha3StringHash(data).substr(0, 32);
+}
+
+std::filesystem::path sourceCacheEntry(const std::filesystem::path &cacheDirectory, const std::string &key)
+{
+  return cacheDirectory / key;
+}
+
+bool sourceCacheReady(const std::filesystem::path &entry)
+{
+  std::error_code ec;
+  return std::filesystem::is_directory(entry, ec) && std::filesystem::exists(indexPath(entry), ec);
+}
+
+bool sourceCacheStaging(const std::filesystem::path &entry, std::filesystem::path &staging)
+{
+  std::error_code ec;
+  staging = entry;
+  staging += ".tmp";
+  sourceCacheRemove(entry);
+  std::filesystem::remove_all(staging, ec);
+  if (!std::filesystem::create_directories(staging, ec)) {
+    fprintf(stderr, "ERROR: can't create directory at %s\n", staging.string().c_str());
+    return false;
+  }
+  return true;
+}
+
+bool sourceCacheCommit(const std::filesystem::path &entry)
+{
+  std::filesystem::path staging = entry;
+  staging += ".tmp";
+  std::filesystem::path index = indexPath(entry);
+  std::filesystem::path indexTmp = index;
+  indexTmp += ".tmp";
+
+  // Format: "d <permissions> <path>", "f <permissions> <size> <mtime_ns> <path>",
+  // "l <path> <target>", fields separated by tab, directories precede their content
+  std::ofstream out(indexTmp, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    fprintf(stderr, "ERROR: can't create file %s\n", indexTmp.string().c_str());
+    return false;
+  }
+
+  out << indexHeader << '\n';
+  std::error_code ec;
+  for (auto it = std::filesystem::recursive_directory_iterator(staging, ec), end = std::filesystem::recursive_directory_iterator(); !ec && it != end; it.increment(ec)) {
+    std::string relativePath = it->path().lexically_relative(staging).generic_string();
+    std::filesystem::file_status status = it->symlink_status(ec);
+    if (ec)
+      break;
+    if (std::filesystem::is_symlink(status)) {
+      std::filesystem::path target = std::filesystem::read_symlink(it->path(), ec);
+      out << "l\t" << relativePath << '\t' << target.string() << '\n';
+    } else if (std::filesystem::is_directory(status)) {
+      out << "d\t" << permissionsOf(status) << '\t' << relativePath << '\n';
+    } else if (std::filesystem::is_regular_file(status)) {
+      uint64_t size = it->file_size(ec);
+      uint64_t mtime = ec ? 0 : mtimeNs(it->path(), ec);
+      out << "f\t" << permissionsOf(status) << '\t' << size << '\t' << mtime << '\t' << relativePath << '\n';
+    }
+  }
+
+  out.close();
+  if (ec || !out) {
+    fprintf(stderr, "ERROR: can't write file %s\n", indexTmp.string().c_str());
+    std::filesystem::remove(indexTmp, ec);
+    return false;
+  }
+
+  // Entry is complete when its file list appears
+  std::filesystem::rename(staging, entry, ec);
+  if (!ec)
+    std::filesystem::rename(indexTmp, index, ec);
+  if (ec) {
+    fprintf(stderr, "ERROR: can't rename %s to %s\n", staging.string().c_str(), entry.string().c_str());
+    return false;
+  }
+  return true;
+}
+
+void sourceCacheRemove(const std::filesystem::path &entry)
+{
+  std::error_code ec;
+  std::filesystem::remove(indexPath(entry), ec);
+  if (std::filesystem::exists(entry, ec)) {
+    clearDirectory(entry);
+    std::filesystem::remove_all(entry, ec);
+  }
+}
+
+bool sourceCacheMaterialize(const std::filesystem::path &entry,
+                            const std::filesystem::path &destination,
+                            size_t &filesNum,
+                            ESourceLinkMode &mode)
+{
+  std::ifstream index(indexPath(entry), std::ios::binary);
+  std::string line;
+  if (!std::getline(index, line) || line != indexHeader)
+    return false;
+
+  // Permissions of directories are restored when their content created
+  std::vector<std::pair<std::filesystem::path, unsigned>> directories;
+  std::string fields[5];
+  bool success = true;
+  filesNum = 0;
+  mode = ESourceLinkMode::Reflink;
+  while (success && std::getline(index, line)) {
+    std::error_code ec;
+    if (startsWith(line, "d\t") && splitFields(line.substr(2), fields, 2)) {
+      std::filesystem::path path = destination / fields[1];
+      std::filesystem::create_directory(path, ec);
+      directories.emplace_back(path, strtoul(fields[0].c_str(), nullptr, 10));
+      success = !ec;
+    } else if (startsWith(line, "f\t") && splitFields(line.substr(2), fields, 4)) {
+      // Entry file changed since commit makes entry stale
+      std::filesystem::path source = entry / fields[3];
+      ESourceLinkMode fileMode = ESourceLinkMode::Reflink;
+      std::filesystem::file_status status = std::filesystem::status(source, ec);
+      success = !ec &&
+                std::filesystem::is_regular_file(status) &&
+                permissionsOf(status) == strtoul(fields[0].c_str(), nullptr, 10) &&
+                std::filesystem::file_size(source, ec) == strtoull(fields[1].c_str(), nullptr, 10) &&
+                !ec &&
+                mtimeNs(source, ec) == strtoull(fields[2].c_str(), nullptr, 10) &&
+                !ec &&
+                linkFile(source, destination / fields[3], fileMode);
+      mode = std::max(mode, fileMode);
+      filesNum++;
+    } else if (startsWith(line, "l\t") && splitFields(line.substr(2), fields, 2)) {
+      std::filesystem::create_symlink(fields[1], destination / fields[0], ec);
+      success = !ec;
+    } else {
+      success = false;
+    }
+  }
+
+  for (auto it = directories.rbegin(); it != directories.rend(); ++it) {
+    std::error_code ec;
+    std::filesystem::permissions(it->first, static_cast<std::filesystem::perms>(it->second), ec);
+  }
+
+  if (!success)
+    clearDirectory(destination);
+  return success;
+}
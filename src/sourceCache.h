@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Cache of pristine source trees: archive is extracted and patched once to entry directory
+// <cacheDirectory>/<key>, next to it "<key>.files" lists entry files with their size, mode and
+// mtime. Workspace is filled from entry by reflinks (FICLONE) where file system supports them,
+// else by copies; files are never shared with workspace, build may change them in place. Entry
+// which file was changed anyway is found stale on next use and extracted again
+enum class ESourceLinkMode : unsigned {
+  Reflink = 0,
+  Copy
+};
+
+// Key of extracted archive with patches applied in patchDirectory (relative to tree root)
+std::string sourceCacheKey(const std::string &archiveSha3,
+                           const std::string &patchDirectory,
+                           const std::vector<std::filesystem::path> &patches);
+std::filesystem::path sourceCacheEntry(const std::filesystem::path &cacheDirectory, const std::string &key);
+// Entry is complete, its file list is written
+bool sourceCacheReady(const std::filesystem::path &entry);
+// Empty directory for new entry, files put there become entry after sourceCacheCommit
+bool sourceCacheStaging(const std::filesystem::path &entry, std::filesystem::path &staging);
+bool sourceCacheCommit(const std::filesystem::path &entry);
+void sourceCacheRemove(const std::filesystem::path &entry);
+// Fills empty destination directory from entry, mode is Copy if any file was copied. Returns
+// false if entry files were changed since commit or on error, destination is left empty then
+bool sourceCacheMaterialize(const std::filesystem::path &entry,
+                            const std::filesystem::path &destination,
+                            size_t &filesNum,
+                            ESourceLinkMode &mode);
+// Removes content of directory, read-only subdirectories from archives included
+void clearDirectory(const std::filesystem::path &path);
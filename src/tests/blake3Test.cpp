@@ -0,0 +1,143 @@
+// BLAKE3 known answers (official test_vectors.json, input byte i is i % 251) through every
+// hashMany kernel supported by current CPU, single threaded and with subtrees split between
+// threads, data passed to update at once and in pieces crossing block and chunk boundaries
+#include "blake3.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct CVector {
+  size_t Size;
+  const char *Hash;
+};
+
+static std::string bytePattern(size_t size)
+{
+  std::string data;
+  for (size_t i = 0; i < size; i++)
+    data.push_back(static_cast<char>(i % 251));
+  return data;
+}
+
+static std::string toHex(const uint8_t *hash)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string hex;
+  for (unsigned i = 0; i < 32; i++) {
+    hex.push_back(digits[hash[i] >> 4]);
+    hex.push_back(digits[hash[i] & 0xF]);
+  }
+  return hex;
+}
+
+// Piece sizes repeat cyclically, empty list means single update
+static std::string hashPieces(const std::string &data, const std::vector<size_t> &pieces)
+{
+  Blake3Hasher hasher;
+  if (pieces.empty()) {
+    hasher.update(data.data(), data.size());
+  } else {
+    size_t offset = 0;
+    for (size_t i = 0; offset < data.size(); i++) {
+      size_t size = std::min(pieces[i % pieces.size()], data.size() - offset);
+      hasher.update(data.data() + offset, size);
+      offset += size;
+    }
+  }
+
+  uint8_t hash[32];
+  hasher.final(hash);
+  return toHex(hash);
+}
+
+int main()
+{
+  const std::vector<CVector> vectors = {
+    {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+    {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+    {1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+    {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+    {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+    {2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+    {2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"},
+    {3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2"},
+    {3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"},
+    {4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969"},
+    {4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995"},
+    {5120, "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833"},
+    {5121, "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff"},
+    {6144, "3e2e5b74e048f3add6d21faab3f83aa44d3b2278afb83b80b3c35164ebeca205"},
+    {6145, "f1323a8631446cc50536a9f705ee5cb619424d46887f3c376c695b70e0f0507f"},
+    {7168, "61da957ec2499a95d6b8023e2b0e604ec7f6b50e80a9678b89d2628e99ada77a"},
+    {7169, "a003fc7a51754a9b3c7fae0367ab3d782dccf28855a03d435f8cfe74605e7817"},
+    {8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63"},
+    {8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+    {16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4"},
+    {31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"},
+    {102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+    // Not in official list: subtrees above 64 chunks, split recursively between threads
+    {1049601, "860f19b5fefff01454de342be87a20059449529116a20fb22a21da665aafa071"}
+  };
+
+  // Single update, single bytes, and sizes straddling block (64) and chunk (1024) boundaries
+  const std::vector<std::vector<size_t>> splits = {
+    {},
+    {1},
+    {63, 1025, 64, 4097, 1, 1024, 2049}
+  };
+
+  struct CThreading {
+    const char *Name;
+    unsigned Threads;
+    size_t Threshold;
+  };
+
+  // Low threshold makes every subtree of 4 chunks and more to be split between threads
+  const CThreading threadings[] = {
+    {"single thread", 1, 0},
+    {"4 threads", 4, 2048}
+  };
+
+  unsigned failures = 0;
+  for (const auto &kernel: blake3Kernels()) {
+    if (!blake3ForceKernel(kernel)) {
+      fprintf(stderr, "FAILED: can't select kernel %s\n", kernel.c_str());
+      failures++;
+      continue;
+    }
+
+    printf("kernel %s\n", kernel.c_str());
+    for (const auto &threading: threadings) {
+      blake3ForceThreading(threading.Threads, threading.Threshold);
+      for (const auto &v: vectors) {
+        std::string data = bytePattern(v.Size);
+        for (size_t i = 0; i < splits.size(); i++) {
+          std::string hash = hashPieces(data, splits[i]);
+          if (hash != v.Hash) {
+            fprintf(stderr, "FAILED: %s, %s, split %zu, %zu bytes: %s, expected %s\n", kernel.c_str(), threading.Name, i, v.Size, hash.c_str(), v.Hash);
+            failures++;
+          }
+        }
+      }
+    }
+  }
+
+  blake3ForceKernel(std::string());
+  blake3ForceThreading(0, 0);
+  for (const auto &v: vectors) {
+    std::string hash = blake3StringHash(bytePattern(v.Size));
+    if (hash != v.Hash) {
+      fprintf(stderr, "FAILED: blake3StringHash, %zu bytes: %s, expected %s\n", v.Size, hash.c_str(), v.Hash);
+      failures++;
+    }
+  }
+
+  if (failures) {
+    fprintf(stderr, "%u checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
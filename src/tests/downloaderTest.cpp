@@ -0,0 +1,178 @@
+// Downloader against local HTTP server (downloaderTestServer.py): large file fetched by parallel
+// range requests, resume of not received ranges from .part.state and of existing part of file,
+// fallback to whole file when server ignores Range
+#include "downloader.h"
+#include "sha3.h"
+
+#include <curl/curl.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static unsigned gFailures = 0;
+
+static void check(bool condition, const char *name)
+{
+  if (!condition) {
+    fprintf(stderr, "FAILED: %s\n", name);
+    gFailures++;
+  }
+}
+
+// Same generator as in server: 65521 bytes of LCG output repeated
+static std::string content(size_t size)
+{
+  std::string block(65521, '\0');
+  uint32_t x = 1;
+  for (auto &c: block) {
+    x = x*1103515245u + 12345u;
+    c = static_cast<char>(x >> 24);
+  }
+
+  std::string data;
+  data.reserve(size + block.size());
+  while (data.size() < size)
+    data.append(block);
+  data.resize(size);
+  return data;
+}
+
+static bool writeFile(const std::filesystem::path &path, const std::string &data)
+{
+  FILE *hFile = fopen(path.string().c_str(), "wb");
+  if (!hFile)
+    return false;
+  bool success = fwrite(data.data(), 1, data.size(), hFile) == data.size();
+  return fclose(hFile) == 0 && success;
+}
+
+static std::string readFile(const std::filesystem::path &path)
+{
+  std::string data;
+  FILE *hFile = fopen(path.string().c_str(), "rb");
+  if (!hFile)
+    return data;
+  char buffer[65536];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), hFile)) > 0)
+    data.append(buffer, size);
+  fclose(hFile);
+  return data;
+}
+
+struct CServerStats {
+  unsigned long long Requests = 0;
+  unsigned long long Ranged = 0;
+  unsigned long long Bytes = 0;
+};
+
+// GET requests served since previous call
+static CServerStats serverStats(const std::string &url)
+{
+  CServerStats stats;
+  std::string response;
+  CURL *handle = curl_easy_init();
+  curl_easy_setopt(handle, CURLOPT_URL, (url + "/stats").c_str());
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, +[](char *data, size_t size, size_t count, void *arg) -> size_t {
+    static_cast<std::string*>(arg)->append(data, size*count);
+    return size*count;
+  });
+  curl_easy_setopt(handle, CURLOPT_WRITEDATA, &response);
+  if (curl_easy_perform(handle) != CURLE_OK || sscanf(response.c_str(), "%llu %llu %llu", &stats.Requests, &stats.Ranged, &stats.Bytes) != 3)
+    fprintf(stderr, "can't get server stats\n");
+  curl_easy_cleanup(handle);
+  return stats;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <server url>\n", argv[0]);
+    return 1;
+  }
+
+  std::string url = argv[1];
+  std::filesystem::path directory = std::filesystem::temp_directory_path() / "cxx-pm-downloader-test";
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+  std::filesystem::path path = directory / "file.part";
+  std::filesystem::path state = directory / "file.part.state";
+  std::string sha3;
+
+  // 20 MiB is split to 4 ranges of 5 MiB fetched concurrently
+  {
+    const size_t size = 20u << 20;
+    std::string expected = content(size);
+    serverStats(url);
+    Downloader downloader(false);
+    check(downloader.download(url + "/ranges/" + std::to_string(size), path, sha3, 60, nullptr), "segmented download succeeds");
+    CServerStats stats = serverStats(url);
+    check(stats.Requests == 4 && stats.Ranged == 4, "large file is fetched by 4 range requests");
+    check(stats.Bytes == size, "each byte is sent once");
+    check(sha3 == sha3StringHash(expected), "hash of segmented download");
+    check(readFile(path) == expected, "content of segmented download");
+    check(!std::filesystem::exists(state), "state of complete download is removed");
+    Downloader::discard(path);
+  }
+
+  // Only ranges listed in state are requested, data outside them is kept
+  {
+    const size_t size = 3u << 20;
+    std::string expected = content(size);
+    std::string part = expected;
+    std::fill(part.begin(), part.begin() + 100000, '\0');
+    std::fill(part.begin() + 2000000, part.end(), '\0');
+    check(writeFile(path, part), "write part file");
+    check(writeFile(state, std::to_string(size) + "\n0 100000\n2000000 " + std::to_string(size) + "\n"), "write state file");
+    serverStats(url);
+    Downloader downloader(false);
+    check(downloader.download(url + "/ranges/" + std::to_string(size), path, sha3, 60, nullptr), "download resumed from state succeeds");
+    CServerStats stats = serverStats(url);
+    check(stats.Requests == 2 && stats.Ranged == 2, "each not received range is requested");
+    check(stats.Bytes == 100000 + size - 2000000, "received ranges are not fetched again");
+    check(sha3 == sha3StringHash(expected), "hash of download resumed from state");
+    check(readFile(path) == expected, "content of download resumed from state");
+    check(!std::filesystem::exists(state), "state of resumed download is removed");
+    Downloader::discard(path);
+  }
+
+  // Existing part of file without state is continued
+  {
+    const size_t size = 3u << 20;
+    std::string expected = content(size);
+    check(writeFile(path, expected.substr(0, 1u << 20)), "write part file");
+    serverStats(url);
+    Downloader downloader(false);
+    check(downloader.download(url + "/ranges/" + std::to_string(size), path, sha3, 60, nullptr), "download continued after part succeeds");
+    CServerStats stats = serverStats(url);
+    check(stats.Requests == 1 && stats.Ranged == 1 && stats.Bytes == size - (1u << 20), "only rest of file is fetched");
+    check(sha3 == sha3StringHash(expected), "hash of download continued after part");
+    Downloader::discard(path);
+  }
+
+  // Server claiming range support but sending whole file: segmented attempt and existing part
+  // are dropped, file is received by single request
+  for (size_t existing: {size_t(0), size_t(1u << 20)}) {
+    const size_t size = 20u << 20;
+    std::string expected = content(size);
+    if (existing)
+      check(writeFile(path, expected.substr(0, existing)), "write part file");
+    serverStats(url);
+    Downloader downloader(false);
+    check(downloader.download(url + "/norange/" + std::to_string(size), path, sha3, 60, nullptr), "download from server ignoring ranges succeeds");
+    CServerStats stats = serverStats(url);
+    check(stats.Ranged == 0 && stats.Requests >= 2, "range requests are replaced by whole file request");
+    check(sha3 == sha3StringHash(expected), "hash of download from server ignoring ranges");
+    check(readFile(path) == expected, "content of download from server ignoring ranges");
+    Downloader::discard(path);
+  }
+
+  std::filesystem::remove_all(directory);
+  if (gFailures) {
+    fprintf(stderr, "%u checks failed\n", gFailures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
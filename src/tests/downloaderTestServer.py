@@ -0,0 +1,87 @@
+# Local HTTP server for downloader test, runs test executable given as first argument with
+# server URL. /ranges/<size> serves generated file with Range support, /norange/<size> claims
+# "Accept-Ranges: bytes" but sends whole file to every request. /stats returns counters of GET
+# requests since previous /stats: "<requests> <ranged requests> <body bytes sent>"
+import http.server
+import subprocess
+import sys
+import threading
+
+lock = threading.Lock()
+stats = [0, 0, 0]
+cache = {}
+
+# Same generator as in downloaderTest.cpp: 65521 bytes of LCG output repeated
+def content(size):
+    with lock:
+        if size not in cache:
+            x = 1
+            block = bytearray(65521)
+            for i in range(len(block)):
+                x = (x * 1103515245 + 12345) & 0xFFFFFFFF
+                block[i] = x >> 24
+            cache[size] = (bytes(block) * (size // len(block) + 1))[:size]
+        return cache[size]
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_HEAD(self):
+        self.respond(False)
+
+    def do_GET(self):
+        self.respond(True)
+
+    def respond(self, body):
+        mode, _, size = self.path.strip("/").partition("/")
+        if mode == "stats":
+            with lock:
+                data = ("%u %u %u" % tuple(stats)).encode()
+                stats[:] = [0, 0, 0]
+            self.send(200, data, body)
+            return
+        if mode not in ("ranges", "norange") or not size.isdigit():
+            self.send(404, b"", body)
+            return
+
+        data = content(int(size))
+        begin, end = 0, len(data)
+        requested = self.headers.get("Range")
+        ranged = mode == "ranges" and requested is not None and requested.startswith("bytes=")
+        if ranged:
+            first, _, last = requested[6:].partition("-")
+            begin, end = int(first), min(int(last) + 1 if last else len(data), len(data))
+        if body:
+            with lock:
+                stats[0] += 1
+                stats[1] += ranged
+        self.send(206 if ranged else 200, data[begin:end], body, (begin, end, len(data)) if ranged else None)
+
+    def send(self, code, data, body, contentRange=None):
+        self.send_response(code)
+        self.send_header("Content-Length", str(len(data)))
+        self.send_header("Accept-Ranges", "bytes")
+        if contentRange:
+            self.send_header("Content-Range", "bytes %u-%u/%u" % (contentRange[0], contentRange[1] - 1, contentRange[2]))
+        self.end_headers()
+        if not body:
+            return
+        # Client drops connection when it gets whole file instead of range
+        try:
+            for offset in range(0, len(data), 1 << 16):
+                self.wfile.write(data[offset:offset + (1 << 16)])
+                if code != 404 and not self.path.startswith("/stats"):
+                    with lock:
+                        stats[2] += min(1 << 16, len(data) - offset)
+        except (BrokenPipeError, ConnectionResetError):
+            self.close_connection = True
+
+server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+server.daemon_threads = True
+threading.Thread(target=server.serve_forever, daemon=True).start()
+result = subprocess.call([sys.argv[1], "http://127.0.0.1:%u" % server.server_address[1]])
+server.shutdown()
+sys.exit(result)
@@ -0,0 +1,152 @@
+// ProcessExecutor: exit status and output of children, concurrency limit, timeout killing
+// process group, early stop by output callback, exit of child which closed its output;
+// runNoCapture timeout killing process group; PATH lookup after permission change
+#include "exec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+static unsigned gFailures = 0;
+
+static void check(bool condition, const char *name)
+{
+  if (!condition) {
+    fprintf(stderr, "FAILED: %s\n", name);
+    gFailures++;
+  }
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point beginPt)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - beginPt).count();
+}
+
+static std::future<CProcessResult> launchShell(ProcessExecutor &executor, const std::string &script, const OutputCallback &callback = OutputCallback(), unsigned timeout = 0)
+{
+  return executor.launch(".", "sh", { "-c", script }, {}, callback, false, true, timeout);
+}
+
+int main()
+{
+  // Exit status and captured output
+  {
+    ProcessExecutor executor;
+    std::string output;
+    auto success = launchShell(executor, "echo hello", [&output](EOutputStream, const char *data, size_t size) {
+      output.append(data, size);
+      return true;
+    });
+    auto failure = launchShell(executor, "exit 3");
+    auto missing = executor.launch(".", "cxx-pm-no-such-executable", {}, {}, OutputCallback(), false, false);
+    check(success.get().Success, "exit 0 is success");
+    check(output == "hello\n", "stdout is passed to callback");
+    check(!failure.get().Success, "exit 3 is failure");
+    check(!missing.get().Success, "missing executable is failure");
+  }
+
+  // No more than 2 of 6 children run at once: three rounds of 0.3 s sleeps
+  {
+    ProcessExecutor executor(2);
+    auto beginPt = std::chrono::steady_clock::now();
+    std::vector<std::future<CProcessResult>> results;
+    for (unsigned i = 0; i < 6; i++)
+      results.push_back(launchShell(executor, "sleep 0.3"));
+    bool allSucceeded = true;
+    for (auto &result: results)
+      allSucceeded &= result.get().Success;
+    double seconds = secondsSince(beginPt);
+    check(allSucceeded, "limited children succeed");
+    check(seconds >= 0.85, "concurrency limit holds children in queue");
+    check(seconds < 1.8, "children up to limit run concurrently");
+  }
+
+  // Timeout kills whole process group: background sleep keeps pipe open until killed
+  {
+    ProcessExecutor executor;
+    auto beginPt = std::chrono::steady_clock::now();
+    auto result = launchShell(executor, "sleep 30 & wait", [](EOutputStream, const char*, size_t) { return true; }, 1);
+    check(!result.get().Success, "timed out child is failure");
+    check(secondsSince(beginPt) < 5, "timed out child and its descendants are killed");
+  }
+
+  // Callback returning false stops endless child, run is success
+  {
+    ProcessExecutor executor;
+    std::atomic<unsigned> calls = 0;
+    auto beginPt = std::chrono::steady_clock::now();
+    auto result = launchShell(executor, "while :; do echo line; sleep 0.01; done", [&calls](EOutputStream, const char*, size_t) {
+      calls++;
+      return false;
+    });
+    check(result.get().Success, "stopped child is success");
+    check(calls == 1, "callback is not called after it returned false");
+    check(secondsSince(beginPt) < 5, "stopped child is killed");
+  }
+
+  // Child closed its stdout long before exit, completion comes from exit notification
+  {
+    ProcessExecutor executor;
+    auto beginPt = std::chrono::steady_clock::now();
+    auto result = launchShell(executor, "exec >&-; sleep 0.5; exit 0", [](EOutputStream, const char*, size_t) { return true; });
+    check(result.get().Success, "child with closed stdout is success");
+    check(secondsSince(beginPt) >= 0.45, "child is complete only after exit");
+  }
+
+  // Destructor waits for launched children
+  {
+    std::future<CProcessResult> result;
+    {
+      ProcessExecutor executor(1);
+      launchShell(executor, "sleep 0.2");
+      result = launchShell(executor, "true");
+    }
+    check(result.wait_for(std::chrono::seconds(0)) == std::future_status::ready && result.get().Success, "destructor waits for queued children");
+  }
+
+  // Timeout of child with inherited stdio kills its descendants: background job would
+  // create marker file after child is killed
+  {
+    std::filesystem::path marker = std::filesystem::temp_directory_path() / "cxx-pm-exec-test-marker";
+    std::filesystem::remove(marker);
+    std::string script = "(sleep 2; touch '" + marker.string() + "') & wait";
+    check(!runNoCapture(".", "sh", { "-c", script }, {}, true, nullptr, 1), "timed out child without capture is failure");
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+    check(!std::filesystem::exists(marker), "descendants of timed out child without capture are killed");
+    std::filesystem::remove(marker);
+  }
+
+  // Permission change doesn't touch directory mtime, snapshot of PATH directory must not
+  // keep file not executable at first lookup
+  {
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "cxx-pm-exec-test-path";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::filesystem::path tool = directory / "cxx-pm-test-tool";
+    FILE *hFile = fopen(tool.c_str(), "w");
+    fputs("#!/bin/sh\nexit 0\n", hFile);
+    fclose(hFile);
+
+    std::string path = getenv("PATH");
+    setenv("PATH", (path + ":" + directory.string()).c_str(), 1);
+    updatePath();
+    check(!runNoCapture(".", "cxx-pm-test-tool", {}, {}, false), "file without execute permission is not found");
+    std::filesystem::permissions(tool, std::filesystem::perms::owner_exec, std::filesystem::perm_options::add);
+    check(runNoCapture(".", "cxx-pm-test-tool", {}, {}, false), "file found after chmod +x");
+    setenv("PATH", path.c_str(), 1);
+    updatePath();
+    std::filesystem::remove_all(directory);
+  }
+
+  if (gFailures) {
+    fprintf(stderr, "%u checks failed\n", gFailures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
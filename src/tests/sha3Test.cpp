@@ -0,0 +1,87 @@
+// FIPS 202 SHA3-256 known answers through every Keccak-f[1600] kernel supported by current CPU,
+// single state and multi-buffer ones, and through dispatching sha3StringHash/sha3MultiHash
+#include "sha3.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+struct CVector {
+  const char *Name;
+  std::string Message;
+  const char *Hash;
+};
+
+static std::string bytePattern(size_t size)
+{
+  std::string data;
+  for (size_t i = 0; i < size; i++)
+    data.push_back(static_cast<char>(i & 0xFF));
+  return data;
+}
+
+int main()
+{
+  const std::vector<CVector> vectors = {
+    {"empty", "", "a7ffc6f8bf1ed76651c14756a061d662f580ff4de43b49fa82d80a4b80f8434a"},
+    {"abc", "abc", "3a985da74fe225b2045c172d6bd390bd855f086e3e9d525b46bfe24511431532"},
+    {"448 bits", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "41c0dba2a9d6240849100376a8235e2c82e1b9998a999e21db32dd97496d3376"},
+    {"896 bits", "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", "916f6061fe879741ca6469b43971dfdb28b1a32dc36cb3254e812be27aad1d18"},
+    {"1600 bits of 0xa3", std::string(200, '\xa3'), "79f38adec5c20307a98ef76e8324afbfd46cfd81b22e3973c65fa1bd9de31787"},
+    // Lengths around rate (136 bytes) and two full blocks
+    {"135 bytes", bytePattern(135), "fded8fd9d6551c601eeb3b7c6bc5e5cfd8aad1d015b7e9aaa9c9b9475231d5e2"},
+    {"136 bytes", bytePattern(136), "cf3ccff92480a29160c2d38317c430e14749bfee1788106957dfe73f8c4930e5"},
+    {"137 bytes", bytePattern(137), "ce9d7dc90913ee5d92745019479a5352c6d6279bef18ed07dc0a83ee8084daca"},
+    {"272 bytes", bytePattern(272), "0b21ec4a8eff6d179e09ba9fe0ab08515b24e0923fbf419f5c30a38e64577db5"},
+    {"million a", std::string(1000000, 'a'), "5c8875ae474a3634ba4fd55ec85bffd661f32aca75c6d699d0cdcb6c115891c1"}
+  };
+
+  // Repeated list is longer than widest kernel, lanes take next messages of different sizes
+  std::vector<std::string_view> messages;
+  std::vector<const CVector*> expected;
+  for (unsigned round = 0; round < 3; round++) {
+    for (const auto &v: vectors) {
+      messages.emplace_back(v.Message);
+      expected.push_back(&v);
+    }
+  }
+
+  unsigned failures = 0;
+  auto check = [&failures](const char *kernel, const CVector &v, const std::string &hash) {
+    if (hash != v.Hash) {
+      fprintf(stderr, "FAILED: %s, %s: %s, expected %s\n", kernel, v.Name, hash.c_str(), v.Hash);
+      failures++;
+    }
+  };
+
+  keccakf1600_kernel kernels[8];
+  unsigned kernelsNum = keccakf1600_kernels(kernels, 8);
+  std::vector<std::string> hashes(messages.size());
+  for (unsigned k = 0; k < kernelsNum; k++) {
+    printf("kernel %s (%u states)\n", kernels[k].name, kernels[k].n);
+    // Single message leaves other lanes idle
+    for (const auto &v: vectors) {
+      std::string_view message(v.Message);
+      std::string hash;
+      sha3MultiHashKernel(kernels[k].fn, kernels[k].n, &message, 1, &hash);
+      check(kernels[k].name, v, hash);
+    }
+
+    sha3MultiHashKernel(kernels[k].fn, kernels[k].n, messages.data(), messages.size(), hashes.data());
+    for (size_t i = 0; i < messages.size(); i++)
+      check(kernels[k].name, *expected[i], hashes[i]);
+  }
+
+  for (const auto &v: vectors)
+    check("sha3StringHash", v, sha3StringHash(v.Message));
+  sha3MultiHash(messages.data(), messages.size(), hashes.data());
+  for (size_t i = 0; i < messages.size(); i++)
+    check("sha3MultiHash", *expected[i], hashes[i]);
+
+  if (failures) {
+    fprintf(stderr, "%u checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
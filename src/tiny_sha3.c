@@ -11,9 +11,12 @@
 
 #include "tiny_sha3.h"
 
+#include <string.h>
+
 // update the state with given number of rounds
+// portable reference version, sha3_keccakf (keccakf1600.c) selects optimized one
 
-void sha3_keccakf(uint64_t st[25])
+void sha3_keccakf_ref(uint64_t st[25])
 {
     // constants
     const uint64_t keccakf_rndc[24] = {
@@ -126,7 +129,22 @@ int sha3_update(sha3_ctx_t *c, const void *data, size_t len)
     int j;
 
     j = c->pt;
-    for (i = 0; i < len; i++) {
+    i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // absorb whole blocks by 64-bit lanes
+    if (j == 0) {
+        int k;
+        uint64_t v;
+        for (; len - i >= (size_t) c->rsiz; i += c->rsiz) {
+            for (k = 0; k < c->rsiz / 8; k++) {
+                memcpy(&v, (const uint8_t *) data + i + k*8, 8);
+                c->st.q[k] ^= v;
+            }
+            sha3_keccakf(c->st.q);
+        }
+    }
+#endif
+    for (; i < len; i++) {
         c->st.b[j++] ^= ((const uint8_t *) data)[i];
         if (j >= c->rsiz) {
             sha3_keccakf(c->st.q);
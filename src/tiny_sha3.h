@@ -31,6 +31,7 @@ typedef struct {
 
 // Compression function.
 void sha3_keccakf(uint64_t st[25]);
+void sha3_keccakf_ref(uint64_t st[25]);
 
 // OpenSSL - like interfece
 int sha3_init(sha3_ctx_t *c, int mdlen);    // mdlen = hash output in bytes